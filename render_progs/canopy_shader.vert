@@ -47,19 +47,6 @@ mat4 translate(vec3 delta)
         vec4(delta, 1.0));
 }
 
-mat4 rotate(vec3 axis, float angle)
-{
-    axis = normalize(axis);
-    float s = sin(angle);
-    float c = cos(angle);
-    float oc = 1.0 - c;
-    
-    return mat4(oc * axis.x * axis.x + c,           oc * axis.x * axis.y - axis.z * s,  oc * axis.z * axis.x + axis.y * s,  0.0,
-                oc * axis.x * axis.y + axis.z * s,  oc * axis.y * axis.y + c,           oc * axis.y * axis.z - axis.x * s,  0.0,
-                oc * axis.z * axis.x - axis.y * s,  oc * axis.y * axis.z + axis.x * s,  oc * axis.z * axis.z + c,           0.0,
-                0.0,                                0.0,                                0.0,                                1.0);
-}
-
 mat4 scale(vec3 axis)
 {
 	return mat4(
@@ -69,21 +56,20 @@ mat4 scale(vec3 axis)
 		vec4(0.0, 0.0, 0.0, 1.0));
 }
 
-#define NOISE fbm
-#define NUM_NOISE_OCTAVES 5
-#define MAX_TERRAIN_BLOCKS 100000
-
-#define NUM_OCTAVES 5
+// Layers of plant_noise. See plant_noise.h
+#define PLANT_NOISE_INDIVIDUAL_OFFSET 0
+#define PLANT_NOISE_GROUP_OFFSET 1
+uniform sampler2DArray plant_noise;
 
-float rand(vec2 n) 
-{ 
-	return fract(sin(dot(n, vec2(12.9898, 4.1414))) * 43758.5453);
+vec4 get_plant_noise(int layer, ivec2 id)
+{
+	return texelFetch(plant_noise, ivec3(id % textureSize(plant_noise, 0).xy, layer), 0);
 }
 
 void main()
 {
-	float x_id = float(gl_InstanceID % total);
-	float z_id = float(gl_InstanceID / total);
+	int x_id = int(gl_InstanceID % total);
+	int z_id = int(gl_InstanceID / total);
 
 	int block_x = int((terrain_index % MAX_TERRAIN_BLOCKS) & 0xff);
 	int block_z = int((terrain_index / MAX_TERRAIN_BLOCKS) & 0xff);
@@ -91,21 +77,20 @@ void main()
 
 	int sub_id = gl_InstanceID % (block/20);
 
-	float sub_x_id = float(sub_id % (block/20));
-	float sub_z_id = float(sub_id / (block/20));
+	int sub_x_id = sub_id % (block/20);
+	int sub_z_id = sub_id / (block/20);
 
-	float rand_num0 = rand(vec2(x_id, z_id));
-	float rand_num1 = rand(vec2(z_id, x_id));
-	float rand_num_sub0 = rand(vec2(sub_x_id, sub_z_id));
-	float rand_num_sub1 = rand(vec2(sub_z_id, sub_x_id));
+	// The directions are baked from the same hashes of the ids, see plant_noise_gen_shader.comp
+	vec4 individual_noise = get_plant_noise(PLANT_NOISE_INDIVIDUAL_OFFSET, ivec2(x_id, z_id));
+	vec4 subgroup_noise = get_plant_noise(PLANT_NOISE_GROUP_OFFSET, ivec2(sub_x_id, sub_z_id));
 
 	float sub_coefficient = float(block)*1.50f;
 	float individual_coefficient = float(block)/2.0f;
 
-	vec3 subgroup_offset = (rotate(vec3(rand_num_sub0, 1.0, rand_num_sub1), 10.0/rand_num_sub0) * normalize(vec4(rand_num_sub0, rand_num_sub1, rand_num_sub0*rand_num_sub1, 1.0))).xyz * sub_coefficient;
-	vec3 individual_offset = (rotate(vec3(rand_num0, 1.0, rand_num1), 10000.0/rand_num0) * normalize(vec4(rand_num0, rand_num1, rand_num0*rand_num1, 1.0))).xyz * individual_coefficient;
+	vec3 subgroup_offset = subgroup_noise.xyz * sub_coefficient;
+	vec3 individual_offset = individual_noise.xyz * individual_coefficient;
 
-	mat4 scale = scale(vec3(1.5+(rand_num_sub0*5.0)));
+	mat4 scale = scale(vec3(1.5+(subgroup_noise.w*5.0)));
 
 	vec3 final_position = base_position + subgroup_offset + individual_offset;
 	vs_out.g_group_offset = subgroup_offset;
@@ -0,0 +1,62 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#version 430 core
+
+layout (location = 0) out vec3 frag_normal;
+layout (location = 1) out vec3 frag_position;
+layout (location = 2) out vec3 frag_color;
+
+in vec3 f_position;
+in vec3 f_normal;
+in float f_land_height;
+in float f_snow_value;
+flat in int f_temperature;
+flat in float f_precipitation;
+
+uniform float sea_level;
+
+// The same colors as terrain_shader.frag
+void main()
+{
+	frag_normal = f_normal;
+	frag_position = (f_position * 0.01f);
+	vec3 base_color = vec3(0.16f, 0.19f, 0.061f);
+	vec3 cold_no_snow = vec3(0.07f, 0.15f, 0.17f);
+	vec3 desert_color = vec3(0.40f, 0.28f, 0.14f);
+	vec3 snow_color = vec3(0.15f, 0.15f, 0.19f);
+	vec3 underwater_color = vec3(0.07, 0.15, 0.25);
+	frag_color = base_color;
+
+	if (f_temperature < 45)
+	{
+		frag_color = mix(cold_no_snow, base_color, float(f_temperature)/140.0f);
+	}
+	if (f_precipitation < 0.2f)
+	{
+		frag_color = mix(desert_color, base_color, 0.2-f_precipitation);
+	}
+	if ((f_land_height < sea_level) && (f_precipitation >= 0.2))
+	{
+		frag_color = underwater_color;
+	}
+	else if (f_snow_value >= 0.35f)
+	{
+		frag_color = snow_color;
+	}
+}
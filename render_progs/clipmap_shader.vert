@@ -0,0 +1,98 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#version 430 core
+
+layout (location = 0) in ivec2 v_sample;
+
+uniform mat4 projection_view_space;
+uniform sampler2D clipmap;
+uniform int texture_width;
+uniform int samples_per_block;
+// The level is num_cells x num_cells squares
+uniform int num_cells;
+// The sample that v_sample (0, 0) is, and the one at the corner of the player's block, which is at (0, 0) in the world.
+// These are counted from the corner of the world, so near its edge the first samples can be negative.
+uniform int first_sample_x;
+uniform int first_sample_z;
+uniform int player_sample_x;
+uniform int player_sample_z;
+uniform float block_width;
+uniform float max_height;
+uniform float sea_level;
+
+out vec3 f_position;
+out vec3 f_normal;
+out float f_land_height;
+out float f_snow_value;
+flat out int f_temperature;
+flat out float f_precipitation;
+
+// The texture is a ring buffer, see ClipmapLevel in clipmap.h. % isn't defined for negative numbers in GLSL.
+vec4 get_texel(ivec2 s)
+{
+	ivec2 wrapped = ((s % texture_width) + texture_width) % texture_width;
+	return texelFetch(clipmap, wrapped, 0);
+}
+
+float get_height(ivec2 s)
+{
+	return get_texel(s).r * max_height;
+}
+
+void main()
+{
+	ivec2 s = ivec2(first_sample_x, first_sample_z) + v_sample;
+	vec4 texel = get_texel(s);
+	float height = texel.r * max_height;
+
+	// The next level out only has every other one of this level's samples along its edge, so the ones in between
+	// are moved onto the line between their neighbours. Otherwise there'd be cracks between the levels.
+	if (((v_sample.x == 0) || (v_sample.x == num_cells)) && ((v_sample.y % 2) == 1))
+	{
+		height = (get_height(s - ivec2(0, 1)) + get_height(s + ivec2(0, 1)))/2.0;
+	}
+	else if (((v_sample.y == 0) || (v_sample.y == num_cells)) && ((v_sample.x % 2) == 1))
+	{
+		height = (get_height(s - ivec2(1, 0)) + get_height(s + ivec2(1, 0)))/2.0;
+	}
+
+	float spacing = block_width/float(samples_per_block);
+	// The sample before the level's first row or column wraps around to the block past its far edge, so the slope
+	// is one sided there. The block past the far edge is in the texture, so the last row and column are fine.
+	ivec2 before = max(s - ivec2(1, 1), ivec2(first_sample_x, first_sample_z));
+	float x_slope = (get_height(s + ivec2(1, 0)) - get_height(ivec2(before.x, s.y)))/float(s.x + 1 - before.x);
+	float z_slope = (get_height(s + ivec2(0, 1)) - get_height(ivec2(s.x, before.y)))/float(s.y + 1 - before.y);
+	f_normal = normalize(vec3(-x_slope, spacing, -z_slope));
+
+	f_land_height = height;
+	f_snow_value = texel.g;
+	f_precipitation = texel.b;
+	f_temperature = int(round(texel.a * 100.0));
+
+	// Far away, the water is just flat
+	if ((height < sea_level) && (texel.b >= 0.2))
+	{
+		height = sea_level;
+		f_normal = vec3(0.0, 1.0, 0.0);
+	}
+
+	vec2 xz = vec2(s - ivec2(player_sample_x, player_sample_z)) * spacing;
+	f_position = vec3(xz.x, height, xz.y);
+	gl_Position = projection_view_space * vec4(f_position, 1.0);
+}
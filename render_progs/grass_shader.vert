@@ -48,18 +48,35 @@ mat4 rotate(vec3 axis, float angle)
                 0.0,                                0.0,                                0.0,                                1.0);
 }
 
+// rotate(vec3(0, 1, 0), angle), from the sine and cosine of the angle
+mat4 rotate_y(float s, float c)
+{
+	return mat4(c,   0.0, s,   0.0,
+		    0.0, 1.0, 0.0, 0.0,
+		    -s,  0.0, c,   0.0,
+		    0.0, 0.0, 0.0, 1.0);
+}
+
+// Layer of plant_noise. See plant_noise.h
+#define PLANT_NOISE_GRASS 2
+uniform sampler2DArray plant_noise;
+
 void main()
 {
 	int x_index = gl_InstanceID % int(patch_size);
 	int z_index = gl_InstanceID / int(patch_size);
-	float rand_num = fract(100000*sin(gl_InstanceID));
+	// The blade's hash, and the sine and cosine of it, baked by plant_noise_gen_shader.comp
+	ivec2 noise_size = textureSize(plant_noise, 0).xy;
+	int noise_id = gl_InstanceID % (noise_size.x*noise_size.y);
+	vec3 grass_noise = texelFetch(plant_noise, ivec3(noise_id % noise_size.x, noise_id / noise_size.x, PLANT_NOISE_GRASS), 0).xyz;
+	float rand_num = grass_noise.x;
 	float patch_size_factor = 0.4;
 	float offx = (x_index-patch_size/2)*patch_size*patch_size_factor*rand_num;
 	float offz = (z_index-patch_size/2)*patch_size*patch_size_factor*(rand_num*rand_num/2);
 	vec2 final_xz_offset = vec2(base_offset.x + offx, base_offset.y + offz);
 
 	mat4 scale = scale(vec3(scale_factor*rand_num));
-	mat4 rotation = rotate(vec3(0, 1, 0), rand_num);
+	mat4 rotation = rotate_y(grass_noise.y, grass_noise.z);
 	mat4 displacement = mat4(1.0);
 	mat4 recenter = translate(vec3(-0.5, -0.5, -0.5));
 	mat4 inv_recenter = inverse(recenter);
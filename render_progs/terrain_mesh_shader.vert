@@ -0,0 +1,56 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#version 430 core
+
+// The meshed land (see terrain_mesh.h), which goes straight to terrain_shader.frag
+
+layout (location = 0) in vec3 v_position;
+layout (location = 1) in vec3 v_normal;
+layout (location = 2) in vec2 v_data;
+
+uniform mat4 projection_view_space;
+// Where the corner of this block is
+uniform vec2 block_offset;
+uniform int temperature;
+uniform float precipitation;
+uniform float sea_level;
+
+out vec3 f_position;
+out vec3 f_color;
+out vec3 f_normal;
+out vec2 f_tex_coords;
+out float f_snow_value;
+out vec3 f_snow_normal;
+out float f_sea_level;
+flat out int f_temperature;
+flat out float f_precipitation;
+
+void main()
+{
+	f_position = v_position + vec3(block_offset.x, 0.0, block_offset.y);
+	f_color = vec3(0.0);
+	f_normal = v_normal;
+	f_tex_coords = vec2(0.0);
+	f_snow_value = v_data.x;
+	f_snow_normal = v_normal;
+	f_sea_level = sea_level;
+	f_temperature = temperature;
+	f_precipitation = precipitation;
+	gl_Position = projection_view_space * vec4(f_position, 1.0);
+}
@@ -28,9 +28,8 @@ in vec2 f_tex_coords;
 in float f_snow_value;
 in vec3 f_snow_normal;
 in float f_sea_level;
-
-uniform int temperature;
-uniform float precipitation;
+flat in int f_temperature;
+flat in float f_precipitation;
 
 
 bool float_close_enough(float a, float b)
@@ -54,15 +53,15 @@ void main()
 	vec3 underwater_color = vec3(0.07, 0.15, 0.25);
 	frag_color = base_color;
 
-	if (temperature < 45)
+	if (f_temperature < 45)
 	{
-		frag_color = mix(cold_no_snow, base_color, float(temperature)/140.0f);
+		frag_color = mix(cold_no_snow, base_color, float(f_temperature)/140.0f);
 	}
-	if ((precipitation < 0.2f))
+	if ((f_precipitation < 0.2f))
 	{
-		frag_color = mix(desert_color, base_color, 0.2-precipitation);
+		frag_color = mix(desert_color, base_color, 0.2-f_precipitation);
 	}
-	if ((f_position.y < f_sea_level) && (precipitation >= 0.2))
+	if ((f_position.y < f_sea_level) && (f_precipitation >= 0.2))
 	{
 		frag_color = vec3(0.07, 0.15, 0.25);
 	}
@@ -20,8 +20,13 @@
 
 layout (location = 0) in vec3 v_position;
 
+// Every instance is one block -- its index into draw_blocks is passed down to the later stages
+uniform int first_draw_block;
+out int v_draw_block;
+
 void main()
 {
 	gl_Position = vec4(v_position, 1.0f);
+	v_draw_block = first_draw_block + gl_InstanceID;
 }
 
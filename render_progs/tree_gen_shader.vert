@@ -25,19 +25,6 @@ mat4 scale(vec3 axis)
 		vec4(0.0, 0.0, 0.0, 1.0));
 }
 
-mat4 rotate(vec3 axis, float angle)
-{
-    axis = normalize(axis);
-    float s = sin(angle);
-    float c = cos(angle);
-    float oc = 1.0 - c;
-    
-    return mat4(oc * axis.x * axis.x + c,           oc * axis.x * axis.y - axis.z * s,  oc * axis.z * axis.x + axis.y * s,  0.0,
-                oc * axis.x * axis.y + axis.z * s,  oc * axis.y * axis.y + c,           oc * axis.y * axis.z - axis.x * s,  0.0,
-                oc * axis.z * axis.x - axis.y * s,  oc * axis.y * axis.z + axis.x * s,  oc * axis.z * axis.z + c,           0.0,
-                0.0,                                0.0,                                0.0,                                1.0);
-}
-
 mat4 translate(vec3 delta)
 {
     return mat4(
@@ -47,21 +34,18 @@ mat4 translate(vec3 delta)
         vec4(delta, 1.0));
 }
 
-float rand(vec2 n) 
-{ 
-	return fract(sin(dot(n, vec2(12.9898, 4.1414))) * 43758.5453);
-}
+// Layer of plant_noise. See plant_noise.h
+#define PLANT_NOISE_GROUP_OFFSET 1
+uniform sampler2DArray plant_noise;
 
 vec3 get_group_offset(uint id)
 {
-	float x_id = float(id % block);
-	float z_id = float(id / block);
-
-	float rand_num0 = rand(vec2(x_id, z_id));
-	float rand_num1 = rand(vec2(z_id, x_id));
+	ivec2 ids = ivec2(id % block, id / block);
 
+	// The direction is baked from hashes of the ids, see plant_noise_gen_shader.comp
+	vec3 direction = texelFetch(plant_noise, ivec3(ids % textureSize(plant_noise, 0).xy, PLANT_NOISE_GROUP_OFFSET), 0).xyz;
 	float coefficient = float(block*20)*1.50f;
-	return vec3(rotate(vec3(rand_num0, 1.0, rand_num1), 10.0/rand_num0) * normalize(vec4(rand_num0, rand_num1, rand_num0*rand_num1, 1.0)) * coefficient);
+	return direction * coefficient;
 }
 
 void main()
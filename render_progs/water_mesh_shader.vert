@@ -0,0 +1,68 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#version 430 core
+
+// The meshed water (see terrain_mesh.h), which goes straight to water_shader.frag
+
+layout (location = 0) in vec3 v_position;
+layout (location = 1) in vec3 v_normal;
+layout (location = 2) in vec2 v_data;
+
+uniform mat4 projection_view_space;
+// Where the corner of this block is
+uniform vec2 block_offset;
+uniform int temperature;
+uniform float precipitation;
+uniform float time;
+uniform float sea_level;
+uniform float height_factor;
+uniform float camera_height;
+
+out float f_sea_level;
+out float f_camera_height;
+out vec3 f_position;
+out vec3 f_color;
+out vec3 f_normal;
+out vec2 f_tex_coords;
+flat out int f_temperature;
+flat out float f_precipitation;
+
+void main()
+{
+	vec3 pos = v_position + vec3(block_offset.x, sea_level, block_offset.y);
+
+	// The same waves as water_shader.etess
+	float temporal_factor = (sin(time*v_data.x) + cos(time*v_data.y))/4.0;
+	pos.y += v_data.x * (temporal_factor * height_factor);
+	if (temperature < 32)
+	{
+		pos.y = sea_level;
+	}
+
+	f_position = pos;
+	f_color = vec3(0.0);
+	// Left for water_shader.frag to work out
+	f_normal = vec3(0.0);
+	f_tex_coords = vec2(0.0);
+	f_sea_level = sea_level;
+	f_camera_height = camera_height;
+	f_temperature = temperature;
+	f_precipitation = precipitation;
+	gl_Position = projection_view_space * vec4(pos, 1.0);
+}
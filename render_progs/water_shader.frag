@@ -28,9 +28,8 @@ in vec3 f_normal;
 in vec2 f_tex_coords;
 in float f_sea_level;
 in float f_camera_height;
-
-uniform int temperature;
-uniform float precipitation;
+flat in int f_temperature;
+flat in float f_precipitation;
 
 #define NOISE fbm
 #define BITMAP_WIDTH 1024
@@ -87,6 +86,15 @@ float fbm(vec2 x) {
 void main()
 {
 	frag_normal = f_normal;
+	// There's no geometry shader to find the water's normals, so they're the faces' normals from here
+	if (f_normal == vec3(0.0))
+	{
+		frag_normal = normalize(cross(dFdx(f_position), dFdy(f_position)));
+		if (frag_normal.y < 0.0)
+		{
+			frag_normal = -frag_normal;
+		}
+	}
 	frag_position = (f_position * 0.01f);
 
 	vec3 base_color = vec3(0.16f, 0.19f, 0.761f);
@@ -97,7 +105,7 @@ void main()
 	{
 		frag_color = underwater_color;
 	}
-	else if (temperature < 32)
+	else if (f_temperature < 32)
 	{
 		frag_color = ice_color;
 	}
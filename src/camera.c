@@ -24,6 +24,7 @@
 #include "input.h"
 #include "utils.h"
 #include "camera.h"
+#include "terrain_raycast.h"
 #include "time.h"
 
 extern float delta_t;
@@ -96,6 +97,15 @@ void set_camera(Camera *camera, vec3 position, vec3 direction)
 
 }
 
+/* Only the far plane depends on the view distance, so this is all a camera needs when it changes */
+void update_camera_projection(Camera *camera)
+{
+	int window_width = 0;
+	int window_height = 0;
+	get_window_size(&window_width, &window_height);
+	glm_perspective(RAD(45.0f), (float)window_width/(float)window_height, 1.0f, get_view_distance(), camera->projection_space);
+}
+
 void update_camera(Camera *camera, ActorState player, TerrainChunk *terrain_chunk, mat4 rotation)
 {
 	static int camera_scroll = 80;
@@ -117,6 +127,20 @@ void update_camera(Camera *camera, ActorState player, TerrainChunk *terrain_chun
 	glm_translate(translate, camera_direction);
 	glm_mat4_mulv3(translate, player.position, 1, camera->position);
 
+	vec3 target;
+	glm_vec3_add(player.position, VEC3(0, 20.0f + ((float)camera_scroll-55.0f)/3.0f, 0), target);
+
+	/* If there's a ridge between the player and the camera, pull the camera in to just in front of it */
+	TerrainRayHit hit;
+	if (terrain_segment_intersection(terrain_chunk, target, camera->position, &hit))
+	{
+		vec3 to_target;
+		glm_vec3_sub(target, hit.position, to_target);
+		glm_vec3_normalize(to_target);
+		glm_vec3_muladds(to_target, 3.0f, hit.position);
+		glm_vec3_copy(hit.position, camera->position);
+	}
+
 	float height = get_terrain_height(camera->position, terrain_chunk);
 	if (camera->position[1] < (height + 3.0f))
 	{
@@ -125,8 +149,6 @@ void update_camera(Camera *camera, ActorState player, TerrainChunk *terrain_chun
 
 	//camera->position[1] = 100.0f;
 
-	vec3 target;
-	glm_vec3_add(player.position, VEC3(0, 20.0f + ((float)camera_scroll-55.0f)/3.0f, 0), target);
 	glm_lookat(camera->position, target, up, camera->view_space);
 
 	g_camera_height = camera->position[1];
@@ -43,6 +43,7 @@ Camera create_camera(B_Window window, vec3 position, vec3 front);
 void update_camera(Camera *camera, ActorState player, TerrainChunk *terrain_chunk, mat4 yaw_dest);
 void look_at(Camera *camera, vec3 target);
 void set_camera(Camera *camera, vec3 position, vec3 direction);
+void update_camera_projection(Camera *camera);
 float get_view_distance(void);
 float get_camera_height(void);
 
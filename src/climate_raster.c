@@ -0,0 +1,253 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "climate_raster.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#define CLIMATE_RASTER_MAGIC "BGCLIMA"
+#define CLIMATE_RASTER_FILE_SIZE (sizeof(ClimateRasterHeader) + (2*(size_t)CLIMATE_RASTER_WIDTH*CLIMATE_RASTER_WIDTH))
+
+ClimateRaster g_climate_raster;
+int g_climate_raster_loaded = 0;
+
+typedef struct ClimateRasterBakeJob
+{
+	uint32_t	row;
+	uint8_t		*samples;
+} ClimateRasterBakeJob;
+
+/* The block a sample is taken from. The last sample along each side would be just past the edge of the world, so
+ * it's moved back onto the last block. */
+static uint64_t get_sample_block(uint32_t sample)
+{
+	return mini(sample*CLIMATE_RASTER_STEP, MAX_TERRAIN_BLOCKS-1);
+}
+
+static uint8_t quantize_temperature(int linear_temperature)
+{
+	return (uint8_t)glm_clamp(linear_temperature + CLIMATE_RASTER_TEMPERATURE_OFFSET, 0, 255);
+}
+
+static uint8_t quantize_precipitation(float precipitation)
+{
+	float range = CLIMATE_RASTER_MAX_PRECIPITATION - CLIMATE_RASTER_MIN_PRECIPITATION;
+	float scaled = (precipitation - CLIMATE_RASTER_MIN_PRECIPITATION)/range;
+	return (uint8_t)(glm_clamp(scaled, 0.0f, 1.0f)*255.0f + 0.5f);
+}
+
+static float dequantize_precipitation(float quantized)
+{
+	float range = CLIMATE_RASTER_MAX_PRECIPITATION - CLIMATE_RASTER_MIN_PRECIPITATION;
+	return CLIMATE_RASTER_MIN_PRECIPITATION + (quantized/255.0f)*range;
+}
+
+static void bake_climate_raster_row_job(void *arg)
+{
+	ClimateRasterBakeJob *job = arg;
+	uint64_t *terrain_indices = BG_MALLOC(uint64_t, CLIMATE_RASTER_WIDTH);
+	ClimateCacheEntry *climates = BG_MALLOC(ClimateCacheEntry, CLIMATE_RASTER_WIDTH);
+	int *linear_temperatures = BG_MALLOC(int, CLIMATE_RASTER_WIDTH);
+	uint64_t z = get_sample_block(job->row);
+	for (uint32_t x = 0; x < CLIMATE_RASTER_WIDTH; ++x)
+	{
+		terrain_indices[x] = (z*MAX_TERRAIN_BLOCKS) + get_sample_block(x);
+	}
+	compute_block_climates(terrain_indices, climates, linear_temperatures, CLIMATE_RASTER_WIDTH);
+
+	uint8_t *row = &job->samples[2*(size_t)job->row*CLIMATE_RASTER_WIDTH];
+	for (uint32_t x = 0; x < CLIMATE_RASTER_WIDTH; ++x)
+	{
+		row[2*x] = quantize_temperature(linear_temperatures[x]);
+		row[(2*x)+1] = quantize_precipitation(climates[x].precipitation);
+	}
+	BG_FREE(terrain_indices);
+	BG_FREE(climates);
+	BG_FREE(linear_temperatures);
+}
+
+void bake_climate_raster(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		fprintf(stderr, "bake_climate_raster error: could not open %s: %s\n", path, strerror(errno));
+		exit(-1);
+	}
+	if (ftruncate(fd, CLIMATE_RASTER_FILE_SIZE))
+	{
+		fprintf(stderr, "bake_climate_raster error: could not resize %s: %s\n", path, strerror(errno));
+		exit(-1);
+	}
+	uint8_t *data = mmap(NULL, CLIMATE_RASTER_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "bake_climate_raster error: could not map %s: %s\n", path, strerror(errno));
+		exit(-1);
+	}
+
+	/* Rows are done a batch at a time so there's only ever a few jobs allocated */
+	uint8_t *samples = data + sizeof(ClimateRasterHeader);
+	ThreadPool *pool = create_thread_pool(0);
+	int batch_size = 256;
+	ClimateRasterBakeJob *jobs = BG_MALLOC(ClimateRasterBakeJob, batch_size);
+	for (uint32_t first_row = 0; first_row < CLIMATE_RASTER_WIDTH; first_row += batch_size)
+	{
+		int num_rows = mini(batch_size, CLIMATE_RASTER_WIDTH - first_row);
+		for (int i = 0; i < num_rows; ++i)
+		{
+			jobs[i].row = first_row + i;
+			jobs[i].samples = samples;
+			thread_pool_submit(pool, bake_climate_raster_row_job, &jobs[i]);
+		}
+		thread_pool_wait(pool);
+		printf("Baked climate rows %u to %u of %u\n", first_row + 1, first_row + num_rows, CLIMATE_RASTER_WIDTH);
+	}
+	BG_FREE(jobs);
+	free_thread_pool(pool);
+
+	/* The header goes in last so a bake that gets interrupted doesn't leave a raster that looks valid */
+	ClimateRasterHeader header = {0};
+	memcpy(header.magic, CLIMATE_RASTER_MAGIC, sizeof(header.magic));
+	header.version = CLIMATE_RASTER_VERSION;
+	header.step = CLIMATE_RASTER_STEP;
+	header.width = CLIMATE_RASTER_WIDTH;
+	memcpy(data, &header, sizeof(header));
+	msync(data, CLIMATE_RASTER_FILE_SIZE, MS_SYNC);
+
+	/* Check it against the exact climate of some random blocks, using the raster that was just written */
+	g_climate_raster.data = data;
+	g_climate_raster.size = CLIMATE_RASTER_FILE_SIZE;
+	g_climate_raster.samples = samples;
+	g_climate_raster_loaded = 1;
+	int num_checks = 4096;
+	uint64_t *terrain_indices = BG_MALLOC(uint64_t, num_checks);
+	ClimateCacheEntry *exact = BG_MALLOC(ClimateCacheEntry, num_checks);
+	for (int i = 0; i < num_checks; ++i)
+	{
+		uint64_t x = (uint64_t)rand() % MAX_TERRAIN_BLOCKS;
+		uint64_t z = (uint64_t)rand() % MAX_TERRAIN_BLOCKS;
+		terrain_indices[i] = (z*MAX_TERRAIN_BLOCKS) + x;
+	}
+	compute_block_climates(terrain_indices, exact, NULL, num_checks);
+	int max_temperature_error = 0;
+	float max_precipitation_error = 0.0f;
+	for (int i = 0; i < num_checks; ++i)
+	{
+		ClimateCacheEntry approximate;
+		lookup_climate_raster(terrain_indices[i], &approximate);
+		max_temperature_error = maxi(max_temperature_error, abs(approximate.temperature - exact[i].temperature));
+		max_precipitation_error = fmaxf(max_precipitation_error, fabsf(approximate.precipitation - exact[i].precipitation));
+	}
+	printf("Wrote %s: %ux%u samples, max error over %i random blocks: temperature %i, precipitation %f\n", 
+		path, CLIMATE_RASTER_WIDTH, CLIMATE_RASTER_WIDTH, num_checks, max_temperature_error, max_precipitation_error);
+	BG_FREE(terrain_indices);
+	BG_FREE(exact);
+	free_climate_raster();
+}
+
+void load_climate_raster(const char *path)
+{
+	if (!file_exists(path))
+	{
+		return;
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "load_climate_raster error: could not open %s: %s\n", path, strerror(errno));
+		return;
+	}
+	struct stat file_stat;
+	fstat(fd, &file_stat);
+	if ((size_t)file_stat.st_size != CLIMATE_RASTER_FILE_SIZE)
+	{
+		fprintf(stderr, "load_climate_raster error: %s is the wrong size. Rebake it with --bake-climate.\n", path);
+		close(fd);
+		return;
+	}
+	uint8_t *data = mmap(NULL, CLIMATE_RASTER_FILE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "load_climate_raster error: could not map %s: %s\n", path, strerror(errno));
+		return;
+	}
+	ClimateRasterHeader *header = (ClimateRasterHeader *)data;
+	if (memcmp(header->magic, CLIMATE_RASTER_MAGIC, sizeof(header->magic)) || 
+	    (header->version != CLIMATE_RASTER_VERSION) ||
+	    (header->step != CLIMATE_RASTER_STEP) ||
+	    (header->width != CLIMATE_RASTER_WIDTH))
+	{
+		fprintf(stderr, "load_climate_raster error: %s is out of date. Rebake it with --bake-climate.\n", path);
+		munmap(data, CLIMATE_RASTER_FILE_SIZE);
+		return;
+	}
+	g_climate_raster.data = data;
+	g_climate_raster.size = CLIMATE_RASTER_FILE_SIZE;
+	g_climate_raster.samples = data + sizeof(ClimateRasterHeader);
+	g_climate_raster_loaded = 1;
+}
+
+void free_climate_raster(void)
+{
+	if (!g_climate_raster_loaded)
+	{
+		return;
+	}
+	munmap(g_climate_raster.data, g_climate_raster.size);
+	memset(&g_climate_raster, 0, sizeof(g_climate_raster));
+	g_climate_raster_loaded = 0;
+}
+
+int lookup_climate_raster(uint64_t terrain_index, ClimateCacheEntry *dest)
+{
+	if (!g_climate_raster_loaded)
+	{
+		return 0;
+	}
+	uint32_t x = terrain_index % MAX_TERRAIN_BLOCKS;
+	uint32_t z = terrain_index / MAX_TERRAIN_BLOCKS;
+	uint32_t sample_x = x / CLIMATE_RASTER_STEP;
+	uint32_t sample_z = z / CLIMATE_RASTER_STEP;
+	float t_x = (float)(x - get_sample_block(sample_x)) / (get_sample_block(sample_x+1) - get_sample_block(sample_x));
+	float t_z = (float)(z - get_sample_block(sample_z)) / (get_sample_block(sample_z+1) - get_sample_block(sample_z));
+
+	const uint8_t *row_0 = &g_climate_raster.samples[2*(size_t)sample_z*CLIMATE_RASTER_WIDTH];
+	const uint8_t *row_1 = row_0 + (2*CLIMATE_RASTER_WIDTH);
+	float values[2];
+	for (int i = 0; i < 2; ++i)
+	{
+		float top = glm_lerp(row_0[(2*sample_x)+i], row_0[(2*(sample_x+1))+i], t_x);
+		float bottom = glm_lerp(row_1[(2*sample_x)+i], row_1[(2*(sample_x+1))+i], t_x);
+		values[i] = glm_lerp(top, bottom, t_z);
+	}
+	dest->key = terrain_index + 1;
+	dest->temperature = polarize_temperature((int)roundf(values[0]) - CLIMATE_RASTER_TEMPERATURE_OFFSET);
+	dest->precipitation = dequantize_precipitation(values[1]);
+	return 1;
+}
@@ -0,0 +1,67 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CLIMATE_RASTER_H__
+#define __CLIMATE_RASTER_H__
+#include <stdint.h>
+#include "environment.h"
+
+/* A coarse copy of every block's temperature and precipitation, baked once with --bake-climate and memory mapped at
+ * startup. There's one sample every CLIMATE_RASTER_STEP blocks along each side, one byte each for temperature and
+ * precipitation, and lookups interpolate between the four nearest samples. It's for things that only need roughly
+ * the right climate for a lot of blocks, like far away terrain -- anything that needs the exact climate should use
+ * get_environment_condition(). */
+#define CLIMATE_RASTER_PATH "climate.raster"
+#define CLIMATE_RASTER_STEP 16
+#define CLIMATE_RASTER_WIDTH ((MAX_TERRAIN_BLOCKS/CLIMATE_RASTER_STEP) + 1)
+/* Bump this whenever the climate noise changes, so old rasters aren't used */
+#define CLIMATE_RASTER_VERSION 1
+/* Temperature is stored from before polarize_temperature(), plus this, since polarizing turns small differences into 
+ * big jumps that don't interpolate well */
+#define CLIMATE_RASTER_TEMPERATURE_OFFSET 80
+/* Precipitation is quantized over this range. It's a little wider than what the noise actually gives. */
+#define CLIMATE_RASTER_MIN_PRECIPITATION -0.25f
+#define CLIMATE_RASTER_MAX_PRECIPITATION 1.25f
+
+typedef struct ClimateRasterHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	step;
+	uint32_t	width;
+	uint32_t	padding;
+} ClimateRasterHeader;
+
+typedef struct ClimateRaster
+{
+	uint8_t		*data;
+	size_t		size;
+	/* Pairs of temperature and precipitation, row by row */
+	const uint8_t	*samples;
+} ClimateRaster;
+
+/* Works out the whole raster and writes it to path */
+void bake_climate_raster(const char *path);
+/* Maps the raster at path. If there isn't one, or it's out of date, lookups just fail and callers fall back to the
+ * exact climate. */
+void load_climate_raster(const char *path);
+void free_climate_raster(void);
+/* Returns 0 if there's no raster loaded */
+int lookup_climate_raster(uint64_t terrain_index, ClimateCacheEntry *dest);
+
+#endif
@@ -0,0 +1,287 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clipmap.h"
+#include "heightmap_generation.h"
+#include "environment.h"
+#include "utils.h"
+
+static uint16_t clipmap_unorm16(float f)
+{
+	return (uint16_t)(glm_clamp(f, 0.0f, 1.0f)*65535.0f + 0.5f);
+}
+
+/* Where block number block (along x or z) goes in the level's ring buffer. Near the edge of the world the level
+ * reaches past it, to negative block numbers, and C's % keeps the sign. */
+static int get_clipmap_block_slot(ClipmapLevel *level, int block)
+{
+	int num_slots = level->blocks+1;
+	return ((block % num_slots) + num_slots) % num_slots;
+}
+
+/* Generates the block at (block_x, block_z) into the level's texels, with only samples_per_block heights along each
+ * side instead of the land chunk's HEIGHTMAP_BLOCK_WIDTH. */
+static void generate_clipmap_block(ClipmapLevel *level, int block_x, int block_z)
+{
+	/* Blocks past the edge of the world still get heights from the noise, with the climate of the nearest one in it */
+	uint64_t terrain_index = ((uint64_t)maxi(mini(block_z, MAX_TERRAIN_BLOCKS-1), 0)*MAX_TERRAIN_BLOCKS) +
+				 (uint64_t)maxi(mini(block_x, MAX_TERRAIN_BLOCKS-1), 0);
+	/* The outer levels are far enough away that the climate raster is close enough */
+	EnvironmentCondition condition;
+	if (level->samples_per_block < CLIPMAP_BASE_SAMPLES_PER_BLOCK)
+	{
+		condition = get_approximate_environment_condition(terrain_index);
+	}
+	else
+	{
+		condition = get_environment_condition(terrain_index);
+	}
+	uint16_t precipitation = clipmap_unorm16(condition.precipitation);
+	uint16_t temperature = clipmap_unorm16(condition.temperature/100.0f);
+
+	int samples_per_block = level->samples_per_block;
+	float step = (float)HEIGHTMAP_BLOCK_WIDTH/samples_per_block;
+	int first_x = get_clipmap_block_slot(level, block_x) * samples_per_block;
+	int first_z = get_clipmap_block_slot(level, block_z) * samples_per_block;
+	TerrainHeight heights[CLIPMAP_BASE_SAMPLES_PER_BLOCK];
+	for (int z = 0; z < samples_per_block; ++z)
+	{
+		generate_terrain_height_row(TERRAIN_CHUNK_LAND,
+					    (float)block_x * HEIGHTMAP_BLOCK_WIDTH,
+					    ((float)block_z * HEIGHTMAP_BLOCK_WIDTH) + (z*step),
+					    step,
+					    samples_per_block,
+					    condition,
+					    heights);
+		ClipmapTexel *row = &level->texels[((first_z + z) * level->texture_width) + first_x];
+		for (int x = 0; x < samples_per_block; ++x)
+		{
+			row[x].height = heights[x].height;
+			row[x].snow = heights[x].snow;
+			row[x].precipitation = precipitation;
+			row[x].temperature = temperature;
+		}
+	}
+}
+
+/* Uploads the width x height texels starting at the corner of block (block_x, block_z). Only one of the block
+ * coordinates is used for each strip, the other is passed as 0. GL_UNPACK_ROW_LENGTH has to be texture_width. */
+static void B_upload_clipmap_strip(ClipmapLevel *level, int block_x, int block_z, int width, int height)
+{
+	int first_x = get_clipmap_block_slot(level, block_x) * level->samples_per_block;
+	int first_z = get_clipmap_block_slot(level, block_z) * level->samples_per_block;
+	glTexSubImage2D(GL_TEXTURE_2D, 0, first_x, first_z, width, height, GL_RGBA, GL_UNSIGNED_SHORT,
+			&level->texels[(first_z * level->texture_width) + first_x]);
+}
+
+static void B_send_clipmap_level_to_gpu(ClipmapLevel *level)
+{
+	glGenTextures(1, &level->texture);
+	glBindTexture(GL_TEXTURE_2D, level->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16, level->texture_width, level->texture_width, 0, GL_RGBA, GL_UNSIGNED_SHORT, NULL);
+	/* It's only read with texelFetch */
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	/* The vertices are just sample coordinates inside of the level -- the vertex shader finds the heights */
+	int num_cells = level->blocks * level->samples_per_block;
+	int hole_min = ((level->blocks - level->hole_blocks)/2) * level->samples_per_block;
+	int hole_max = hole_min + (level->hole_blocks * level->samples_per_block);
+	int num_vertices = (num_cells+1)*(num_cells+1);
+	ivec2 *vertices = BG_MALLOC(ivec2, num_vertices);
+	for (int i = 0; i < num_vertices; ++i)
+	{
+		vertices[i][0] = i % (num_cells+1);
+		vertices[i][1] = i / (num_cells+1);
+	}
+
+	unsigned int *indices = BG_MALLOC(unsigned int, num_cells*num_cells*6);
+	level->num_indices = 0;
+	for (int z = 0; z < num_cells; ++z)
+	{
+		for (int x = 0; x < num_cells; ++x)
+		{
+			if ((x >= hole_min) && (x < hole_max) && (z >= hole_min) && (z < hole_max))
+			{
+				continue;
+			}
+			unsigned int top_left = (z * (num_cells+1)) + x;
+			unsigned int bottom_left = top_left + (num_cells+1);
+			/* Counter-clockwise seen from above, the same as the tessellated terrain */
+			indices[level->num_indices++] = top_left;
+			indices[level->num_indices++] = bottom_left;
+			indices[level->num_indices++] = top_left+1;
+			indices[level->num_indices++] = top_left+1;
+			indices[level->num_indices++] = bottom_left;
+			indices[level->num_indices++] = bottom_left+1;
+		}
+	}
+
+	glGenVertexArrays(1, &level->vao);
+	glBindVertexArray(level->vao);
+
+	glGenBuffers(1, &level->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, level->vbo);
+	glBufferData(GL_ARRAY_BUFFER, num_vertices*sizeof(ivec2), vertices, GL_STATIC_DRAW);
+	glVertexAttribIPointer(0, 2, GL_INT, sizeof(ivec2), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	glGenBuffers(1, &level->ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, level->ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, level->num_indices*sizeof(unsigned int), indices, GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	BG_FREE(vertices);
+	BG_FREE(indices);
+}
+
+Clipmap create_clipmap(int chunk_dimension, uint64_t center_index)
+{
+	Clipmap clipmap = {0};
+	int hole_blocks = chunk_dimension;
+	for (int i = 0; i < CLIPMAP_LEVELS; ++i)
+	{
+		ClipmapLevel *level = &clipmap.levels[i];
+		/* An odd number of blocks, so the level is centered on the player's block like the land chunk is */
+		level->blocks = (hole_blocks*2) + 1;
+		level->hole_blocks = hole_blocks;
+		level->samples_per_block = CLIPMAP_BASE_SAMPLES_PER_BLOCK >> i;
+		level->texture_width = (level->blocks+1) * level->samples_per_block;
+		level->texels = BG_MALLOC(ClipmapTexel, level->texture_width*level->texture_width);
+		B_send_clipmap_level_to_gpu(level);
+		hole_blocks = level->blocks;
+	}
+
+	clipmap.center_index = center_index;
+	for (int i = 0; i < CLIPMAP_LEVELS; ++i)
+	{
+		ClipmapLevel *level = &clipmap.levels[i];
+		int half_blocks = level->blocks/2;
+		int center_x = center_index % MAX_TERRAIN_BLOCKS;
+		int center_z = center_index / MAX_TERRAIN_BLOCKS;
+		for (int z = center_z - half_blocks; z <= center_z + half_blocks + 1; ++z)
+		{
+			for (int x = center_x - half_blocks; x <= center_x + half_blocks + 1; ++x)
+			{
+				generate_clipmap_block(level, x, z);
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D, level->texture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, level->texture_width, level->texture_width, GL_RGBA, GL_UNSIGNED_SHORT, level->texels);
+	}
+	return clipmap;
+}
+
+void free_clipmap(Clipmap *clipmap)
+{
+	for (int i = 0; i < CLIPMAP_LEVELS; ++i)
+	{
+		ClipmapLevel *level = &clipmap->levels[i];
+		glDeleteTextures(1, &level->texture);
+		glDeleteBuffers(1, &level->vbo);
+		glDeleteBuffers(1, &level->ebo);
+		glDeleteVertexArrays(1, &level->vao);
+		BG_FREE(level->texels);
+	}
+	memset(clipmap, 0, sizeof(Clipmap));
+}
+
+void B_update_clipmap(Clipmap *clipmap, uint64_t center_index)
+{
+	int old_x = clipmap->center_index % MAX_TERRAIN_BLOCKS;
+	int old_z = clipmap->center_index / MAX_TERRAIN_BLOCKS;
+	int center_x = center_index % MAX_TERRAIN_BLOCKS;
+	int center_z = center_index / MAX_TERRAIN_BLOCKS;
+	if ((old_x == center_x) && (old_z == center_z))
+	{
+		return;
+	}
+
+	for (int i = 0; i < CLIPMAP_LEVELS; ++i)
+	{
+		ClipmapLevel *level = &clipmap->levels[i];
+		int half_blocks = level->blocks/2;
+		glBindTexture(GL_TEXTURE_2D, level->texture);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, level->texture_width);
+		for (int z = center_z - half_blocks; z <= center_z + half_blocks + 1; ++z)
+		{
+			/* Blocks that were already in the level are still in the same place in the texture */
+			int new_z = !((abs(z - old_z) <= half_blocks) || (z == old_z + half_blocks + 1));
+			for (int x = center_x - half_blocks; x <= center_x + half_blocks + 1; ++x)
+			{
+				int new_x = !((abs(x - old_x) <= half_blocks) || (x == old_x + half_blocks + 1));
+				if (new_x || new_z)
+				{
+					generate_clipmap_block(level, x, z);
+				}
+			}
+			/* The level covers exactly as many blocks as the texture holds, so a new row of blocks is a full
+			 * width strip of the texture */
+			if (new_z)
+			{
+				B_upload_clipmap_strip(level, 0, z, level->texture_width, level->samples_per_block);
+			}
+		}
+		for (int x = center_x - half_blocks; x <= center_x + half_blocks + 1; ++x)
+		{
+			if (!((abs(x - old_x) <= half_blocks) || (x == old_x + half_blocks + 1)))
+			{
+				B_upload_clipmap_strip(level, x, 0, level->samples_per_block, level->texture_width);
+			}
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	}
+	clipmap->center_index = center_index;
+}
+
+void B_draw_clipmap(Clipmap *clipmap, B_Shader shader, mat4 projection_view)
+{
+	int center_x = clipmap->center_index % MAX_TERRAIN_BLOCKS;
+	int center_z = clipmap->center_index / MAX_TERRAIN_BLOCKS;
+
+	glUseProgram(shader);
+	B_set_uniform_mat4(shader, "projection_view_space", projection_view);
+	B_set_uniform_float(shader, "block_width", TERRAIN_XZ_SCALE*4.0f);
+	B_set_uniform_float(shader, "max_height", TERRAIN_MAX_HEIGHT);
+	B_set_uniform_float(shader, "sea_level", SEA_LEVEL);
+	B_set_uniform_int(shader, "clipmap", 0);
+	glActiveTexture(GL_TEXTURE0);
+	for (int i = 0; i < CLIPMAP_LEVELS; ++i)
+	{
+		ClipmapLevel *level = &clipmap->levels[i];
+		int half_blocks = level->blocks/2;
+		glBindTexture(GL_TEXTURE_2D, level->texture);
+		B_set_uniform_int(shader, "texture_width", level->texture_width);
+		B_set_uniform_int(shader, "samples_per_block", level->samples_per_block);
+		B_set_uniform_int(shader, "num_cells", level->blocks*level->samples_per_block);
+		B_set_uniform_int(shader, "first_sample_x", (center_x - half_blocks) * level->samples_per_block);
+		B_set_uniform_int(shader, "first_sample_z", (center_z - half_blocks) * level->samples_per_block);
+		B_set_uniform_int(shader, "player_sample_x", center_x * level->samples_per_block);
+		B_set_uniform_int(shader, "player_sample_z", center_z * level->samples_per_block);
+		glBindVertexArray(level->vao);
+		glDrawElements(GL_TRIANGLES, level->num_indices, GL_UNSIGNED_INT, 0);
+	}
+}
+
+float get_clipmap_view_distance(Clipmap *clipmap)
+{
+	return (TERRAIN_XZ_SCALE*4.0f) * (clipmap->levels[CLIPMAP_LEVELS-1].blocks/2);
+}
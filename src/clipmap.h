@@ -0,0 +1,77 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CLIPMAP_H__
+#define __CLIPMAP_H__
+#include "terrain.h"
+
+/* A Clipmap is the far-off terrain drawn around the land chunk when USE_CLIPMAP_TERRAIN is set. It's made of nested
+ * square rings ("levels"), each twice as wide as the one inside it with half as many heights per block, so every
+ * level costs about the same to generate, store and draw. The land chunk sits in the hole in the middle of level 0. */
+#define CLIPMAP_LEVELS 4
+/* Level i has CLIPMAP_BASE_SAMPLES_PER_BLOCK >> i heights along each side of a block. Every level's samples have to
+ * land on block edges, so there can't be more levels than log2 of this, plus one. */
+#define CLIPMAP_BASE_SAMPLES_PER_BLOCK 8
+
+/* The climate is stored next to each height so the far terrain can be colored the same way terrain_shader.frag
+ * colors the land chunk. */
+typedef struct ClipmapTexel
+{
+	uint16_t	height;
+	uint16_t	snow;
+	/* precipitation, and temperature/100, as normalized 16 bit values */
+	uint16_t	precipitation;
+	uint16_t	temperature;
+} ClipmapTexel;
+
+typedef struct ClipmapLevel
+{
+	/* The level is blocks x blocks terrain blocks centered on the player's, with a hole hole_blocks wide in the
+	 * middle for the next level in. */
+	int		blocks;
+	int		hole_blocks;
+	int		samples_per_block;
+	/* The texture is a toroidal ring buffer that holds one more block than the level covers in x and z, since the
+	 * last row and column of vertices are the first samples of the next block over. Block (x, z) is always at
+	 * ((x % (blocks+1)) * samples_per_block, (z % (blocks+1)) * samples_per_block), so only blocks that come into
+	 * view ever have to be generated. */
+	int		texture_width;
+	ClipmapTexel	*texels;
+	B_Texture	texture;
+	/* One grid mesh of (blocks*samples_per_block) squares, with the hole cut out, that's reused every frame */
+	unsigned int	vao;
+	unsigned int	vbo;
+	unsigned int	ebo;
+	int		num_indices;
+} ClipmapLevel;
+
+typedef struct Clipmap
+{
+	ClipmapLevel	levels[CLIPMAP_LEVELS];
+	uint64_t	center_index;
+} Clipmap;
+
+/* chunk_dimension is the dimension of the land chunk that goes in the middle */
+Clipmap create_clipmap(int chunk_dimension, uint64_t center_index);
+void free_clipmap(Clipmap *clipmap);
+/* Moves the clipmap to center_index, generating and uploading only the blocks that weren't already in it */
+void B_update_clipmap(Clipmap *clipmap, uint64_t center_index);
+void B_draw_clipmap(Clipmap *clipmap, B_Shader shader, mat4 projection_view);
+/* How far away the edge of the outermost level is */
+float get_clipmap_view_distance(Clipmap *clipmap);
+#endif
@@ -133,19 +133,23 @@ B_Shader B_compile_terrain_shader(const char *vert_path, const char *frag_path,
 	unsigned int fragment_id = glCreateShader(GL_FRAGMENT_SHADER);
 	unsigned int ctess_id = glCreateShader(GL_TESS_CONTROL_SHADER);
 	unsigned int etess_id = glCreateShader(GL_TESS_EVALUATION_SHADER);
-	unsigned int geo_id = glCreateShader(GL_GEOMETRY_SHADER);
+	/* The geometry stage is optional */
+	unsigned int geo_id = (geo_path != NULL) ? glCreateShader(GL_GEOMETRY_SHADER) : 0;
 
 	char *vertex_buffer = BG_MALLOC(char, 4096);
 	char *fragment_buffer = BG_MALLOC(char, 4096);
-	char *ctess_buffer = BG_MALLOC(char, 4096);
+	char *ctess_buffer = BG_MALLOC(char, 8192);
 	char *etess_buffer = BG_MALLOC(char, 8192);
 	char *geo_buffer = BG_MALLOC(char, 12188);
 	
 	B_load_file(vert_path, vertex_buffer, 4096);
 	B_load_file(frag_path, fragment_buffer, 4096);
-	B_load_file(ctess_path, ctess_buffer, 4096);
+	B_load_file(ctess_path, ctess_buffer, 8192);
 	B_load_file(etess_path, etess_buffer, 8192);
-	B_load_file(geo_path, geo_buffer, 12188);
+	if (geo_path != NULL)
+	{
+		B_load_file(geo_path, geo_buffer, 12188);
+	}
 
 	const char *vertex_source = vertex_buffer;
 	const char *fragment_source = fragment_buffer;
@@ -169,15 +173,18 @@ B_Shader B_compile_terrain_shader(const char *vert_path, const char *frag_path,
 	glCompileShader(etess_id);
 	B_check_shader(etess_id, etess_path, GL_COMPILE_STATUS);
 
-	glShaderSource(geo_id, 1, &geo_source, NULL);
-	glCompileShader(geo_id);
-	B_check_shader(geo_id, geo_path, GL_COMPILE_STATUS);
+	if (geo_path != NULL)
+	{
+		glShaderSource(geo_id, 1, &geo_source, NULL);
+		glCompileShader(geo_id);
+		B_check_shader(geo_id, geo_path, GL_COMPILE_STATUS);
+		glAttachShader(program_id, geo_id);
+	}
 
 	glAttachShader(program_id, vertex_id);
 	glAttachShader(program_id, fragment_id);
 	glAttachShader(program_id, ctess_id);
 	glAttachShader(program_id, etess_id);
-	glAttachShader(program_id, geo_id);
 	glLinkProgram(program_id);
 	B_check_shader(program_id, "shader program", GL_LINK_STATUS);
 
@@ -191,7 +198,10 @@ B_Shader B_compile_terrain_shader(const char *vert_path, const char *frag_path,
 	glDeleteShader(fragment_id);
 	glDeleteShader(ctess_id);
 	glDeleteShader(etess_id);
-	glDeleteShader(geo_id);
+	if (geo_path != NULL)
+	{
+		glDeleteShader(geo_id);
+	}
 
 	return program_id;
 }
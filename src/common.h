@@ -27,6 +27,26 @@
 #define USE_ALT_CAMERA 0
 #define BENCHMARK 0
 #define TERRAIN_XZ_SCALE 300
+/* When set, heightmaps are generated on the CPU (see heightmap_generation.c) and uploaded to the GPU, instead
+ * of being generated by the compute shaders and read back. */
+#define CPU_HEIGHTMAP_GENERATION 1
+/* When set, blocks generated on the CPU are cached on disk (see tile_cache.h) */
+#define USE_TILE_CACHE 1
+/* Terrain quality: land and water patch edges are tessellated into pieces about TERRAIN_TESSELLATION_PIXELS long on
+ * screen, unless that would come to more than TERRAIN_TRIANGLE_BUDGET triangles a frame. */
+#define TERRAIN_TESSELLATION_PIXELS 8.0f
+#define TERRAIN_TRIANGLE_BUDGET 2000000
+/* When set, every visible terrain block of a chunk is drawn with one instanced draw call, reading its offset and
+ * climate from the chunk's draw block buffer. Otherwise each block is its own draw call. */
+#define USE_INSTANCED_TERRAIN 1
+/* When set, rings of coarser and coarser terrain (see clipmap.h) are drawn out past the land chunk, and the view
+ * distance goes out to the edge of them. */
+#define USE_CLIPMAP_TERRAIN 0
+/* When set, the terrain is drawn from indexed meshes built on the CPU at a few levels of detail (see terrain_mesh.h)
+ * instead of being tessellated. That's a lot faster on software renderers and old GPUs. */
+#define USE_MESHED_TERRAIN 0
+/* When set, land blocks hidden behind nearer ridges (see horizon_culling.h) aren't drawn */
+#define USE_HORIZON_CULLING 1
 
 /* NOTE TO STRANGERS: The worlds are generated differently on different machines. These shortcuts are for me
  * during development, but won't work on your machine. Sorry :\ */
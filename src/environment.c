@@ -1,10 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <SDL2/SDL.h>
 #include "noise.h"
 #include "camera.h"
 #include "environment.h"
+#include "utils.h"
+#include "heightmap_generation.h"
+#include "climate_raster.h"
+
+/* Temperature and precipitation never change for a block, so they're kept here after the first time they're worked
+ * out. Only the rain level is redone, and that's once per frame. */
+ClimateCacheEntry g_climate_cache[CLIMATE_CACHE_SIZE];
+uint64_t g_climate_cache_hits = 0;
+uint64_t g_climate_cache_misses = 0;
+pthread_mutex_t g_climate_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Set once a frame on the main thread and read by the worker threads generating terrain, so it's atomic. It stays
+ * negative until the first frame sets it (the rain level itself never is). */
+_Atomic float g_current_rain_level = -1.0f;
 
 void B_send_raindrop_mesh_to_gpu(ParticleMesh *mesh)
 {
@@ -144,7 +159,7 @@ ParticleMesh create_snowflake_mesh(int g_buffer)
 	return mesh;
 }
 
-float get_current_rain_level(void)
+static float compute_current_rain_level(void)
 {	
 	uint64_t ticks = SDL_GetTicks64();
 //	ticks -= get_pause_time();
@@ -157,6 +172,22 @@ float get_current_rain_level(void)
 	return final;
 }
 
+void update_current_rain_level(void)
+{
+	atomic_store_explicit(&g_current_rain_level, compute_current_rain_level(), memory_order_relaxed);
+}
+
+float get_current_rain_level(void)
+{
+	/* Tools that never run a frame don't call update_current_rain_level */
+	float rain_level = atomic_load_explicit(&g_current_rain_level, memory_order_relaxed);
+	if (rain_level < 0.0f)
+	{
+		return compute_current_rain_level();
+	}
+	return rain_level;
+}
+
 float get_current_rain_chances(float current_rain_level, EnvironmentCondition environment_condition)
 {	
 	return environment_condition.precipitation - current_rain_level;
@@ -187,20 +218,32 @@ DirectionLight get_weather_light(EnvironmentCondition environment_condition)
 	return dir;
 }
 
-EnvironmentCondition get_environment_condition(uint64_t terrain_index)
+static int get_linear_temperature(float temperature_noise)
 {
-	uint64_t x_index = terrain_index % MAX_TERRAIN_BLOCKS;
-	uint64_t z_index = terrain_index / MAX_TERRAIN_BLOCKS;
-
-	float x = (float)(x_index) / MAX_TERRAIN_BLOCKS;
-	float z = (float)(z_index) / MAX_TERRAIN_BLOCKS;
+	return round((1.0f + temperature_noise/2.0f) * 100) - 55.0f;
+}
 
-	float precipitation = (1.0f + fbm2d(x*100, z*100, 6, 0.60))/2.0f;
-	int temperature = round((1.0f + fbm2d(x, z, 5, 0.80)/2.0f) * 100) - 55.0f;
+int polarize_temperature(int linear_temperature)
+{
 	/* Logistic function -- because otherwise wayy to much of the map is covered in areas right around 50 degrees.
 	 * This creates more polarization in temperatures -- snowy areas and warm areas instead of a bunch of middle ground */
-	temperature = 100.0f / (1.0f + powf(2.71828, -0.5f*(temperature-50.0f)));
-	float percent_cloudy = get_current_rain_level();
+	return 100.0f / (1.0f + powf(2.71828, -0.5f*(linear_temperature-50.0f)));
+}
+
+/* Turns the two climate fbm2d() values for a block into its temperature and precipitation */
+static ClimateCacheEntry make_climate(uint64_t terrain_index, float precipitation_noise, float temperature_noise)
+{
+	float precipitation = (1.0f + precipitation_noise)/2.0f;
+	int temperature = polarize_temperature(get_linear_temperature(temperature_noise));
+
+	ClimateCacheEntry climate = { terrain_index + 1, temperature, precipitation };
+	return climate;
+}
+
+/* Adds the part of the condition that changes over time to a block's climate */
+static EnvironmentCondition make_environment_condition(ClimateCacheEntry climate, float rain_level)
+{
+	float percent_cloudy = rain_level;
 
 	if (percent_cloudy > 1.0f)
 	{
@@ -211,16 +254,161 @@ EnvironmentCondition get_environment_condition(uint64_t terrain_index)
 		percent_cloudy = 0.0f;
 	}
 
-	if (precipitation < 0.2f)
+	if (climate.precipitation < 0.2f)
 	{
 		percent_cloudy = 0.0f;
 	}
 
-	EnvironmentCondition cond = { temperature, precipitation, percent_cloudy };
+	EnvironmentCondition cond = { climate.temperature, climate.precipitation, percent_cloudy };
 
 	return cond;
 }
 
+static ClimateCacheEntry *get_climate_cache_entry(uint64_t terrain_index)
+{
+	/* The slots wrap around the map like a ring buffer, so any CLIMATE_CACHE_WIDTH by CLIMATE_CACHE_WIDTH area of
+	 * blocks fits without two of them sharing a slot */
+	uint64_t x = (terrain_index % MAX_TERRAIN_BLOCKS) % CLIMATE_CACHE_WIDTH;
+	uint64_t z = (terrain_index / MAX_TERRAIN_BLOCKS) % CLIMATE_CACHE_WIDTH;
+	return &g_climate_cache[(z*CLIMATE_CACHE_WIDTH) + x];
+}
+
+/* Returns 1 and fills in dest if terrain_index's climate is in the cache. The caller holds g_climate_cache_mutex. */
+static int find_cached_climate(uint64_t terrain_index, ClimateCacheEntry *dest)
+{
+	ClimateCacheEntry *entry = get_climate_cache_entry(terrain_index);
+	if (entry->key == terrain_index + 1)
+	{
+		*dest = *entry;
+		g_climate_cache_hits++;
+		return 1;
+	}
+	g_climate_cache_misses++;
+	return 0;
+}
+
+EnvironmentCondition get_environment_condition(uint64_t terrain_index)
+{
+	float rain_level = get_current_rain_level();
+	ClimateCacheEntry climate;
+	pthread_mutex_lock(&g_climate_cache_mutex);
+	int cached = find_cached_climate(terrain_index, &climate);
+	pthread_mutex_unlock(&g_climate_cache_mutex);
+	if (cached)
+	{
+		return make_environment_condition(climate, rain_level);
+	}
+
+	uint64_t x_index = terrain_index % MAX_TERRAIN_BLOCKS;
+	uint64_t z_index = terrain_index / MAX_TERRAIN_BLOCKS;
+
+	float x = (float)(x_index) / MAX_TERRAIN_BLOCKS;
+	float z = (float)(z_index) / MAX_TERRAIN_BLOCKS;
+
+	climate = make_climate(terrain_index, fbm2d(x*100, z*100, 6, 0.60), fbm2d(x, z, 5, 0.80));
+	pthread_mutex_lock(&g_climate_cache_mutex);
+	*get_climate_cache_entry(terrain_index) = climate;
+	pthread_mutex_unlock(&g_climate_cache_mutex);
+	return make_environment_condition(climate, rain_level);
+}
+
+/* Same as calling get_environment_condition() for each index, but the noise for all the ones that aren't cached is
+ * done in one batch */
+void get_environment_conditions(const uint64_t *terrain_indices, EnvironmentCondition *conditions, int count)
+{
+	float rain_level = get_current_rain_level();
+	/* Which of terrain_indices missed the cache */
+	int *misses = BG_MALLOC(int, count);
+	uint64_t *missed_indices = BG_MALLOC(uint64_t, count);
+	ClimateCacheEntry *climates = BG_MALLOC(ClimateCacheEntry, count);
+	int num_misses = 0;
+	pthread_mutex_lock(&g_climate_cache_mutex);
+	for (int i = 0; i < count; ++i)
+	{
+		ClimateCacheEntry climate;
+		if (find_cached_climate(terrain_indices[i], &climate))
+		{
+			conditions[i] = make_environment_condition(climate, rain_level);
+		}
+		else
+		{
+			misses[num_misses++] = i;
+		}
+	}
+	pthread_mutex_unlock(&g_climate_cache_mutex);
+
+	for (int i = 0; i < num_misses; ++i)
+	{
+		missed_indices[i] = terrain_indices[misses[i]];
+	}
+	compute_block_climates(missed_indices, climates, NULL, num_misses);
+
+	pthread_mutex_lock(&g_climate_cache_mutex);
+	for (int i = 0; i < num_misses; ++i)
+	{
+		*get_climate_cache_entry(missed_indices[i]) = climates[i];
+		conditions[misses[i]] = make_environment_condition(climates[i], rain_level);
+	}
+	pthread_mutex_unlock(&g_climate_cache_mutex);
+	BG_FREE(misses);
+	BG_FREE(missed_indices);
+	BG_FREE(climates);
+}
+
+void compute_block_climates(const uint64_t *terrain_indices, ClimateCacheEntry *climates, int *linear_temperatures, 
+			    int count)
+{
+	/* x, z, then the same scaled by 100 for precipitation, then the two noise results */
+	float *buffer = BG_MALLOC(float, 6*count);
+	float *x = buffer;
+	float *z = &buffer[count];
+	float *precipitation_x = &buffer[2*count];
+	float *precipitation_z = &buffer[3*count];
+	float *precipitation = &buffer[4*count];
+	float *temperature = &buffer[5*count];
+	for (int i = 0; i < count; ++i)
+	{
+		x[i] = (float)(terrain_indices[i] % MAX_TERRAIN_BLOCKS) / MAX_TERRAIN_BLOCKS;
+		z[i] = (float)(terrain_indices[i] / MAX_TERRAIN_BLOCKS) / MAX_TERRAIN_BLOCKS;
+		precipitation_x[i] = x[i]*100;
+		precipitation_z[i] = z[i]*100;
+	}
+
+	fbm2d_n(precipitation_x, precipitation_z, precipitation, count, 6, 0.60, 6);
+	fbm2d_n(x, z, temperature, count, 5, 0.80, 6);
+
+	for (int i = 0; i < count; ++i)
+	{
+		climates[i] = make_climate(terrain_indices[i], precipitation[i], temperature[i]);
+	}
+	if (linear_temperatures != NULL)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			linear_temperatures[i] = get_linear_temperature(temperature[i]);
+		}
+	}
+	BG_FREE(buffer);
+}
+
+EnvironmentCondition get_approximate_environment_condition(uint64_t terrain_index)
+{
+	ClimateCacheEntry climate;
+	if (lookup_climate_raster(terrain_index, &climate))
+	{
+		return make_environment_condition(climate, get_current_rain_level());
+	}
+	return get_environment_condition(terrain_index);
+}
+
+void get_climate_cache_stats(uint64_t *hits, uint64_t *misses)
+{
+	pthread_mutex_lock(&g_climate_cache_mutex);
+	*hits = g_climate_cache_hits;
+	*misses = g_climate_cache_misses;
+	pthread_mutex_unlock(&g_climate_cache_mutex);
+}
+
 int get_current_tod_phase(double current_time)
 {
 	if ((current_time >= (B_SUNRISE_TIME * SECONDS_PER_IN_GAME_HOUR)) &&
@@ -555,8 +743,7 @@ void get_final_sky_color(EnvironmentCondition environment_condition, TimeOfDay t
 
 int camera_underwater(uint64_t terrain_index)
 {
-	EnvironmentCondition cond = get_environment_condition(terrain_index);
-	return ((get_camera_height() < SEA_LEVEL) && (cond.precipitation >= 0.2));
+	return ((get_camera_height() < SEA_LEVEL) && terrain_block_has_water(terrain_index));
 }
 
 void tod_phase_to_string(int phase, char *dest)
@@ -15,6 +15,20 @@ typedef struct EnvironmentCondition
 	float	percent_cloudy;
 } EnvironmentCondition;
 
+/* A block's temperature and precipitation, as kept by get_environment_condition's cache. key is the terrain index + 1,
+ * so that 0 can mean an empty slot. */
+typedef struct ClimateCacheEntry
+{
+	uint64_t	key;
+	int		temperature;
+	float		precipitation;
+} ClimateCacheEntry;
+
+/* The climate cache has a slot for each block of a CLIMATE_CACHE_WIDTH square that wraps around the map, which is
+ * plenty for the biggest chunks and whatever else is looked up around the player */
+#define CLIMATE_CACHE_WIDTH 64
+#define CLIMATE_CACHE_SIZE (CLIMATE_CACHE_WIDTH*CLIMATE_CACHE_WIDTH)
+
 #define MORNING_LIGHT_DIRECTION VEC3(1.0f, 0.0f, 0.0f)
 #define AFTERNOON_LIGHT_DIRECTION VEC3(0.0f, 1.0f, 0.0f)
 #define EVENING_LIGHT_DIRECTION VEC3(-1.0f, 0.0f, 0.0f)
@@ -57,6 +71,21 @@ typedef struct ParticleMesh
 
 void get_final_sky_color(EnvironmentCondition environment_condition, TimeOfDay tod, uint64_t terrain_index, vec3 dest);
 EnvironmentCondition get_environment_condition(uint64_t terrain_index);
+void get_environment_conditions(const uint64_t *terrain_indices, EnvironmentCondition *conditions, int count);
+/* Works out the climate of each block from scratch, without going through the cache. If linear_temperatures isn't
+ * NULL, it gets each block's temperature from before polarize_temperature(). */
+void compute_block_climates(const uint64_t *terrain_indices, ClimateCacheEntry *climates, int *linear_temperatures, 
+			    int count);
+/* Pushes temperatures away from 50 degrees. One degree of linear temperature around 50 is over 10 degrees after. */
+int polarize_temperature(int linear_temperature);
+/* get_environment_condition, from the baked climate raster if one is loaded (see climate_raster.h). Only for things
+ * that don't need the block's exact climate, like far away terrain. */
+EnvironmentCondition get_approximate_environment_condition(uint64_t terrain_index);
+/* How many climate lookups have been answered from the cache, and how many had to work it out */
+void get_climate_cache_stats(uint64_t *hits, uint64_t *misses);
+/* Works out the rain level for this frame, which get_current_rain_level and get_environment_condition return until
+ * the next call */
+void update_current_rain_level(void);
 DirectionLight get_weather_light(EnvironmentCondition environment_condition);
 ParticleMesh create_raindrop_mesh(int g_buffer);
 TimeOfDay get_time_of_day(void);
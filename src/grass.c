@@ -4,6 +4,7 @@
 #include "environment.h"
 #include "grass.h"
 #include "noise.h"
+#include "plant_noise.h"
 #include "utils.h"
 #include "camera.h"
 #include "debug.h"
@@ -181,7 +182,6 @@ void get_grass_patch_offsets(uint64_t terrain_index, vec2 offsets[9])
 void B_draw_grass_patch(TerrainElementMesh mesh, 
 			float scale_coefficient,
 			vec3 camera_position,
-			TerrainChunk *chunk,
 			mat4 projection_view,
 			vec3 player_position, 
 			vec3 player_facing,
@@ -189,7 +189,8 @@ void B_draw_grass_patch(TerrainElementMesh mesh,
 			int x_offset, 
 			int z_offset, 
 			int patch_size, 
-			vec2 base_offset)
+			vec2 base_offset,
+			float terrain_height)
 {
 	/* If base offset bleeds into another terrain block, don't draw.*/
 	if ((base_offset[0] > TERRAIN_XZ_SCALE*4) ||
@@ -201,7 +202,7 @@ void B_draw_grass_patch(TerrainElementMesh mesh,
 	vec3 offset = GLM_VEC3_ZERO_INIT;
 	offset[0] = base_offset[0] + (x_offset * (TERRAIN_XZ_SCALE*4));
 	offset[2] = base_offset[1] + (z_offset * (TERRAIN_XZ_SCALE*4));
-	offset[1] = get_terrain_height(offset, chunk);
+	offset[1] = terrain_height;
 	float max_distance = TERRAIN_XZ_SCALE * 2.0f;
 	vec3 frustum_corners[8];
 	if (USE_ALT_CAMERA)
@@ -267,6 +268,7 @@ void B_draw_grass_patch(TerrainElementMesh mesh,
 	glBindTexture(GL_TEXTURE_2D, mesh.heightmap);
 	B_set_uniform_float(mesh.shaders[0], "scale_factor", scale_coefficient);
 	B_set_uniform_int(mesh.shaders[0], "heightmap", 0);
+	B_bind_plant_noise(mesh.shaders[0]);
 	B_set_uniform_float(mesh.shaders[0], "patch_size", (float)patch_size);
 	B_set_uniform_mat4(mesh.shaders[0], "projection_view", projection_view);
 	B_set_uniform_float(mesh.shaders[0], "terrain_chunk_size", TERRAIN_XZ_SCALE*4.0f);
@@ -279,6 +281,10 @@ void B_draw_grass_patch(TerrainElementMesh mesh,
 	B_set_uniform_float(mesh.shaders[0], "max_distance", max_distance);
 	B_set_uniform_float(mesh.shaders[0], "sea_level", SEA_LEVEL);
 	B_set_uniform_int(mesh.shaders[0], "terrain_chunk_dimension", get_terrain_chunk_dimension());
+	vec2 heightmap_origin;
+	get_terrain_heightmap_origin(heightmap_origin);
+	B_set_uniform_vec2(mesh.shaders[0], "heightmap_origin", heightmap_origin);
+	B_set_uniform_float(mesh.shaders[0], "max_height", TERRAIN_MAX_HEIGHT);
 	B_set_uniform_float(mesh.shaders[0], "xz_scale", TERRAIN_XZ_SCALE);
 	B_set_uniform_int(mesh.shaders[0], "draw_debug", DRAW_DEBUG);
 
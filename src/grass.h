@@ -16,7 +16,6 @@ void get_grass_patch_offsets(uint64_t terrain_index, vec2 offsets[9]);
 void B_draw_grass_patch(TerrainElementMesh mesh, 
 			float scale_coefficient,
 			vec3 camera_position,
-			TerrainChunk *chunk,
 			mat4 projection_view,
 			vec3 player_position, 
 			vec3 player_facing,
@@ -24,7 +23,8 @@ void B_draw_grass_patch(TerrainElementMesh mesh,
 			int x_offset, 
 			int z_offset, 
 			int patch_size, 
-			vec2 base_offset);
+			vec2 base_offset,
+			float terrain_height);
 
 /*void draw_grass_patches(Plant grass_patch,
 			vec3 camera_position,
@@ -0,0 +1,218 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "height_pyramid.h"
+#include "utils.h"
+
+HeightPyramid create_height_pyramid(int width, int height)
+{
+	HeightPyramid pyramid = {0};
+	pyramid.width = width;
+	pyramid.height = height;
+
+	int level_width = (width + HEIGHT_PYRAMID_CELL_WIDTH - 1)/HEIGHT_PYRAMID_CELL_WIDTH;
+	int level_height = (height + HEIGHT_PYRAMID_CELL_WIDTH - 1)/HEIGHT_PYRAMID_CELL_WIDTH;
+	while (1)
+	{
+		if (pyramid.num_levels >= MAX_HEIGHT_PYRAMID_LEVELS)
+		{
+			fprintf(stderr, "create_height_pyramid error: %ix%i heightmap needs too many levels\n", width, height);
+			exit(-1);
+		}
+		pyramid.level_widths[pyramid.num_levels] = level_width;
+		pyramid.level_heights[pyramid.num_levels] = level_height;
+		pyramid.levels[pyramid.num_levels] = BG_MALLOC(HeightBounds, (level_width*level_height));
+		pyramid.num_levels++;
+		if ((level_width == 1) && (level_height == 1))
+		{
+			break;
+		}
+		level_width = (level_width + 1)/2;
+		level_height = (level_height + 1)/2;
+	}
+	return pyramid;
+}
+
+void free_height_pyramid(HeightPyramid *pyramid)
+{
+	for (int i = 0; i < pyramid->num_levels; ++i)
+	{
+		BG_FREE(pyramid->levels[i]);
+	}
+	pyramid->num_levels = 0;
+}
+
+static void merge_height_bounds(HeightBounds *dest, HeightBounds bounds)
+{
+	if (bounds.min < dest->min)
+	{
+		dest->min = bounds.min;
+	}
+	if (bounds.max > dest->max)
+	{
+		dest->max = bounds.max;
+	}
+}
+
+static void scan_height_bounds(HeightPyramid *pyramid, TerrainHeight *heights, int min_x, int min_z, int max_x, int max_z, HeightBounds *bounds)
+{
+	for (int z = min_z; z <= max_z; ++z)
+	{
+		TerrainHeight *row = &heights[z*pyramid->width];
+		for (int x = min_x; x <= max_x; ++x)
+		{
+			if (row[x].height < bounds->min)
+			{
+				bounds->min = row[x].height;
+			}
+			if (row[x].height > bounds->max)
+			{
+				bounds->max = row[x].height;
+			}
+		}
+	}
+}
+
+void update_height_pyramid_region(HeightPyramid *pyramid, TerrainHeight *heights, int x, int z, int width, int height)
+{
+	if ((width <= 0) || (height <= 0))
+	{
+		return;
+	}
+
+	/* The range of cells being recalculated, inclusive, on the level being worked on */
+	int min_x = x/HEIGHT_PYRAMID_CELL_WIDTH;
+	int min_z = z/HEIGHT_PYRAMID_CELL_WIDTH;
+	int max_x = (x + width - 1)/HEIGHT_PYRAMID_CELL_WIDTH;
+	int max_z = (z + height - 1)/HEIGHT_PYRAMID_CELL_WIDTH;
+
+	HeightBounds *level = pyramid->levels[0];
+	for (int cell_z = min_z; cell_z <= max_z; ++cell_z)
+	{
+		for (int cell_x = min_x; cell_x <= max_x; ++cell_x)
+		{
+			HeightBounds bounds = { UINT16_MAX, 0 };
+			int texel_x = cell_x*HEIGHT_PYRAMID_CELL_WIDTH;
+			int texel_z = cell_z*HEIGHT_PYRAMID_CELL_WIDTH;
+			scan_height_bounds(pyramid,
+					   heights,
+					   texel_x,
+					   texel_z,
+					   mini(texel_x + HEIGHT_PYRAMID_CELL_WIDTH, pyramid->width) - 1,
+					   mini(texel_z + HEIGHT_PYRAMID_CELL_WIDTH, pyramid->height) - 1,
+					   &bounds);
+			level[(cell_z*pyramid->level_widths[0]) + cell_x] = bounds;
+		}
+	}
+
+	for (int i = 1; i < pyramid->num_levels; ++i)
+	{
+		HeightBounds *children = pyramid->levels[i-1];
+		int child_width = pyramid->level_widths[i-1];
+		int child_height = pyramid->level_heights[i-1];
+		level = pyramid->levels[i];
+		min_x /= 2;
+		min_z /= 2;
+		max_x /= 2;
+		max_z /= 2;
+		for (int cell_z = min_z; cell_z <= max_z; ++cell_z)
+		{
+			for (int cell_x = min_x; cell_x <= max_x; ++cell_x)
+			{
+				HeightBounds bounds = { UINT16_MAX, 0 };
+				for (int child_z = cell_z*2; child_z < mini(cell_z*2 + 2, child_height); ++child_z)
+				{
+					for (int child_x = cell_x*2; child_x < mini(cell_x*2 + 2, child_width); ++child_x)
+					{
+						merge_height_bounds(&bounds, children[(child_z*child_width) + child_x]);
+					}
+				}
+				level[(cell_z*pyramid->level_widths[i]) + cell_x] = bounds;
+			}
+		}
+	}
+}
+
+static void get_cell_bounds(HeightPyramid *pyramid,
+			    TerrainHeight *heights,
+			    int level,
+			    int cell_x,
+			    int cell_z,
+			    int min_x,
+			    int min_z,
+			    int max_x,
+			    int max_z,
+			    HeightBounds *bounds)
+{
+	int cell_width = HEIGHT_PYRAMID_CELL_WIDTH << level;
+	int cell_min_x = cell_x*cell_width;
+	int cell_min_z = cell_z*cell_width;
+	int cell_max_x = mini(cell_min_x + cell_width, pyramid->width) - 1;
+	int cell_max_z = mini(cell_min_z + cell_width, pyramid->height) - 1;
+	if ((cell_min_x > max_x) || (cell_max_x < min_x) || (cell_min_z > max_z) || (cell_max_z < min_z))
+	{
+		return;
+	}
+
+	HeightBounds cell = pyramid->levels[level][(cell_z*pyramid->level_widths[level]) + cell_x];
+	/* Nothing in this cell can widen the bounds */
+	if ((cell.min >= bounds->min) && (cell.max <= bounds->max))
+	{
+		return;
+	}
+	if ((cell_min_x >= min_x) && (cell_max_x <= max_x) && (cell_min_z >= min_z) && (cell_max_z <= max_z))
+	{
+		merge_height_bounds(bounds, cell);
+		return;
+	}
+
+	if (level == 0)
+	{
+		scan_height_bounds(pyramid,
+				   heights,
+				   maxi(cell_min_x, min_x),
+				   maxi(cell_min_z, min_z),
+				   mini(cell_max_x, max_x),
+				   mini(cell_max_z, max_z),
+				   bounds);
+		return;
+	}
+
+	for (int child_z = cell_z*2; child_z < mini(cell_z*2 + 2, pyramid->level_heights[level-1]); ++child_z)
+	{
+		for (int child_x = cell_x*2; child_x < mini(cell_x*2 + 2, pyramid->level_widths[level-1]); ++child_x)
+		{
+			get_cell_bounds(pyramid, heights, level-1, child_x, child_z, min_x, min_z, max_x, max_z, bounds);
+		}
+	}
+}
+
+void get_height_pyramid_bounds(HeightPyramid *pyramid, TerrainHeight *heights, int min_x, int min_z, int max_x, int max_z, HeightBounds *bounds)
+{
+	min_x = maxi(min_x, 0);
+	min_z = maxi(min_z, 0);
+	max_x = mini(max_x, pyramid->width - 1);
+	max_z = mini(max_z, pyramid->height - 1);
+	if ((min_x > max_x) || (min_z > max_z))
+	{
+		return;
+	}
+	get_cell_bounds(pyramid, heights, pyramid->num_levels - 1, 0, 0, min_x, min_z, max_x, max_z, bounds);
+}
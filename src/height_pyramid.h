@@ -0,0 +1,34 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __HEIGHT_PYRAMID_H__
+#define __HEIGHT_PYRAMID_H__
+#include "terrain.h"
+
+/* width and height are the size of the heightmap the pyramid is for, in texels. */
+HeightPyramid create_height_pyramid(int width, int height);
+void free_height_pyramid(HeightPyramid *pyramid);
+
+/* Recalculates the part of the pyramid over the given rectangle of texels (and every level above it) after that
+ * part of heights has changed. heights has to be the same size as the pyramid. */
+void update_height_pyramid_region(HeightPyramid *pyramid, TerrainHeight *heights, int x, int z, int width, int height);
+
+/* Merges the bounds of heights between (min_x, min_z) and (max_x, max_z), inclusive, into bounds. Whole cells of
+ * the pyramid are used wherever they fit in the rectangle, so only the texels along its edges are ever read. */
+void get_height_pyramid_bounds(HeightPyramid *pyramid, TerrainHeight *heights, int min_x, int min_z, int max_x, int max_z, HeightBounds *bounds);
+#endif
@@ -0,0 +1,954 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thread_pool.h"
+#include "terrain_streaming.h"
+#include "tile_cache.h"
+#include "height_pyramid.h"
+#include "terrain_deformation.h"
+#include "heightmap_generation.h"
+
+/* The compute shaders rely on the GPU's sin(), which gives different results on different GPUs (and wildly inaccurate
+ * ones for the huge arguments rand() hands it). Here sin() is a fixed polynomial approximation (the one from Cephes'
+ * sinf) that is evaluated the same way in the scalar and the SIMD code, so every machine and every code path generates
+ * the same world. The compiler must not contract these expressions into FMAs, which is why the SIMD clones below only
+ * target AVX2 and not FMA. */
+#define HM_FOUR_OVER_PI 1.27323954473516f
+#define HM_DP1 0.78515625f
+#define HM_DP2 2.4187564849853515625e-4f
+#define HM_DP3 3.77489497744594108e-8f
+#define HM_SIN_P0 -1.9515295891e-4f
+#define HM_SIN_P1 8.3321608736e-3f
+#define HM_SIN_P2 -1.6666654611e-1f
+#define HM_COS_P0 2.443315711809948e-5f
+#define HM_COS_P1 -1.388731625493765e-3f
+#define HM_COS_P2 4.166664568298827e-2f
+
+/* cos(0.5) and sin(0.5), for the rotation between fbm octaves */
+#define HM_ROT_COS 0.87758256f
+#define HM_ROT_SIN 0.47942554f
+#define HM_NUM_OCTAVES 5
+
+typedef float v8f __attribute__((vector_size(32)));
+typedef int v8i __attribute__((vector_size(32)));
+
+/* The v8f helpers are always inlined, so the ABI notes about passing 32 byte vectors without AVX don't apply
+ * (the Makefile passes -Wno-psabi) */
+#define HM_INLINE static inline __attribute__((always_inline))
+
+typedef struct TerrainBlockJob
+{
+	int			type;
+	uint64_t		terrain_index;
+	EnvironmentCondition	condition;
+	TerrainHeight		*dest;
+	int			stride;
+} TerrainBlockJob;
+
+typedef struct TerrainNormalJob
+{
+	TerrainChunk		*chunk;
+	int			block_x;
+	int			block_z;
+} TerrainNormalJob;
+
+ThreadPool *g_heightmap_thread_pool = NULL;
+/* One for each block of the land chunk, centered on g_terrain_water_mask_center. See update_terrain_water_mask. */
+uint8_t *g_terrain_water_mask = NULL;
+int g_terrain_water_mask_dimension = 0;
+uint64_t g_terrain_water_mask_center;
+/* Blocks that update_terrain_water_mask found can have water, but that were dry the last time it was asked. They
+ * were skipped when the water chunk was generated, so they're kept here until take_new_terrain_water_blocks. */
+uint64_t *g_new_terrain_water_blocks = NULL;
+int g_num_new_terrain_water_blocks = 0;
+int g_max_new_terrain_water_blocks = 0;
+
+/* ---------------------------------------- scalar ---------------------------------------- */
+
+HM_INLINE int float_bits(float f)
+{
+	int i = 0;
+	memcpy(&i, &f, sizeof(i));
+	return i;
+}
+
+HM_INLINE float bits_float(int i)
+{
+	float f = 0;
+	memcpy(&f, &i, sizeof(f));
+	return f;
+}
+
+HM_INLINE float hm_sin(float x)
+{
+	int sign = float_bits(x) & (int)0x80000000;
+	float ax = bits_float(float_bits(x) & 0x7fffffff);
+	int j = (int)(ax * HM_FOUR_OVER_PI);
+	j = (j + 1) & ~1;
+	float y = (float)j;
+	int swap_sign = (j & 4) << 29;
+
+	float z = ((ax - y*HM_DP1) - y*HM_DP2) - y*HM_DP3;
+	float zz = z*z;
+	float r = 0.0f;
+	if (j & 2)
+	{
+		r = HM_COS_P0*zz + HM_COS_P1;
+		r = r*zz + HM_COS_P2;
+		r = r*zz*zz;
+		r = r - 0.5f*zz;
+		r = r + 1.0f;
+	}
+	else
+	{
+		r = HM_SIN_P0*zz + HM_SIN_P1;
+		r = r*zz + HM_SIN_P2;
+		r = r*zz*z;
+		r = r + z;
+	}
+	return bits_float(float_bits(r) ^ sign ^ swap_sign);
+}
+
+HM_INLINE float hm_floor(float x)
+{
+	float t = (float)(int)x;
+	if (t > x)
+	{
+		t = t + -1.0f;
+	}
+	return t;
+}
+
+HM_INLINE float hm_rand(float x, float y)
+{
+	float s = hm_sin(x*12.9898f + y*4.1414f) * 43758.5453f;
+	return s - hm_floor(s);
+}
+
+HM_INLINE float hm_mix(float a, float b, float t)
+{
+	return a*(1.0f - t) + b*t;
+}
+
+HM_INLINE float hm_noise(float x, float y)
+{
+	float ix = hm_floor(x);
+	float iy = hm_floor(y);
+	float ux = x - ix;
+	float uy = y - iy;
+	ux = ux*ux*(3.0f - 2.0f*ux);
+	uy = uy*uy*(3.0f - 2.0f*uy);
+
+	float res = hm_mix(hm_mix(hm_rand(ix, iy), hm_rand(ix + 1.0f, iy), ux),
+			   hm_mix(hm_rand(ix, iy + 1.0f), hm_rand(ix + 1.0f, iy + 1.0f), ux), uy);
+	return res*res;
+}
+
+HM_INLINE float hm_fbm(float x, float y)
+{
+	float v = 0.0f;
+	float a = 0.5f;
+	for (int i = 0; i < HM_NUM_OCTAVES; ++i)
+	{
+		v += a * hm_noise(x, y);
+		float rx = HM_ROT_COS*x - HM_ROT_SIN*y;
+		float ry = HM_ROT_SIN*x + HM_ROT_COS*y;
+		x = rx*2.0f + 100.0f;
+		y = ry*2.0f + 100.0f;
+		a *= 0.5f;
+	}
+	return v;
+}
+
+/* hm_noise, and its derivatives along x and y */
+HM_INLINE float hm_noise_deriv(float x, float y, float *dx, float *dy)
+{
+	float ix = hm_floor(x);
+	float iy = hm_floor(y);
+	float fx = x - ix;
+	float fy = y - iy;
+	float ux = fx*fx*(3.0f - 2.0f*fx);
+	float uy = fy*fy*(3.0f - 2.0f*fy);
+	float dux = 6.0f*fx*(1.0f - fx);
+	float duy = 6.0f*fy*(1.0f - fy);
+
+	float a = hm_rand(ix, iy);
+	float b = hm_rand(ix + 1.0f, iy);
+	float c = hm_rand(ix, iy + 1.0f);
+	float d = hm_rand(ix + 1.0f, iy + 1.0f);
+	float low = hm_mix(a, b, ux);
+	float high = hm_mix(c, d, ux);
+	float res = hm_mix(low, high, uy);
+	*dx = 2.0f*res*hm_mix(b - a, d - c, uy)*dux;
+	*dy = 2.0f*res*(high - low)*duy;
+	return res*res;
+}
+
+/* hm_fbm, and its derivatives along x and y. The value is exactly the same as hm_fbm's. */
+HM_INLINE float hm_fbm_deriv(float x, float y, float *dx, float *dy)
+{
+	float v = 0.0f;
+	float a = 0.5f;
+	/* How much the octave's coordinates move per unit of the original x and y. Each octave rotates and doubles them. */
+	float m00 = 1.0f;
+	float m01 = 0.0f;
+	float m10 = 0.0f;
+	float m11 = 1.0f;
+	*dx = 0.0f;
+	*dy = 0.0f;
+	for (int i = 0; i < HM_NUM_OCTAVES; ++i)
+	{
+		float noise_dx;
+		float noise_dy;
+		v += a * hm_noise_deriv(x, y, &noise_dx, &noise_dy);
+		*dx += a*(noise_dx*m00 + noise_dy*m10);
+		*dy += a*(noise_dx*m01 + noise_dy*m11);
+		float rx = HM_ROT_COS*x - HM_ROT_SIN*y;
+		float ry = HM_ROT_SIN*x + HM_ROT_COS*y;
+		x = rx*2.0f + 100.0f;
+		y = ry*2.0f + 100.0f;
+		float n00 = 2.0f*(HM_ROT_COS*m00 - HM_ROT_SIN*m10);
+		float n01 = 2.0f*(HM_ROT_COS*m01 - HM_ROT_SIN*m11);
+		m10 = 2.0f*(HM_ROT_SIN*m00 + HM_ROT_COS*m10);
+		m11 = 2.0f*(HM_ROT_SIN*m01 + HM_ROT_COS*m11);
+		m00 = n00;
+		m01 = n01;
+		a *= 0.5f;
+	}
+	return v;
+}
+
+/* Snow slides off ground that's too steep. The slope comes from the derivatives of the height's two fbms, which are
+ * taken at land's noise coordinates: heightmap texels * 5/TERRAIN_XZ_SCALE, with scale's at a tenth of those. Dividing
+ * by a texel's width turns it into world height per world unit. */
+HM_INLINE float hm_slide_snow(float snow, float value, float scale, float value_dx, float value_dz, float scale_dx, float scale_dz)
+{
+	float texel_width = (TERRAIN_XZ_SCALE*4.0f)/HEIGHTMAP_BLOCK_WIDTH;
+	float factor = (TERRAIN_HEIGHT_FACTOR*(5.0f/TERRAIN_XZ_SCALE))/texel_width;
+	float x_slope = (value_dx*scale + value*(scale_dx/10.0f))*factor;
+	float z_slope = (value_dz*scale + value*(scale_dz/10.0f))*factor;
+	float slope = sqrtf(x_slope*x_slope + z_slope*z_slope);
+	return snow - (TERRAIN_SNOW_SLIDE*fmaxf(slope - TERRAIN_SNOW_MAX_SLOPE, 0.0f));
+}
+
+HM_INLINE TerrainHeight hm_terrain_height(int type, float x, float z, EnvironmentCondition condition)
+{
+	float value = 0.0f;
+	float scale = 0.0f;
+	float snow = 0.0f;
+	if (type == TERRAIN_CHUNK_LAND)
+	{
+		float pos_x = (x/TERRAIN_XZ_SCALE)*5.0f;
+		float pos_z = (z/TERRAIN_XZ_SCALE)*5.0f;
+		if ((condition.temperature < 32) && (condition.precipitation > 0.2f))
+		{
+			float value_dx, value_dz, scale_dx, scale_dz;
+			value = hm_fbm_deriv(pos_x, pos_z, &value_dx, &value_dz);
+			scale = hm_fbm_deriv(pos_x/10.0f, pos_z/10.0f, &scale_dx, &scale_dz);
+			snow = hm_fbm(pos_x + condition.precipitation, pos_z + condition.precipitation);
+			snow = hm_slide_snow(snow, value, scale, value_dx, value_dz, scale_dx, scale_dz);
+		}
+		else
+		{
+			value = hm_fbm(pos_x, pos_z);
+			scale = hm_fbm(pos_x/10.0f, pos_z/10.0f);
+		}
+	}
+	else
+	{
+		float pos_x = (x/TERRAIN_XZ_SCALE)*40.0f;
+		float pos_z = (z/TERRAIN_XZ_SCALE)*40.0f;
+		value = hm_fbm(pos_x, pos_z);
+		scale = hm_fbm(pos_x + 50.0f, pos_z + 50.0f);
+		snow = hm_fbm(pos_x - 50.0f, pos_z - 50.0f);
+	}
+	return pack_terrain_height(type, value, scale, snow);
+}
+
+/* ---------------------------------------- SIMD ---------------------------------------- */
+
+HM_INLINE v8f hm_sin8(v8f x)
+{
+	v8i sign = (v8i)x & (int)0x80000000;
+	v8f ax = (v8f)((v8i)x & 0x7fffffff);
+	v8i j = __builtin_convertvector(ax * HM_FOUR_OVER_PI, v8i);
+	j = (j + 1) & ~1;
+	v8f y = __builtin_convertvector(j, v8f);
+	v8i swap_sign = (j & 4) << 29;
+	v8i use_cos = (j & 2) == 2;
+
+	v8f z = ((ax - y*HM_DP1) - y*HM_DP2) - y*HM_DP3;
+	v8f zz = z*z;
+
+	v8f c = HM_COS_P0*zz + HM_COS_P1;
+	c = c*zz + HM_COS_P2;
+	c = c*zz*zz;
+	c = c - 0.5f*zz;
+	c = c + 1.0f;
+
+	v8f s = HM_SIN_P0*zz + HM_SIN_P1;
+	s = s*zz + HM_SIN_P2;
+	s = s*zz*z;
+	s = s + z;
+
+	v8i r = ((v8i)c & use_cos) | ((v8i)s & ~use_cos);
+	return (v8f)(r ^ sign ^ swap_sign);
+}
+
+HM_INLINE v8f hm_floor8(v8f x)
+{
+	v8f t = __builtin_convertvector(__builtin_convertvector(x, v8i), v8f);
+	/* The comparison is -1 where true, so this subtracts 1 where t rounded up */
+	return t + __builtin_convertvector(t > x, v8f);
+}
+
+HM_INLINE v8f hm_rand8(v8f x, v8f y)
+{
+	v8f s = hm_sin8(x*12.9898f + y*4.1414f) * 43758.5453f;
+	return s - hm_floor8(s);
+}
+
+HM_INLINE v8f hm_mix8(v8f a, v8f b, v8f t)
+{
+	return a*(1.0f - t) + b*t;
+}
+
+HM_INLINE v8f hm_noise8(v8f x, v8f y)
+{
+	v8f ix = hm_floor8(x);
+	v8f iy = hm_floor8(y);
+	v8f ux = x - ix;
+	v8f uy = y - iy;
+	ux = ux*ux*(3.0f - 2.0f*ux);
+	uy = uy*uy*(3.0f - 2.0f*uy);
+
+	v8f res = hm_mix8(hm_mix8(hm_rand8(ix, iy), hm_rand8(ix + 1.0f, iy), ux),
+			  hm_mix8(hm_rand8(ix, iy + 1.0f), hm_rand8(ix + 1.0f, iy + 1.0f), ux), uy);
+	return res*res;
+}
+
+HM_INLINE v8f hm_fbm8(v8f x, v8f y)
+{
+	v8f v = {0};
+	float a = 0.5f;
+	for (int i = 0; i < HM_NUM_OCTAVES; ++i)
+	{
+		v += a * hm_noise8(x, y);
+		v8f rx = HM_ROT_COS*x - HM_ROT_SIN*y;
+		v8f ry = HM_ROT_SIN*x + HM_ROT_COS*y;
+		x = rx*2.0f + 100.0f;
+		y = ry*2.0f + 100.0f;
+		a *= 0.5f;
+	}
+	return v;
+}
+
+HM_INLINE v8f hm_noise_deriv8(v8f x, v8f y, v8f *dx, v8f *dy)
+{
+	v8f ix = hm_floor8(x);
+	v8f iy = hm_floor8(y);
+	v8f fx = x - ix;
+	v8f fy = y - iy;
+	v8f ux = fx*fx*(3.0f - 2.0f*fx);
+	v8f uy = fy*fy*(3.0f - 2.0f*fy);
+	v8f dux = 6.0f*fx*(1.0f - fx);
+	v8f duy = 6.0f*fy*(1.0f - fy);
+
+	v8f a = hm_rand8(ix, iy);
+	v8f b = hm_rand8(ix + 1.0f, iy);
+	v8f c = hm_rand8(ix, iy + 1.0f);
+	v8f d = hm_rand8(ix + 1.0f, iy + 1.0f);
+	v8f low = hm_mix8(a, b, ux);
+	v8f high = hm_mix8(c, d, ux);
+	v8f res = hm_mix8(low, high, uy);
+	*dx = 2.0f*res*hm_mix8(b - a, d - c, uy)*dux;
+	*dy = 2.0f*res*(high - low)*duy;
+	return res*res;
+}
+
+HM_INLINE v8f hm_fbm_deriv8(v8f x, v8f y, v8f *dx, v8f *dy)
+{
+	v8f v = {0};
+	float a = 0.5f;
+	float m00 = 1.0f;
+	float m01 = 0.0f;
+	float m10 = 0.0f;
+	float m11 = 1.0f;
+	*dx = (v8f){0};
+	*dy = (v8f){0};
+	for (int i = 0; i < HM_NUM_OCTAVES; ++i)
+	{
+		v8f noise_dx;
+		v8f noise_dy;
+		v += a * hm_noise_deriv8(x, y, &noise_dx, &noise_dy);
+		*dx += a*(noise_dx*m00 + noise_dy*m10);
+		*dy += a*(noise_dx*m01 + noise_dy*m11);
+		v8f rx = HM_ROT_COS*x - HM_ROT_SIN*y;
+		v8f ry = HM_ROT_SIN*x + HM_ROT_COS*y;
+		x = rx*2.0f + 100.0f;
+		y = ry*2.0f + 100.0f;
+		float n00 = 2.0f*(HM_ROT_COS*m00 - HM_ROT_SIN*m10);
+		float n01 = 2.0f*(HM_ROT_COS*m01 - HM_ROT_SIN*m11);
+		m10 = 2.0f*(HM_ROT_SIN*m00 + HM_ROT_COS*m10);
+		m11 = 2.0f*(HM_ROT_SIN*m01 + HM_ROT_COS*m11);
+		m00 = n00;
+		m01 = n01;
+		a *= 0.5f;
+	}
+	return v;
+}
+
+void generate_terrain_height_row_reference(int type,
+					   float x,
+					   float z,
+					   float step,
+					   int count,
+					   EnvironmentCondition condition,
+					   TerrainHeight *dest)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		dest[i] = hm_terrain_height(type, x + (float)i*step, z, condition);
+	}
+}
+
+__attribute__((target_clones("avx2", "default")))
+void generate_terrain_height_row(int type,
+				 float x,
+				 float z,
+				 float step,
+				 int count,
+				 EnvironmentCondition condition,
+				 TerrainHeight *dest)
+{
+	const v8f lanes = { 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f };
+	int snowy = (condition.temperature < 32) && (condition.precipitation > 0.2f);
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		v8f pos_x = x + (lanes + (float)i)*step;
+		v8f pos_z = (v8f){0} + z;
+		v8f value;
+		v8f scale;
+		v8f snow = {0};
+		if (type == TERRAIN_CHUNK_LAND)
+		{
+			pos_x = (pos_x/TERRAIN_XZ_SCALE)*5.0f;
+			pos_z = (pos_z/TERRAIN_XZ_SCALE)*5.0f;
+			if (snowy)
+			{
+				v8f value_dx, value_dz, scale_dx, scale_dz;
+				value = hm_fbm_deriv8(pos_x, pos_z, &value_dx, &value_dz);
+				scale = hm_fbm_deriv8(pos_x/10.0f, pos_z/10.0f, &scale_dx, &scale_dz);
+				snow = hm_fbm8(pos_x + condition.precipitation, pos_z + condition.precipitation);
+				/* The square root isn't worth vectorizing, next to the fbms */
+				for (int lane = 0; lane < 8; ++lane)
+				{
+					snow[lane] = hm_slide_snow(snow[lane], value[lane], scale[lane], 
+								   value_dx[lane], value_dz[lane], scale_dx[lane], scale_dz[lane]);
+				}
+			}
+			else
+			{
+				value = hm_fbm8(pos_x, pos_z);
+				scale = hm_fbm8(pos_x/10.0f, pos_z/10.0f);
+			}
+		}
+		else
+		{
+			pos_x = (pos_x/TERRAIN_XZ_SCALE)*40.0f;
+			pos_z = (pos_z/TERRAIN_XZ_SCALE)*40.0f;
+			value = hm_fbm8(pos_x, pos_z);
+			scale = hm_fbm8(pos_x + 50.0f, pos_z + 50.0f);
+			snow = hm_fbm8(pos_x - 50.0f, pos_z - 50.0f);
+		}
+		for (int lane = 0; lane < 8; ++lane)
+		{
+			dest[i + lane] = pack_terrain_height(type, value[lane], scale[lane], snow[lane]);
+		}
+	}
+	for (; i < count; ++i)
+	{
+		dest[i] = hm_terrain_height(type, x + (float)i*step, z, condition);
+	}
+}
+
+void generate_terrain_block(int type, uint64_t terrain_index, EnvironmentCondition condition, TerrainHeight *dest, int stride)
+{
+	/* The shaders get the block index as an int, and the block offsets as uints */
+	uint32_t x_block_offset = (uint32_t)(terrain_index % MAX_TERRAIN_BLOCKS) * HEIGHTMAP_BLOCK_WIDTH;
+	uint32_t z_block_offset = (uint32_t)(terrain_index / MAX_TERRAIN_BLOCKS) * HEIGHTMAP_BLOCK_WIDTH;
+	for (int z = 0; z < HEIGHTMAP_BLOCK_WIDTH; ++z)
+	{
+		generate_terrain_height_row(type,
+					    (float)x_block_offset,
+					    (float)z + (float)z_block_offset,
+					    1.0f,
+					    HEIGHTMAP_BLOCK_WIDTH,
+					    condition,
+					    &dest[z*stride]);
+	}
+}
+
+void load_or_generate_terrain_block(int type, uint64_t terrain_index, EnvironmentCondition condition, TerrainHeight *dest, int stride)
+{
+	if (USE_TILE_CACHE && load_cached_terrain_block(type, terrain_index, NULL, dest, stride))
+	{
+		return;
+	}
+	generate_terrain_block(type, terrain_index, condition, dest, stride);
+	if (USE_TILE_CACHE)
+	{
+		store_cached_terrain_block(type, terrain_index, condition, dest, stride);
+	}
+}
+
+static void generate_terrain_block_job(void *arg)
+{
+	TerrainBlockJob *job = (TerrainBlockJob *)arg;
+	if (!take_streamed_terrain_block(job->type, job->terrain_index, job->dest, job->stride))
+	{
+		load_or_generate_terrain_block(job->type, job->terrain_index, job->condition, job->dest, job->stride);
+	}
+	/* The cache and the streamer only ever have the blocks as they were generated */
+	if (job->type == TERRAIN_CHUNK_LAND)
+	{
+		apply_terrain_edits_to_block(job->terrain_index, job->dest, job->stride);
+	}
+}
+
+void generate_terrain_chunk_blocks(TerrainChunk *chunk, ivec2 *blocks, int num_blocks)
+{
+	if (g_heightmap_thread_pool == NULL)
+	{
+		g_heightmap_thread_pool = create_thread_pool(0);
+	}
+
+	TerrainBlockJob *jobs = BG_MALLOC(TerrainBlockJob, num_blocks);
+	uint64_t *indices = BG_MALLOC(uint64_t, num_blocks);
+	EnvironmentCondition *conditions = BG_MALLOC(EnvironmentCondition, num_blocks);
+	int num_jobs = 0;
+	for (int i = 0; i < num_blocks; ++i)
+	{
+		int index = get_terrain_chunk_block_index(chunk, blocks[i][0], blocks[i][1]);
+		/* Dry blocks are never drawn, so their part of the water heightmap can be left alone */
+		if ((chunk->type == TERRAIN_CHUNK_WATER) && !terrain_block_has_water(index))
+		{
+			continue;
+		}
+		jobs[num_jobs].type = chunk->type;
+		jobs[num_jobs].terrain_index = index;
+		jobs[num_jobs].dest = get_terrain_block_buffer(chunk, blocks[i][0], blocks[i][1]);
+		jobs[num_jobs].stride = chunk->heightmap_width;
+		indices[num_jobs] = index;
+		num_jobs++;
+	}
+
+	/* The climate noise for the whole batch of blocks is done at once, before any job starts */
+	get_environment_conditions(indices, conditions, num_jobs);
+	for (int i = 0; i < num_jobs; ++i)
+	{
+		jobs[i].condition = conditions[i];
+		thread_pool_submit(g_heightmap_thread_pool, generate_terrain_block_job, &jobs[i]);
+	}
+	thread_pool_wait(g_heightmap_thread_pool);
+	BG_FREE(jobs);
+	BG_FREE(indices);
+	BG_FREE(conditions);
+
+	if (chunk->height_pyramid.num_levels)
+	{
+		for (int i = 0; i < num_blocks; ++i)
+		{
+			unsigned int index = get_heightmap_buffer_index(chunk, blocks[i][0]*chunk->width, blocks[i][1]*chunk->height);
+			update_height_pyramid_region(&chunk->height_pyramid,
+						     chunk->heightmap_buffer,
+						     index % chunk->heightmap_width,
+						     index / chunk->heightmap_width,
+						     chunk->width,
+						     chunk->height);
+		}
+		update_terrain_water_mask(chunk);
+	}
+
+	if (chunk->normal_buffer != NULL)
+	{
+		ivec2 *normal_blocks = BG_MALLOC(ivec2, chunk->dimension*chunk->dimension);
+		int num_normal_blocks = get_terrain_normal_blocks(chunk, blocks, num_blocks, normal_blocks);
+		generate_terrain_chunk_normals(chunk, normal_blocks, num_normal_blocks);
+		BG_FREE(normal_blocks);
+	}
+}
+
+static int clamp_texel(int value, int max)
+{
+	if (value < 0)
+	{
+		return 0;
+	}
+	if (value > max)
+	{
+		return max;
+	}
+	return value;
+}
+
+static TerrainHeight get_clamped_texel(TerrainChunk *chunk, int x, int z)
+{
+	x = clamp_texel(x, chunk->heightmap_width-1);
+	z = clamp_texel(z, chunk->heightmap_height-1);
+	return chunk->heightmap_buffer[get_heightmap_buffer_index(chunk, x, z)];
+}
+
+/* The slopes of the ground at texel (x, z), in height per unit */
+static void get_terrain_texel_slopes(TerrainChunk *chunk, int x, int z, int step, float *x_slope, float *z_slope)
+{
+	float spacing = (TERRAIN_XZ_SCALE*4.0f)/chunk->width;
+	x = clamp_texel(x, chunk->heightmap_width-1);
+	z = clamp_texel(z, chunk->heightmap_height-1);
+	int left = clamp_texel(x-step, chunk->heightmap_width-1);
+	int right = clamp_texel(x+step, chunk->heightmap_width-1);
+	int up = clamp_texel(z-step, chunk->heightmap_height-1);
+	int down = clamp_texel(z+step, chunk->heightmap_height-1);
+
+	*x_slope = (unpack_terrain_height(get_clamped_texel(chunk, right, z)) - unpack_terrain_height(get_clamped_texel(chunk, left, z)))/
+		   ((right-left)*spacing);
+	*z_slope = (unpack_terrain_height(get_clamped_texel(chunk, x, down)) - unpack_terrain_height(get_clamped_texel(chunk, x, up)))/
+		   ((down-up)*spacing);
+}
+
+void get_terrain_texel_normal(TerrainChunk *chunk, int x, int z, int step, vec3 dest)
+{
+	float x_slope = 0.0f;
+	float z_slope = 0.0f;
+	get_terrain_texel_slopes(chunk, x, z, step, &x_slope, &z_slope);
+	dest[0] = -x_slope;
+	dest[1] = 1.0f;
+	dest[2] = -z_slope;
+	glm_vec3_normalize(dest);
+}
+
+/* Where snow is just starting, it's lit as if it were piled up against whichever neighbour has the least snow. This is
+ * how the terrain geometry shader used to do it. */
+static void get_snow_border_normal(TerrainChunk *chunk, int x, int z, float snow, vec3 normal, vec3 dest)
+{
+	const int offsets[8][2] = { { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 }, { 1, 1 }, { -1, -1 }, { 1, -1 }, { -1, 1 } };
+	const vec3 directions[8] = { { 0.0f, 0.0f, 1.0f },
+				     { -1.0f, 0.0f, 0.0f },
+				     { 0.0f, 0.0f, -1.0f },
+				     { -1.0f, 0.0f, 0.0f },
+				     { -1.0f, 0.0f, 1.0f },
+				     { 1.0f, 0.0f, -1.0f },
+				     { 1.0f, 0.0f, 1.0f },
+				     { -1.0f, 0.0f, -1.0f } };
+	float max_difference = -1.0f;
+	int max_difference_index = -1;
+	for (int i = 0; i < 8; ++i)
+	{
+		float difference = snow - unpack_terrain_snow(get_clamped_texel(chunk, x + offsets[i][0], z + offsets[i][1]));
+		if (max_difference < difference)
+		{
+			max_difference = difference;
+			max_difference_index = i;
+		}
+	}
+	if ((max_difference_index < 0) || (fabsf(snow - 0.35f) < 0.0001f))
+	{
+		glm_vec3_copy(normal, dest);
+		return;
+	}
+
+	vec3 xz_part;
+	glm_vec3_cross(normal, (float *)directions[max_difference_index], xz_part);
+	glm_vec3_normalize(xz_part);
+	/* Not glm_vec3_lerp, which would clamp this */
+	float t = 1.0f/(snow - 0.35f);
+	for (int i = 0; i < 3; ++i)
+	{
+		dest[i] = xz_part[i] + ((normal[i] - xz_part[i]) * t);
+	}
+	glm_vec3_normalize(dest);
+}
+
+void generate_terrain_rect_normals(TerrainChunk *chunk, int first_x, int first_z, int width, int height)
+{
+	for (int z = first_z; z < first_z + height; ++z)
+	{
+		for (int x = first_x; x < first_x + width; ++x)
+		{
+			float x_slope = 0.0f;
+			float z_slope = 0.0f;
+			get_terrain_texel_slopes(chunk, x, z, 1, &x_slope, &z_slope);
+			vec3 normal = { -x_slope, 1.0f, -z_slope };
+			glm_vec3_normalize(normal);
+
+			vec3 snow_normal;
+			float snow = unpack_terrain_snow(get_clamped_texel(chunk, x, z));
+			if (snow > 0.36f)
+			{
+				snow_normal[0] = -x_slope*TERRAIN_SNOW_NORMAL_FLATNESS;
+				snow_normal[1] = 1.0f;
+				snow_normal[2] = -z_slope*TERRAIN_SNOW_NORMAL_FLATNESS;
+				glm_vec3_normalize(snow_normal);
+			}
+			else if (snow >= 0.33f)
+			{
+				get_snow_border_normal(chunk, x, z, snow, normal, snow_normal);
+			}
+			else
+			{
+				glm_vec3_copy(normal, snow_normal);
+			}
+			chunk->normal_buffer[get_heightmap_buffer_index(chunk, x, z)] = pack_terrain_normal(normal, snow_normal);
+		}
+	}
+}
+
+static void generate_terrain_block_normals_job(void *arg)
+{
+	TerrainNormalJob *job = (TerrainNormalJob *)arg;
+	generate_terrain_rect_normals(job->chunk, 
+				      job->block_x*job->chunk->width, 
+				      job->block_z*job->chunk->height, 
+				      job->chunk->width, 
+				      job->chunk->height);
+}
+
+void generate_terrain_chunk_normals(TerrainChunk *chunk, ivec2 *blocks, int num_blocks)
+{
+	if (g_heightmap_thread_pool == NULL)
+	{
+		g_heightmap_thread_pool = create_thread_pool(0);
+	}
+
+	TerrainNormalJob *jobs = BG_MALLOC(TerrainNormalJob, num_blocks);
+	for (int i = 0; i < num_blocks; ++i)
+	{
+		jobs[i].chunk = chunk;
+		jobs[i].block_x = blocks[i][0];
+		jobs[i].block_z = blocks[i][1];
+		thread_pool_submit(g_heightmap_thread_pool, generate_terrain_block_normals_job, &jobs[i]);
+	}
+	thread_pool_wait(g_heightmap_thread_pool);
+	BG_FREE(jobs);
+}
+
+int get_terrain_normal_blocks(TerrainChunk *chunk, ivec2 *blocks, int num_blocks, ivec2 *dest)
+{
+	int dimension = chunk->dimension;
+	if (num_blocks <= 0)
+	{
+		return 0;
+	}
+
+	uint8_t *changed = BG_MALLOC(uint8_t, dimension*dimension);
+	memset(changed, 0, dimension*dimension);
+	/* A block's normals along its edges come from its neighbours' heights */
+	for (int i = 0; i < num_blocks; ++i)
+	{
+		for (int z = blocks[i][1]-1; z <= blocks[i][1]+1; ++z)
+		{
+			for (int x = blocks[i][0]-1; x <= blocks[i][0]+1; ++x)
+			{
+				if ((x >= 0) && (x < dimension) && (z >= 0) && (z < dimension))
+				{
+					changed[(z*dimension) + x] = 1;
+				}
+			}
+		}
+	}
+	/* The ones on the edge of the chunk now might have lost neighbours that were scrolled out */
+	for (int i = 0; i < dimension; ++i)
+	{
+		changed[i] = 1;
+		changed[((dimension-1)*dimension) + i] = 1;
+		changed[i*dimension] = 1;
+		changed[(i*dimension) + dimension-1] = 1;
+	}
+
+	int num_changed = 0;
+	for (int i = 0; i < dimension*dimension; ++i)
+	{
+		if (changed[i])
+		{
+			dest[num_changed][0] = i % dimension;
+			dest[num_changed][1] = i / dimension;
+			num_changed++;
+		}
+	}
+	BG_FREE(changed);
+	return num_changed;
+}
+
+static void add_new_terrain_water_block(uint64_t terrain_index)
+{
+	if (g_num_new_terrain_water_blocks == g_max_new_terrain_water_blocks)
+	{
+		g_max_new_terrain_water_blocks = (g_max_new_terrain_water_blocks == 0) ? 64 : g_max_new_terrain_water_blocks*2;
+		uint64_t *blocks = BG_MALLOC(uint64_t, g_max_new_terrain_water_blocks);
+		if (g_num_new_terrain_water_blocks > 0)
+		{
+			memcpy(blocks, g_new_terrain_water_blocks, g_num_new_terrain_water_blocks*sizeof(uint64_t));
+		}
+		BG_FREE(g_new_terrain_water_blocks);
+		g_new_terrain_water_blocks = blocks;
+	}
+	g_new_terrain_water_blocks[g_num_new_terrain_water_blocks++] = terrain_index;
+}
+
+void update_terrain_water_mask(TerrainChunk *land_chunk)
+{
+	int dimension = land_chunk->dimension;
+	int half_dimension = dimension/2;
+	/* What the old mask said, to find the blocks that have just become wet */
+	uint8_t *had_water = BG_MALLOC(uint8_t, dimension*dimension);
+	for (int z = 0; z < dimension; ++z)
+	{
+		for (int x = 0; x < dimension; ++x)
+		{
+			uint64_t index = land_chunk->center_index + ((z - half_dimension)*MAX_TERRAIN_BLOCKS) + (x - half_dimension);
+			had_water[z*dimension + x] = terrain_block_has_water(index);
+		}
+	}
+	if (g_terrain_water_mask_dimension != dimension)
+	{
+		BG_FREE(g_terrain_water_mask);
+		g_terrain_water_mask = BG_MALLOC(uint8_t, dimension*dimension);
+		g_terrain_water_mask_dimension = dimension;
+	}
+	g_terrain_water_mask_center = land_chunk->center_index;
+
+	for (int z = 0; z < dimension; ++z)
+	{
+		for (int x = 0; x < dimension; ++x)
+		{
+			uint64_t index = land_chunk->center_index + ((z - half_dimension)*MAX_TERRAIN_BLOCKS) + (x - half_dimension);
+			EnvironmentCondition cond = get_environment_condition(index);
+			if (cond.precipitation < 0.2)
+			{
+				g_terrain_water_mask[z*dimension + x] = 0;
+				continue;
+			}
+
+			/* A block is always one rectangle in the buffer, the ring buffer only wraps between blocks */
+			unsigned int buffer_index = get_heightmap_buffer_index(land_chunk, x*land_chunk->width, z*land_chunk->height);
+			int buffer_x = buffer_index % land_chunk->heightmap_width;
+			int buffer_z = buffer_index / land_chunk->heightmap_width;
+			HeightBounds bounds = { UINT16_MAX, 0 };
+			get_height_pyramid_bounds(&land_chunk->height_pyramid,
+						  land_chunk->heightmap_buffer,
+						  buffer_x,
+						  buffer_z,
+						  buffer_x + land_chunk->width - 1,
+						  buffer_z + land_chunk->height - 1,
+						  &bounds);
+			float lowest = unpack_terrain_height((TerrainHeight){ bounds.min, 0 });
+			g_terrain_water_mask[z*dimension + x] = (lowest < TERRAIN_WATER_MAX_LAND_HEIGHT);
+			if (g_terrain_water_mask[z*dimension + x] && !had_water[z*dimension + x])
+			{
+				add_new_terrain_water_block(index);
+			}
+		}
+	}
+	BG_FREE(had_water);
+}
+
+int take_new_terrain_water_blocks(uint64_t **dest)
+{
+	int num_blocks = g_num_new_terrain_water_blocks;
+	*dest = g_new_terrain_water_blocks;
+	g_new_terrain_water_blocks = NULL;
+	g_num_new_terrain_water_blocks = 0;
+	g_max_new_terrain_water_blocks = 0;
+	return num_blocks;
+}
+
+int terrain_block_has_water(uint64_t terrain_index)
+{
+	int half_dimension = g_terrain_water_mask_dimension/2;
+	int dx = (int)(terrain_index % MAX_TERRAIN_BLOCKS) - (int)(g_terrain_water_mask_center % MAX_TERRAIN_BLOCKS);
+	int dz = (int)(terrain_index / MAX_TERRAIN_BLOCKS) - (int)(g_terrain_water_mask_center / MAX_TERRAIN_BLOCKS);
+	if ((g_terrain_water_mask == NULL) || (abs(dx) > half_dimension) || (abs(dz) > half_dimension))
+	{
+		EnvironmentCondition cond = get_environment_condition(terrain_index);
+		return (cond.precipitation >= 0.2);
+	}
+	return g_terrain_water_mask[(dz + half_dimension)*g_terrain_water_mask_dimension + (dx + half_dimension)];
+}
+
+void generate_terrain_chunk_heightmap(TerrainChunk *chunk, uint64_t center_index)
+{
+	int num_blocks = chunk->dimension*chunk->dimension;
+	ivec2 *blocks = BG_MALLOC(ivec2, num_blocks);
+	for (int i = 0; i < num_blocks; ++i)
+	{
+		blocks[i][0] = i % chunk->dimension;
+		blocks[i][1] = i / chunk->dimension;
+	}
+	chunk->center_index = center_index;
+	chunk->origin_x = 0;
+	chunk->origin_z = 0;
+	chunk->heightmap_generated = 1;
+	generate_terrain_chunk_blocks(chunk, blocks, num_blocks);
+	BG_FREE(blocks);
+}
+
+int scroll_terrain_chunk_heightmap(TerrainChunk *chunk, uint64_t center_index, ivec2 *new_blocks)
+{
+	int dimension = chunk->dimension;
+	int dx = (int)(center_index % MAX_TERRAIN_BLOCKS) - (int)(chunk->center_index % MAX_TERRAIN_BLOCKS);
+	int dz = (int)(center_index / MAX_TERRAIN_BLOCKS) - (int)(chunk->center_index / MAX_TERRAIN_BLOCKS);
+
+	if (!chunk->heightmap_generated || (abs(dx) >= dimension) || (abs(dz) >= dimension))
+	{
+		generate_terrain_chunk_heightmap(chunk, center_index);
+		for (int i = 0; i < dimension*dimension; ++i)
+		{
+			new_blocks[i][0] = i % dimension;
+			new_blocks[i][1] = i / dimension;
+		}
+		return dimension*dimension;
+	}
+
+	/* The blocks that are still in the chunk stay where they are in the buffer, the origin just moves.
+	 * Whatever falls off one side gets overwritten by what comes in on the other. */
+	chunk->center_index = center_index;
+	chunk->origin_x = (((chunk->origin_x + dx) % dimension) + dimension) % dimension;
+	chunk->origin_z = (((chunk->origin_z + dz) % dimension) + dimension) % dimension;
+
+	int num_new_blocks = 0;
+	for (int z = 0; z < dimension; ++z)
+	{
+		for (int x = 0; x < dimension; ++x)
+		{
+			int old_x = x + dx;
+			int old_z = z + dz;
+			if ((old_x < 0) || (old_x >= dimension) || (old_z < 0) || (old_z >= dimension))
+			{
+				new_blocks[num_new_blocks][0] = x;
+				new_blocks[num_new_blocks][1] = z;
+				num_new_blocks++;
+			}
+		}
+	}
+	generate_terrain_chunk_blocks(chunk, new_blocks, num_new_blocks);
+	return num_new_blocks;
+}
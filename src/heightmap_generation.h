@@ -0,0 +1,100 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __HEIGHTMAP_GENERATION_H__
+#define __HEIGHTMAP_GENERATION_H__
+#include "environment.h"
+#include "terrain.h"
+
+/* The width and height of one terrain block's heightmap in texels. This matches TerrainChunk.width and .height
+ * and the dispatch size of the heightmap compute shaders. */
+#define HEIGHTMAP_BLOCK_WIDTH 64
+
+/* These are CPU ports of render_progs/land_heightmap_gen_shader.comp and render_progs/water_heightmap_gen_shader.comp.
+ * They don't need a GL context, so they can be used for collision and by the server.
+ *
+ * Generates count TerrainHeights along one heightmap row. x and z are in global texel coordinates (a block's first texel
+ * is at terrain_index%MAX_TERRAIN_BLOCKS * HEIGHTMAP_BLOCK_WIDTH), and step is the distance between samples in texels.
+ * condition is only used by TERRAIN_CHUNK_LAND, for snow. */
+void generate_terrain_height_row(int type,
+				 float x,
+				 float z,
+				 float step,
+				 int count,
+				 EnvironmentCondition condition,
+				 TerrainHeight *dest);
+
+/* Generates the HEIGHTMAP_BLOCK_WIDTH*HEIGHTMAP_BLOCK_WIDTH TerrainHeights of the block at terrain_index.
+ * dest is the block's first texel and stride is the width of the whole destination image in texels. */
+void generate_terrain_block(int type, uint64_t terrain_index, EnvironmentCondition condition, TerrainHeight *dest, int stride);
+
+/* Same as generate_terrain_block, but goes through the on-disk tile cache (see tile_cache.h) when USE_TILE_CACHE is set */
+void load_or_generate_terrain_block(int type, uint64_t terrain_index, EnvironmentCondition condition, TerrainHeight *dest, int stride);
+
+/* Generates the blocks at the given (x, z) block coordinates of the chunk into chunk->heightmap_buffer, where (0, 0) is
+ * the chunk's top left block. The blocks are split up between worker threads. */
+void generate_terrain_chunk_blocks(TerrainChunk *chunk, ivec2 *blocks, int num_blocks);
+
+/* Regenerates all of chunk->heightmap_buffer for a chunk centered on center_index, and resets the ring buffer's origin. */
+void generate_terrain_chunk_heightmap(TerrainChunk *chunk, uint64_t center_index);
+
+/* The normal at texel (x, z) of the chunk (counted from its top left corner), from the slope between the texels step
+ * away on either side. Texels past the edge of the chunk are clamped to it. */
+void get_terrain_texel_normal(TerrainChunk *chunk, int x, int z, int step, vec3 dest);
+
+/* Works out chunk->normal_buffer for the given blocks. generate_terrain_chunk_blocks already does this for every
+ * block whose normals could have changed, when the chunk has a normal_buffer. */
+void generate_terrain_chunk_normals(TerrainChunk *chunk, ivec2 *blocks, int num_blocks);
+
+/* Works out chunk->normal_buffer for a rectangle of texels, counted from the chunk's top left corner */
+void generate_terrain_rect_normals(TerrainChunk *chunk, int first_x, int first_z, int width, int height);
+
+/* Writes the blocks whose normals change when the given blocks are generated to dest (which needs room for
+ * dimension*dimension), and returns how many there are. */
+int get_terrain_normal_blocks(TerrainChunk *chunk, ivec2 *blocks, int num_blocks, ivec2 *dest);
+
+/* Moves the chunk's center to center_index. Blocks that were already in the chunk are kept, and only the ones that
+ * weren't are generated. Their block coordinates are written to new_blocks (which needs room for dimension*dimension)
+ * and the number of them is returned. Moves of a whole chunk or more just regenerate everything. */
+int scroll_terrain_chunk_heightmap(TerrainChunk *chunk, uint64_t center_index, ivec2 *new_blocks);
+
+/* Water can only be seen where the land is less than TERRAIN_WATER_MAX_LAND_HEIGHT above sea level */
+#define TERRAIN_WATER_MAX_LAND_HEIGHT (SEA_LEVEL + 20.0f)
+
+/* Works out which blocks of the land chunk can have any water in them: ones that aren't deserts, and where the lowest
+ * point of the land is below TERRAIN_WATER_MAX_LAND_HEIGHT. This is called whenever the land chunk's heightmap changes. */
+void update_terrain_water_mask(TerrainChunk *land_chunk);
+
+/* Hands over the blocks that update_terrain_water_mask has found can have water since the last call, but that
+ * terrain_block_has_water said were dry before that. dest is freed by the caller. Returns how many there are. */
+int take_new_terrain_water_blocks(uint64_t **dest);
+
+/* Whether the block at terrain_index can have any water in it. Blocks outside of the last land chunk passed to
+ * update_terrain_water_mask are only checked for being deserts. */
+int terrain_block_has_water(uint64_t terrain_index);
+
+/* The scalar version of generate_terrain_height_row. The SIMD version should always give exactly the same results,
+ * this is kept around to check that. */
+void generate_terrain_height_row_reference(int type,
+					   float x,
+					   float z,
+					   float step,
+					   int count,
+					   EnvironmentCondition condition,
+					   TerrainHeight *dest);
+#endif
@@ -0,0 +1,230 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include "terrain_collisions.h"
+#include "horizon_culling.h"
+#include "utils.h"
+
+/* How a rectangle of the ground looks from the camera, ignoring height */
+typedef struct HorizonView
+{
+	float		min_distance;
+	float		max_distance;
+	/* In buckets, so the rectangle covers from bucket floor(min_bucket) to floor(max_bucket). These can be outside of
+	 * 0 to HORIZON_CULLING_BUCKETS, and wrap around. */
+	float		min_bucket;
+	float		max_bucket;
+	/* Set when the camera is over the rectangle, and none of the rest of this is filled in */
+	int		contains_camera;
+	/* Only used for occluders. The lowest slope the ground in the rectangle could be at from the camera. */
+	float		min_slope;
+	int		draw_block;
+} HorizonView;
+
+static void get_horizon_view(vec3 camera_position, float min_x, float min_z, float max_x, float max_z, HorizonView *dest)
+{
+	float nearest_x = glm_clamp(camera_position[0], min_x, max_x);
+	float nearest_z = glm_clamp(camera_position[2], min_z, max_z);
+	dest->min_distance = hypotf(nearest_x - camera_position[0], nearest_z - camera_position[2]);
+	dest->contains_camera = (dest->min_distance <= 0.0f);
+	if (dest->contains_camera)
+	{
+		return;
+	}
+
+	/* The camera isn't over the rectangle, so the rectangle takes up less than half of the way around it and the
+	 * corners' azimuths can all be measured from the center's without wrapping. */
+	float center_azimuth = atan2f(((min_z + max_z)/2.0f) - camera_position[2], ((min_x + max_x)/2.0f) - camera_position[0]);
+	const float corners[4][2] = { { min_x, min_z }, { max_x, min_z }, { min_x, max_z }, { max_x, max_z } };
+	float min_azimuth = 0.0f;
+	float max_azimuth = 0.0f;
+	dest->max_distance = 0.0f;
+	for (int i = 0; i < 4; ++i)
+	{
+		float x = corners[i][0] - camera_position[0];
+		float z = corners[i][1] - camera_position[2];
+		dest->max_distance = glm_max(dest->max_distance, hypotf(x, z));
+		float azimuth = atan2f(z, x) - center_azimuth;
+		if (azimuth > GLM_PI)
+		{
+			azimuth -= 2.0f*GLM_PI;
+		}
+		else if (azimuth < -GLM_PI)
+		{
+			azimuth += 2.0f*GLM_PI;
+		}
+		min_azimuth = glm_min(min_azimuth, azimuth);
+		max_azimuth = glm_max(max_azimuth, azimuth);
+	}
+	float buckets_per_radian = HORIZON_CULLING_BUCKETS/(2.0f*GLM_PI);
+	dest->min_bucket = (center_azimuth + min_azimuth + GLM_PI)*buckets_per_radian;
+	dest->max_bucket = (center_azimuth + max_azimuth + GLM_PI)*buckets_per_radian;
+}
+
+static int wrap_bucket(int bucket)
+{
+	bucket %= HORIZON_CULLING_BUCKETS;
+	if (bucket < 0)
+	{
+		bucket += HORIZON_CULLING_BUCKETS;
+	}
+	return bucket;
+}
+
+static int compare_occluders(const void *a, const void *b)
+{
+	float distance_a = ((const HorizonView *)a)->max_distance;
+	float distance_b = ((const HorizonView *)b)->max_distance;
+	return (distance_a > distance_b) - (distance_a < distance_b);
+}
+
+static int compare_blocks(const void *a, const void *b)
+{
+	float distance_a = ((const HorizonView *)a)->min_distance;
+	float distance_b = ((const HorizonView *)b)->min_distance;
+	return (distance_a > distance_b) - (distance_a < distance_b);
+}
+
+/* The horizon can only be raised over the buckets the occluder covers all the way across, since there could be a
+ * gap beside it in the rest. */
+static void add_horizon_occluder(float *horizon, HorizonView *occluder)
+{
+	for (int i = (int)ceilf(occluder->min_bucket); i < (int)floorf(occluder->max_bucket); ++i)
+	{
+		int bucket = wrap_bucket(i);
+		horizon[bucket] = glm_max(horizon[bucket], occluder->min_slope);
+	}
+}
+
+static float get_lowest_horizon(float *horizon, HorizonView *view)
+{
+	float lowest = FLT_MAX;
+	for (int i = (int)floorf(view->min_bucket); i <= (int)floorf(view->max_bucket); ++i)
+	{
+		lowest = glm_min(lowest, horizon[wrap_bucket(i)]);
+	}
+	return lowest;
+}
+
+/* The slopes from the camera are height over distance, so the farther away a point above the camera is the lower it
+ * looks, and the opposite for a point below it. */
+static float get_lowest_slope(float height, HorizonView *view, vec3 camera_position)
+{
+	float rise = height - camera_position[1];
+	return rise / ((rise > 0.0f) ? view->max_distance : view->min_distance);
+}
+
+static float get_highest_slope(float height, HorizonView *view, vec3 camera_position)
+{
+	float rise = height - camera_position[1];
+	return rise / ((rise > 0.0f) ? view->min_distance : view->max_distance);
+}
+
+int cull_terrain_blocks_behind_horizon(TerrainChunk *chunk, int num_blocks, vec3 camera_position)
+{
+	if ((chunk->type != TERRAIN_CHUNK_LAND) || (num_blocks <= 0))
+	{
+		return num_blocks;
+	}
+
+	float block_width = TERRAIN_XZ_SCALE*4.0f;
+	float cell_width = block_width/HORIZON_CULLING_OCCLUDER_CELLS;
+	int half_dimension = chunk->dimension/2;
+	int cells_per_side = chunk->dimension*HORIZON_CULLING_OCCLUDER_CELLS;
+	HorizonView *occluders = BG_MALLOC(HorizonView, cells_per_side*cells_per_side);
+	int num_occluders = 0;
+	for (int z = 0; z < cells_per_side; ++z)
+	{
+		for (int x = 0; x < cells_per_side; ++x)
+		{
+			vec2 min_xz = { ((x*cell_width) - (half_dimension*block_width)), ((z*cell_width) - (half_dimension*block_width)) };
+			vec2 max_xz = { min_xz[0] + cell_width, min_xz[1] + cell_width };
+			HorizonView *occluder = &occluders[num_occluders];
+			get_horizon_view(camera_position, min_xz[0], min_xz[1], max_xz[0], max_xz[1], occluder);
+			vec2 height_bounds;
+			if (occluder->contains_camera || !get_terrain_height_bounds(chunk, min_xz, max_xz, height_bounds))
+			{
+				continue;
+			}
+			occluder->min_slope = get_lowest_slope(height_bounds[0], occluder, camera_position);
+			num_occluders++;
+		}
+	}
+	qsort(occluders, num_occluders, sizeof(HorizonView), compare_occluders);
+
+	HorizonView *blocks = BG_MALLOC(HorizonView, num_blocks);
+	float *max_slopes = BG_MALLOC(float, num_blocks);
+	int *hidden = BG_MALLOC(int, num_blocks);
+	for (int i = 0; i < num_blocks; ++i)
+	{
+		vec2 min_xz = { chunk->draw_blocks[i].x_offset*block_width, chunk->draw_blocks[i].z_offset*block_width };
+		vec2 max_xz = { min_xz[0] + block_width, min_xz[1] + block_width };
+		get_horizon_view(camera_position, min_xz[0], min_xz[1], max_xz[0], max_xz[1], &blocks[i]);
+		blocks[i].draw_block = i;
+		vec2 height_bounds;
+		if (!get_terrain_height_bounds(chunk, min_xz, max_xz, height_bounds))
+		{
+			height_bounds[1] = TERRAIN_MAX_HEIGHT;
+		}
+		max_slopes[i] = blocks[i].contains_camera ? FLT_MAX : get_highest_slope(height_bounds[1], &blocks[i], camera_position);
+		hidden[i] = 0;
+	}
+	qsort(blocks, num_blocks, sizeof(HorizonView), compare_blocks);
+
+	/* Only ground that's all nearer than a block can hide it, so the occluders go into the horizon as the sweep
+	 * passes them. */
+	float horizon[HORIZON_CULLING_BUCKETS];
+	for (int i = 0; i < HORIZON_CULLING_BUCKETS; ++i)
+	{
+		horizon[i] = -FLT_MAX;
+	}
+	int next_occluder = 0;
+	for (int i = 0; i < num_blocks; ++i)
+	{
+		HorizonView *block = &blocks[i];
+		if (block->contains_camera)
+		{
+			continue;
+		}
+		while ((next_occluder < num_occluders) && (occluders[next_occluder].max_distance <= block->min_distance))
+		{
+			add_horizon_occluder(horizon, &occluders[next_occluder++]);
+		}
+		hidden[block->draw_block] = (max_slopes[block->draw_block] < get_lowest_horizon(horizon, block));
+	}
+
+	/* The blocks that are left stay in the same order */
+	int num_visible_blocks = 0;
+	for (int i = 0; i < num_blocks; ++i)
+	{
+		if (!hidden[i])
+		{
+			chunk->draw_blocks[num_visible_blocks++] = chunk->draw_blocks[i];
+		}
+	}
+
+	BG_FREE(occluders);
+	BG_FREE(blocks);
+	BG_FREE(max_slopes);
+	BG_FREE(hidden);
+	return num_visible_blocks;
+}
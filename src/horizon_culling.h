@@ -0,0 +1,34 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __HORIZON_CULLING_H__
+#define __HORIZON_CULLING_H__
+#include <cglm/cglm.h>
+#include "terrain.h"
+
+/* How many slices of azimuth around the camera the horizon is kept for */
+#define HORIZON_CULLING_BUCKETS 512
+/* Each block is split into this many cells along each side to find the ridges that hide the blocks behind them */
+#define HORIZON_CULLING_OCCLUDER_CELLS 4
+
+/* Removes the blocks from the first num_blocks of chunk->draw_blocks that are completely hidden behind nearer terrain
+ * from camera_position, and returns how many are left. The blocks are swept outward from the camera, keeping the
+ * lowest the horizon could be in each slice of azimuth, and a block is dropped if its highest point is below the
+ * horizon everywhere the block could be seen. Only land chunks have heights to do this with. */
+int cull_terrain_blocks_behind_horizon(TerrainChunk *chunk, int num_blocks, vec3 camera_position);
+#endif
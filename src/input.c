@@ -36,6 +36,7 @@ CommandConfig default_command_config(void)
 	config.backward = SDLK_s;
 	config.increase_view_distance = SDLK_RIGHTBRACKET;
 	config.decrease_view_distance = SDLK_LEFTBRACKET;
+	config.dig = SDLK_g;
 	config.x_inverted = 1;
 	config.y_inverted = 1;
 	return config;
@@ -120,6 +121,10 @@ int B_update_command_state_ui(CommandState *command_state, CommandConfig config)
 				{
 					command_state->pause = !(command_state->pause);
 				}
+				else if (key == config.dig)
+				{
+					command_state->dig = 1;
+				}
 
 				//DEBUG
 				else if (key == SDLK_p)
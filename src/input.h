@@ -56,6 +56,7 @@ typedef struct CommandState
 	int		decrease_view_distance;
 	int		random_teleport;
 	int		pause;
+	int		dig;
 } CommandState;
 
 
@@ -72,6 +73,7 @@ typedef struct CommandConfig
 	int		pause;
 	int		increase_view_distance;
 	int		decrease_view_distance;
+	int		dig;
 } CommandConfig;
 
 CommandConfig default_command_config(void);
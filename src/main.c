@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 //#include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -33,12 +34,20 @@
 #include "input.h"
 #include "time.h"
 #include "terrain.h"
+#include "terrain_streaming.h"
+#include "tile_cache.h"
+#include "climate_raster.h"
 #include "asset_loading.h"
 #include "terrain_collisions.h"
+#include "terrain_raycast.h"
+#include "noise.h"
+#include "terrain_deformation.h"
+#include "clipmap.h"
 #include "plant_rendering.h"
 #include "grass.h"
 #include "trees.h"
 #include "plant.h"
+#include "plant_noise.h"
 #include "debug.h"
 #include "utils.h"
 
@@ -85,8 +94,14 @@ void game_loop(void)
 	Renderer renderer = create_default_renderer(window);
 
 	// Environment init
+	if (USE_TILE_CACHE)
+	{
+		init_tile_cache(TILE_CACHE_DIRECTORY);
+	}
+	load_climate_raster(CLIMATE_RASTER_PATH);
 	TerrainChunk terrain_chunk = create_terrain_chunk(renderer.g_buffer, TERRAIN_CHUNK_LAND, PLAYER_TERRAIN_INDEX_START);
 
+	B_bake_plant_noise(PLANT_NOISE_RESOLUTION);
 	Plant grass_patch = create_grass_patch(renderer.g_buffer, terrain_chunk.heightmap);
 	vec2 grass_patch_offsets[9];
 	get_grass_patch_offsets(PLAYER_TERRAIN_INDEX_START, grass_patch_offsets);
@@ -96,6 +111,12 @@ void game_loop(void)
 //	Plant tree_trunk = create_tree_trunk(renderer.g_buffer, terrain_chunk.heightmap);
 
 	TerrainChunk water_chunk = create_terrain_chunk(renderer.g_buffer, TERRAIN_CHUNK_WATER, PLAYER_TERRAIN_INDEX_START);
+	Clipmap clipmap = {0};
+	if (USE_CLIPMAP_TERRAIN)
+	{
+		clipmap = create_clipmap(get_terrain_chunk_dimension(), PLAYER_TERRAIN_INDEX_START);
+		set_view_distance(get_clipmap_view_distance(&clipmap));
+	}
 
 	ParticleMesh rain_mesh = create_raindrop_mesh(renderer.g_buffer);
 	ParticleMesh snow_mesh = create_snowflake_mesh(renderer.g_buffer);
@@ -114,20 +135,38 @@ void game_loop(void)
 	unsigned int num_actors = player_id+1;
 
 	// Compile shaders
-	B_Shader terrain_shader = B_compile_terrain_shader("render_progs/terrain_shader.vert",
-							   "render_progs/terrain_shader.frag",
-							   "render_progs/terrain_shader.geo",
-							   "render_progs/terrain_shader.ctess",
-							   "render_progs/terrain_shader.etess");
-	B_Shader water_shader = B_compile_terrain_shader("render_progs/terrain_shader.vert",
-							 "render_progs/water_shader.frag",
-							 "render_progs/water_shader.geo",
-							 "render_progs/terrain_shader.ctess",
-							 "render_progs/water_shader.etess");
+	B_Shader terrain_shader = 0;
+	B_Shader water_shader = 0;
+	if (USE_MESHED_TERRAIN)
+	{
+		terrain_shader = B_compile_simple_shader("render_progs/terrain_mesh_shader.vert",
+							 "render_progs/terrain_shader.frag");
+		water_shader = B_compile_simple_shader("render_progs/water_mesh_shader.vert",
+						       "render_progs/water_shader.frag");
+	}
+	else
+	{
+		terrain_shader = B_compile_terrain_shader("render_progs/terrain_shader.vert",
+							  "render_progs/terrain_shader.frag",
+							  NULL,
+							  "render_progs/terrain_shader.ctess",
+							  "render_progs/terrain_shader.etess");
+		water_shader = B_compile_terrain_shader("render_progs/terrain_shader.vert",
+							"render_progs/water_shader.frag",
+							NULL,
+							"render_progs/terrain_shader.ctess",
+							"render_progs/water_shader.etess");
+	}
 	B_Shader actor_shader = B_compile_simple_shader("render_progs/actor_shader.vert",
 					                "render_progs/actor_shader.frag");
 	B_Shader lighting_shader = B_compile_simple_shader("render_progs/lighting_shader.vert",
 					          	   "render_progs/lighting_shader.frag");
+	B_Shader clipmap_shader = 0;
+	if (USE_CLIPMAP_TERRAIN)
+	{
+		clipmap_shader = B_compile_simple_shader("render_progs/clipmap_shader.vert",
+							 "render_progs/clipmap_shader.frag");
+	}
 	float delta_t = 15.0;
 	float frame_time = 0;
 	int running = 1;
@@ -174,14 +213,21 @@ void game_loop(void)
 			int half_dimension = get_terrain_chunk_dimension()/2;
 			set_view_distance((TERRAIN_XZ_SCALE*4)*half_dimension);
 
-			free_renderer(renderer);
-			renderer = create_default_renderer(window);
-
-			free_terrain_chunk(&terrain_chunk);
-			terrain_chunk = create_terrain_chunk(renderer.g_buffer, TERRAIN_CHUNK_LAND, all_actors[player_id].actor_state.current_terrain_index);
+			/* The land chunk goes first, since the water chunk needs its water mask */
+			B_resize_terrain_chunk(&terrain_chunk, get_terrain_chunk_dimension());
+			B_resize_terrain_chunk(&water_chunk, get_terrain_chunk_dimension());
 
-			free_terrain_chunk(&water_chunk);
-			water_chunk = create_terrain_chunk(renderer.g_buffer, TERRAIN_CHUNK_WATER, all_actors[player_id].actor_state.current_terrain_index);
+			if (USE_CLIPMAP_TERRAIN)
+			{
+				free_clipmap(&clipmap);
+				clipmap = create_clipmap(get_terrain_chunk_dimension(), all_actors[player_id].actor_state.current_terrain_index);
+				set_view_distance(get_clipmap_view_distance(&clipmap));
+			}
+			update_camera_projection(&renderer.camera);
+			if (USE_ALT_CAMERA)
+			{
+				update_camera_projection(&renderer.alt_camera);
+			}
 
 			get_grass_patch_offsets(all_actors[player_id].actor_state.current_terrain_index, grass_patch_offsets);
 		}
@@ -195,14 +241,21 @@ void game_loop(void)
 				int half_dimension = get_terrain_chunk_dimension()/2;
 				set_view_distance((TERRAIN_XZ_SCALE*4) * half_dimension);
 
-				free_renderer(renderer);
-				renderer = create_default_renderer(window);
-
-				free_terrain_chunk(&terrain_chunk);
-				terrain_chunk = create_terrain_chunk(renderer.g_buffer, TERRAIN_CHUNK_LAND, all_actors[player_id].actor_state.current_terrain_index);
+				/* The land chunk goes first, since the water chunk needs its water mask */
+				B_resize_terrain_chunk(&terrain_chunk, get_terrain_chunk_dimension());
+				B_resize_terrain_chunk(&water_chunk, get_terrain_chunk_dimension());
 
-				free_terrain_chunk(&water_chunk);
-				water_chunk = create_terrain_chunk(renderer.g_buffer, TERRAIN_CHUNK_WATER, all_actors[player_id].actor_state.current_terrain_index);
+				if (USE_CLIPMAP_TERRAIN)
+				{
+					free_clipmap(&clipmap);
+					clipmap = create_clipmap(get_terrain_chunk_dimension(), all_actors[player_id].actor_state.current_terrain_index);
+					set_view_distance(get_clipmap_view_distance(&clipmap));
+				}
+				update_camera_projection(&renderer.camera);
+				if (USE_ALT_CAMERA)
+				{
+					update_camera_projection(&renderer.alt_camera);
+				}
 
 				get_grass_patch_offsets(all_actors[player_id].actor_state.current_terrain_index, grass_patch_offsets);
 			}
@@ -215,6 +268,20 @@ void game_loop(void)
 
 
 		// Simulation updates
+		B_poll_terrain_chunk_readback(&terrain_chunk);
+		B_poll_terrain_chunk_readback(&water_chunk);
+		if (all_actors[player_id].actor_state.command_state.dig)
+		{
+			all_actors[player_id].actor_state.command_state.dig = 0;
+			TerrainRayHit hit;
+			if (raycast_terrain(&terrain_chunk, renderer.camera.position, renderer.camera.front, PLAYER_DIG_REACH, &hit))
+			{
+				deform_terrain(&terrain_chunk, hit.position, PLAYER_DIG_RADIUS, PLAYER_DIG_DEPTH);
+			}
+		}
+		B_upload_terrain_chunk_edits(&terrain_chunk);
+		B_generate_new_terrain_water_blocks(&water_chunk);
+		update_current_rain_level();
 		EnvironmentCondition environment_condition = get_environment_condition(all_actors[player_id].actor_state.current_terrain_index);
 
 		frame_time += B_get_frame_time();
@@ -249,14 +316,31 @@ void game_loop(void)
 				get_grass_patch_offsets(all_actors[i].actor_state.current_terrain_index, grass_patch_offsets);
 				B_update_terrain_chunk(&terrain_chunk, all_actors[i].actor_state.current_terrain_index);
 				B_update_terrain_chunk(&water_chunk, all_actors[i].actor_state.current_terrain_index);
+				if (USE_CLIPMAP_TERRAIN)
+				{
+					B_update_clipmap(&clipmap, all_actors[i].actor_state.current_terrain_index);
+				}
 			}
-			update_actor_gravity(&all_actors[i].actor_state, all_actors[i].model->height, &terrain_chunk, delta_t);
+		}
+
+		vec3 actor_positions[MAX_PLAYERS];
+		float terrain_heights[MAX_PLAYERS];
+		for (unsigned int i = 0; i < num_actors; ++i)
+		{
+			glm_vec3_copy(all_actors[i].actor_state.position, actor_positions[i]);
+		}
+		get_terrain_heights(actor_positions, terrain_heights, num_actors, &terrain_chunk);
+		for (unsigned int i = 0; i < num_actors; ++i)
+		{
+			update_actor_gravity(&all_actors[i].actor_state, all_actors[i].model->height, terrain_heights[i], delta_t);
 			if (should_print_debug())
 			{
 				print_vec3(all_actors[i].actor_state.position);
 			}
 		}
 
+		update_terrain_streamer(&all_actors[player_id].actor_state, get_terrain_chunk_dimension());
+
 		for (unsigned int i = 0; i < num_actors; ++i)
 		{
 			update_actor_model(all_actors[i].model, all_actors[i].actor_state);
@@ -296,6 +380,11 @@ void game_loop(void)
 		{
 			glm_mat4_mul(renderer.camera.projection_space, renderer.camera.view_space, projection_view);
 		}
+		update_terrain_tessellation(&terrain_chunk, 
+					    &water_chunk, 
+					    renderer.camera.position, 
+					    projection_view, 
+					    all_actors[player_id].actor_state.current_terrain_index);
 
 		int window_width = 0;
 		int window_height = 0;
@@ -331,27 +420,30 @@ void game_loop(void)
 					   terrain_chunk.heightmap,
 					   water_shader, 
 					   projection_view, 
-					   all_actors[player_id].actor_state.current_terrain_index,
-					   all_actors[player_id].actor_state.front);
+					   all_actors[player_id].actor_state.current_terrain_index);
 		B_stopwatch("Draw Water");
 		glCullFace(GL_BACK);
 
 		if (DRAW_DEBUG)
 		{
 			vec3 grass_patch_centers[9];
+			float grass_patch_heights[9];
 			for (int i = 0; i < 9; ++i)
 			{
 				grass_patch_centers[i][0] = grass_patch_offsets[i][0];
 				grass_patch_centers[i][2] = grass_patch_offsets[i][1];
 				grass_patch_centers[i][1] = 0.0f;
-				grass_patch_centers[i][1] = get_terrain_height(grass_patch_centers[i], &terrain_chunk);
+			}
+			get_terrain_heights(grass_patch_centers, grass_patch_heights, 9, &terrain_chunk);
+			for (int i = 0; i < 9; ++i)
+			{
+				grass_patch_centers[i][1] = grass_patch_heights[i];
 			}
 
 			draw_land_terrain_chunk_debug(&terrain_chunk, 
 						terrain_shader, 
 						projection_view, 
 						all_actors[player_id].actor_state.current_terrain_index,
-						all_actors[player_id].actor_state.front,
 						grass_patch_centers,
 						TERRAIN_XZ_SCALE*2);
 
@@ -361,8 +453,12 @@ void game_loop(void)
 			draw_land_terrain_chunk(&terrain_chunk, 
 						terrain_shader, 
 						projection_view, 
-						all_actors[player_id].actor_state.current_terrain_index,
-						all_actors[player_id].actor_state.front);
+						all_actors[player_id].actor_state.current_terrain_index);
+		}
+
+		if (USE_CLIPMAP_TERRAIN)
+		{
+			B_draw_clipmap(&clipmap, clipmap_shader, projection_view);
 		}
 
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -473,6 +569,21 @@ void game_loop(void)
 
 		if (BENCHMARK)
 		{ 
+			fprintf(stdout, "%i water blocks, %i land blocks culled\n", water_chunk.num_culled_blocks, terrain_chunk.num_culled_blocks);
+			/* The time saved is a guess, from how long the blocks that were drawn took on average */
+			int num_drawn_blocks = (terrain_chunk.dimension*terrain_chunk.dimension) - 
+					       terrain_chunk.num_culled_blocks - terrain_chunk.num_occluded_blocks;
+			float milliseconds_saved = 0.0f;
+			if (num_drawn_blocks > 0)
+			{
+				milliseconds_saved = (terrain_chunk.draw_milliseconds/num_drawn_blocks)*terrain_chunk.num_occluded_blocks;
+			}
+			fprintf(stdout, "%i land blocks behind the horizon, found in %.3f ms, about %.3f ms of drawing saved\n", 
+				terrain_chunk.num_occluded_blocks, terrain_chunk.horizon_culling_milliseconds, milliseconds_saved);
+			uint64_t climate_hits = 0;
+			uint64_t climate_misses = 0;
+			get_climate_cache_stats(&climate_hits, &climate_misses);
+			fprintf(stdout, "Climate cache: %lu hits, %lu misses\n", (unsigned long)climate_hits, (unsigned long)climate_misses);
 			fprintf(stderr, "=====================================\n\n");
 		}
 		frames++;
@@ -484,9 +595,19 @@ void game_loop(void)
 		free_actor(all_actors[i]);
 	}
 
+	free_terrain_streamer();
+	free_tile_cache();
+	free_climate_raster();
 	free_terrain_chunk(&terrain_chunk);
 	free_terrain_chunk(&water_chunk);
+	free_terrain_edits();
+	if (USE_CLIPMAP_TERRAIN)
+	{
+		free_clipmap(&clipmap);
+		B_free_shader(clipmap_shader);
+	}
 	free_plant(grass_patch);
+	B_free_plant_noise();
 	B_free_window(window);
 	free_renderer(renderer);
 	B_free_shader(terrain_shader);
@@ -496,8 +617,93 @@ void game_loop(void)
 
 /* Just sets up and dives right into the main loop 
  * All functions and types that contain platform-specific elements are prefixed with B */
-int main(void)
+int main(int argc, char **argv)
 {
+	/* --prewarm-tiles x_min z_min x_max z_max generates a rectangle of blocks into the tile cache and exits */
+	if ((argc == 6) && (strcmp(argv[1], "--prewarm-tiles") == 0))
+	{
+		init_tile_cache(TILE_CACHE_DIRECTORY);
+		prewarm_tile_cache(strtoull(argv[2], NULL, 10), 
+				   strtoull(argv[3], NULL, 10), 
+				   strtoull(argv[4], NULL, 10), 
+				   strtoull(argv[5], NULL, 10));
+		free_tile_cache();
+		return 0;
+	}
+	/* --benchmark-raycast [num_rays] times raycasts against a generated chunk and exits */
+	else if ((argc >= 2) && (argc <= 3) && (strcmp(argv[1], "--benchmark-raycast") == 0))
+	{
+		int num_rays = 100000;
+		if (argc == 3)
+		{
+			num_rays = atoi(argv[2]);
+		}
+		if (num_rays <= 0)
+		{
+			fprintf(stderr, "Invalid number of rays: %s\n", argv[2]);
+			return -1;
+		}
+		benchmark_terrain_raycast(num_rays);
+		return 0;
+	}
+	/* --benchmark-heightmap-gen [num_runs] times generating the heightmap on the GPU and exits */
+	else if ((argc >= 2) && (argc <= 3) && (strcmp(argv[1], "--benchmark-heightmap-gen") == 0))
+	{
+		int num_runs = 20;
+		if (argc == 3)
+		{
+			num_runs = atoi(argv[2]);
+		}
+		if (num_runs <= 0)
+		{
+			fprintf(stderr, "Invalid number of runs: %s\n", argv[2]);
+			return -1;
+		}
+		B_init();
+		B_Window window = B_create_window();
+		B_benchmark_terrain_chunk_generation(num_runs);
+		B_free_window(window);
+		B_quit();
+		return 0;
+	}
+	/* --check-terrain-edits checks that terrain edits come out the same on the CPU and the GPU and exits */
+	else if ((argc == 2) && (strcmp(argv[1], "--check-terrain-edits") == 0))
+	{
+		B_init();
+		B_Window window = B_create_window();
+		int num_mismatches = B_check_terrain_edits();
+		B_free_window(window);
+		B_quit();
+		return (num_mismatches == 0) ? 0 : -1;
+	}
+	/* --benchmark-noise [num_samples] times the batch fbm2d against the scalar one, checks the noise derivatives and exits */
+	else if ((argc >= 2) && (argc <= 3) && (strcmp(argv[1], "--benchmark-noise") == 0))
+	{
+		int num_samples = 1000000;
+		if (argc == 3)
+		{
+			num_samples = atoi(argv[2]);
+		}
+		if (num_samples <= 0)
+		{
+			fprintf(stderr, "Invalid number of samples: %s\n", argv[2]);
+			return -1;
+		}
+		int num_mismatches = benchmark_noise(num_samples);
+		return (num_mismatches == 0) ? 0 : -1;
+	}
+	/* --bake-climate [path] writes the climate raster and exits */
+	else if ((argc >= 2) && (argc <= 3) && (strcmp(argv[1], "--bake-climate") == 0))
+	{
+		bake_climate_raster((argc == 3) ? argv[2] : CLIMATE_RASTER_PATH);
+		return 0;
+	}
+	else if (argc > 1)
+	{
+		fprintf(stderr, "Usage: %s [--prewarm-tiles x_min z_min x_max z_max] [--benchmark-raycast [num_rays]] [--benchmark-heightmap-gen [num_runs]] [--check-terrain-edits] [--benchmark-noise [num_samples]] [--bake-climate [path]]\n", argv[0]);
+		return -1;
+	}
+
 	B_init();
 	game_loop();
 	B_quit();
@@ -27,6 +27,7 @@
 
 #ifndef __NOISE_H__
 #define __NOISE_H__
+#include <stddef.h>
 /** 1D, 2D, 3D and 4D float Perlin noise
  */
 extern float noise1( float x );
@@ -45,4 +46,17 @@ extern float pnoise4( float x, float y, float z, float w,
 float fbm2d(float x, float y, float lambda, float omega);
 float fbm2d_sky_color(float x, float y, float lambda, float omega);
 
+/* noise2 and fbm2d that also write the partial derivatives along x and y, for the cost of about one evaluation */
+float noise2_deriv(float x, float y, float *dx, float *dy);
+float fbm2d_deriv(float x, float y, float lambda, float omega, float *dx, float *dy);
+
+/* Batch versions: out[i] = noise2(x[i], y[i]), and fbm2d() with a variable number of octaves (fbm2d() uses 6).
+ * They pick AVX2 or SSE2 at runtime and match the scalar functions exactly. */
+void noise2_n(const float *x, const float *y, float *out, size_t n);
+void fbm2d_n(const float *x, const float *y, float *out, size_t n, float lambda, float omega, int octaves);
+void fbm2d_n_reference(const float *x, const float *y, float *out, size_t n, float lambda, float omega, int octaves);
+/* Prints samples per second of fbm2d_n() against the scalar loop for a few octave counts. Returns how many of the
+ * batch results weren't exactly the scalar ones. */
+int benchmark_noise(int num_samples);
+
 #endif
@@ -0,0 +1,62 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glad/glad.h>
+#include "plant_noise.h"
+
+B_Texture g_plant_noise_texture = 0;
+
+void B_bake_plant_noise(int resolution)
+{
+	if ((resolution <= 0) || (resolution % 8))
+	{
+		fprintf(stderr, "B_bake_plant_noise error: Resolution %i isn't a positive multiple of 8\n", resolution);
+		exit(-1);
+	}
+
+	glGenTextures(1, &g_plant_noise_texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, g_plant_noise_texture);
+	/* Full floats, because the canopy rotates its clumps by 10000 over the hash, which needs every bit of it */
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F, resolution, resolution, NUM_PLANT_NOISE_LAYERS, 0, GL_RGBA, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	B_Shader shader = B_compile_compute_shader("render_progs/plant_noise_gen_shader.comp");
+	glUseProgram(shader);
+	glBindImageTexture(0, g_plant_noise_texture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+	glDispatchCompute(resolution/8, resolution/8, 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	B_free_shader(shader);
+}
+
+void B_bind_plant_noise(B_Shader shader)
+{
+	glActiveTexture(GL_TEXTURE0 + PLANT_NOISE_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, g_plant_noise_texture);
+	B_set_uniform_int(shader, "plant_noise", PLANT_NOISE_TEXTURE_UNIT);
+}
+
+void B_free_plant_noise(void)
+{
+	glDeleteTextures(1, &g_plant_noise_texture);
+	g_plant_noise_texture = 0;
+}
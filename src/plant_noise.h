@@ -0,0 +1,49 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PLANT_NOISE_H__
+#define __PLANT_NOISE_H__
+#include "common.h"
+
+/* The plant shaders get all of their per-instance randomness from a texture that's baked once at startup, instead of
+ * working out hashes and rotations for every vertex of every instance every frame. Instance ids wrap around the
+ * texture, so ids past this many per side repeat. */
+#define PLANT_NOISE_RESOLUTION 256
+#define PLANT_NOISE_TEXTURE_UNIT 4
+
+/* The layers of the plant noise texture. Each texel (x, z) is for the instance id pair (x, z), or for the instance
+ * id z*resolution + x. These have to match the layer numbers in the plant shaders. */
+enum PLANT_NOISE_LAYERS
+{
+	/* xyz is the direction a canopy clump is moved in, w the hash it was made from */
+	PLANT_NOISE_INDIVIDUAL_OFFSET,
+	/* Same, for canopy subgroups and the trunks of generated trees (they're rotated a lot less) */
+	PLANT_NOISE_GROUP_OFFSET,
+	/* x is a blade of grass's hash, y and z the sine and cosine it's rotated by */
+	PLANT_NOISE_GRASS,
+	NUM_PLANT_NOISE_LAYERS
+};
+
+extern B_Texture g_plant_noise_texture;
+
+/* Bakes the plant noise texture, resolution texels on a side, with render_progs/plant_noise_gen_shader.comp */
+void B_bake_plant_noise(int resolution);
+/* Binds the plant noise texture to PLANT_NOISE_TEXTURE_UNIT and points shader's plant_noise sampler at it */
+void B_bind_plant_noise(B_Shader shader);
+void B_free_plant_noise(void);
+#endif
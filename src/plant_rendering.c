@@ -24,13 +24,40 @@ void draw_plants(Plant plant,
 	{
 		return;
 	}
+
+	/* Every plant sits on the ground, so the heights under all of them are looked up at once */
+	vec3 *positions = BG_MALLOC(vec3, num_offsets);
+	float *terrain_heights = BG_MALLOC(float, num_offsets);
+	for (int i = 0; i < num_offsets; ++i)
+	{
+		glm_vec3_zero(positions[i]);
+		/* Offsets that bleed into another terrain block aren't drawn. */
+		if ((offsets[i][0] > TERRAIN_XZ_SCALE*4) ||
+		    (offsets[i][1] > TERRAIN_XZ_SCALE*4))
+		{
+			continue;
+		}
+		positions[i][0] = offsets[i][0] + (((i % 3) - 1) * (TERRAIN_XZ_SCALE*4));
+		positions[i][2] = offsets[i][1] + (((i / 3) - 1) * (TERRAIN_XZ_SCALE*4));
+	}
+	get_terrain_heights(positions, terrain_heights, num_offsets, chunk);
+
+	/* The offsets go through the 3x3 blocks around terrain_index, row by row */
+	uint64_t *plant_terrain_indices = BG_MALLOC(uint64_t, num_offsets);
+	EnvironmentCondition *environment_conditions = BG_MALLOC(EnvironmentCondition, num_offsets);
+	for (int i = 0; i < num_offsets; ++i)
+	{
+		plant_terrain_indices[i] = terrain_index + ((i % 3) - 1) + (((i / 3) - 1) * MAX_TERRAIN_BLOCKS);
+	}
+	get_environment_conditions(plant_terrain_indices, environment_conditions, num_offsets);
+
 	int x_counter = -1;
 	int z_counter = -1;
 	for (int i = 0; i < num_offsets; ++i)
 	{
 		int draw = 1;
-		uint64_t plant_terrain_index = terrain_index + x_counter + (z_counter * MAX_TERRAIN_BLOCKS);
-		EnvironmentCondition environment_condition = get_environment_condition(plant_terrain_index);
+		uint64_t plant_terrain_index = plant_terrain_indices[i];
+		EnvironmentCondition environment_condition = environment_conditions[i];
 		if ((environment_condition.temperature > plant.max_temperature) ||
 		    (environment_condition.temperature < plant.min_temperature))
 		{
@@ -71,29 +98,19 @@ void draw_plants(Plant plant,
 
 			int patch_size = get_grass_patch_size(environment_condition, plant_terrain_index);
 			unsigned int canopy_size = get_canopy_size(environment_condition, plant_terrain_index);
-			unsigned int int_x = (plant_terrain_index % MAX_TERRAIN_BLOCKS);
-			unsigned int int_z = (plant_terrain_index / MAX_TERRAIN_BLOCKS);
-			float x = ((float)int_x / (float)MAX_TERRAIN_BLOCKS);
-			float z = ((float)int_z / (float)MAX_TERRAIN_BLOCKS);
-			float scale_factor = (1.0f + fbm2d((float)x*100, (float)z*100, 6, 0.60))/2.0f;
+			/* This used to be its own fbm2d() of the block's position, but it was the same noise as the precipitation */
+			float scale_factor = environment_condition.precipitation;
 			scale_factor *= 10.0f;
 			//float trunk_scale_factor = (1.0f + powf(2.71828, -0.5f*(scale_factor-50.0f)));
 			float trunk_scale_factor = 2.5f*scale_factor;
 
 			if (plant.type == PLANT_TYPE_GRASS)
 			{
-				unsigned int _int_x = (plant_terrain_index % MAX_TERRAIN_BLOCKS);
-				unsigned int _int_z = (plant_terrain_index / MAX_TERRAIN_BLOCKS);
-
-				float _x = ((float)_int_x / (float)MAX_TERRAIN_BLOCKS);
-				float _z = ((float)_int_z / (float)MAX_TERRAIN_BLOCKS);
-
-				float _scale_factor = (1.0f + fbm2d((float)_x*100, (float)_z*100, 6, 0.60))/2.0f;
+				float _scale_factor = environment_condition.precipitation;
 				_scale_factor *= 20.0f;
 				B_draw_grass_patch(plant.meshes[plant_terrain_index%plant.num_meshes], 
 						   _scale_factor,
 						   camera_position,
-						   chunk,
 						   projection_view, 
 						   player_position, 
 						   player_facing, 
@@ -101,7 +118,8 @@ void draw_plants(Plant plant,
 						   x_counter, 
 						   z_counter, 
 						   patch_size, 
-						   offsets[i]);
+						   offsets[i],
+						   terrain_heights[i]);
 			}
 
 			else if (plant.type == PLANT_TYPE_CANOPY)
@@ -111,8 +129,8 @@ void draw_plants(Plant plant,
 						plant_terrain_index%plant.num_meshes, 
 						scale_factor, 
 						canopy_size,
-						chunk, 
 						offsets[i], 
+						terrain_heights[i],
 						x_counter, 
 						z_counter, 
 						projection_view);
@@ -124,8 +142,8 @@ void draw_plants(Plant plant,
 				B_draw_tree_trunk(plant, 
 						0, 
 						trunk_scale_factor,
-						chunk, 
 						offsets[i], 
+						terrain_heights[i],
 						x_counter, 
 						z_counter, 
 						projection_view);
@@ -138,8 +156,8 @@ void draw_plants(Plant plant,
 								plant_terrain_index,
 								0,
 								trunk_scale_factor,
-								chunk, 
 								offsets[i], 
+								terrain_heights[i],
 								x_counter, 
 								z_counter, 
 								projection_view);
@@ -155,4 +173,8 @@ void draw_plants(Plant plant,
 			z_counter++;
 		}
 	}
+	BG_FREE(positions);
+	BG_FREE(terrain_heights);
+	BG_FREE(plant_terrain_indices);
+	BG_FREE(environment_conditions);
 }
@@ -23,7 +23,7 @@
 #include "utils.h"
 #include "time.h"
 
-B_Framebuffer B_generate_g_buffer(B_Texture *normal_texture, B_Texture *position_texture, B_Texture *color_texture, unsigned int *lighting_vao, unsigned int *lighting_vbo)
+B_Framebuffer B_generate_g_buffer(B_Texture *normal_texture, B_Texture *position_texture, B_Texture *color_texture, unsigned int *depth_buffer, unsigned int *lighting_vao, unsigned int *lighting_vbo)
 {
 
 	GLfloat texture_vertices[] =
@@ -97,16 +97,17 @@ B_Framebuffer B_generate_g_buffer(B_Texture *normal_texture, B_Texture *position
 
 	unsigned int attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
 	glDrawBuffers(3, attachments);
-	unsigned int depth_buffer;
-        glGenRenderbuffers(1, &depth_buffer);
-        glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+	unsigned int _depth_buffer;
+        glGenRenderbuffers(1, &_depth_buffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, _depth_buffer);
         glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
-        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _depth_buffer);
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	*position_texture = _position_texture;
 	*normal_texture = _normal_texture;
 	*color_texture = _color_texture;
+	*depth_buffer = _depth_buffer;
 	*lighting_vao = _lighting_vao;
 	*lighting_vbo = _lighting_vbo;
 	return g_buffer;
@@ -122,7 +123,7 @@ Renderer create_default_renderer(B_Window window)
 		renderer.alt_camera = create_camera(window, VEC3(0.0f, 0.0f, 0.0f), VEC3_Z_DOWN);
 	}
 	renderer.window = window;
-	renderer.g_buffer = B_generate_g_buffer(&renderer.normal_texture, &renderer.position_texture, &renderer.color_texture,
+	renderer.g_buffer = B_generate_g_buffer(&renderer.normal_texture, &renderer.position_texture, &renderer.color_texture, &renderer.depth_buffer,
 						&renderer.lighting_vao, &renderer.lighting_vbo);
 	return renderer;
 }
@@ -132,6 +133,8 @@ void free_renderer(Renderer renderer)
 	glDeleteBuffers(1, &renderer.lighting_vbo);
 	glDeleteTextures(1, &renderer.normal_texture);
 	glDeleteTextures(1, &renderer.position_texture);
+	glDeleteTextures(1, &renderer.color_texture);
+	glDeleteRenderbuffers(1, &renderer.depth_buffer);
 	glDeleteVertexArrays(1, &renderer.lighting_vao);
 	glDeleteFramebuffers(1, &renderer.g_buffer);
 }
@@ -42,13 +42,14 @@ typedef struct Renderer
 	B_Texture	normal_texture;
 	B_Texture	position_texture;
 	B_Texture	color_texture;
+	unsigned int	depth_buffer;
 	B_Framebuffer	g_buffer;
 	unsigned int	lighting_vao;
 	unsigned int	lighting_vbo;
 } Renderer;
 
 
-B_Framebuffer B_generate_g_buffer(B_Texture *normal_texture, B_Texture *position_texture, B_Texture *color_texture, unsigned int *lighting_vao, unsigned int *lighting_vbo);
+B_Framebuffer B_generate_g_buffer(B_Texture *normal_texture, B_Texture *position_texture, B_Texture *color_texture, unsigned int *depth_buffer, unsigned int *lighting_vao, unsigned int *lighting_vbo);
 void B_render_lighting(Renderer renderer, 
 		       B_Shader shader, 
 		       PointLight point_light, 
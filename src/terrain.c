@@ -21,6 +21,7 @@
 #include <glad/glad.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
 #include <assimp/cimport.h>
 #include <assimp/scene.h>       
 #include <assimp/postprocess.h> 
@@ -32,11 +33,19 @@
 #include "utils.h"
 #include "input.h"
 #include "terrain.h"
+#include "heightmap_generation.h"
+#include "height_pyramid.h"
+#include "terrain_mesh.h"
+#include "horizon_culling.h"
+#include "terrain_deformation.h"
 #include "debug.h"
 
 int g_terrain_heightmap_width;
 int g_terrain_heightmap_height;
 int g_terrain_chunk_dimension;
+vec2 g_terrain_heightmap_origin;
+float g_terrain_tessellation_scale = 1.0f;
+vec3 g_terrain_camera_position;
 
 void get_terrain_heightmap_size(int *w, int *h)
 {
@@ -60,70 +69,1018 @@ int get_terrain_chunk_dimension(void)
 	return g_terrain_chunk_dimension;
 }
 
-void B_update_terrain_chunk(TerrainChunk *chunk, uint64_t player_block_index)
+static uint16_t quantize_unorm16(float f)
+{
+	if (f <= 0.0f)
+	{
+		return 0;
+	}
+	if (f >= 1.0f)
+	{
+		return UINT16_MAX;
+	}
+	return (uint16_t)((f * UINT16_MAX) + 0.5f);
+}
+
+TerrainHeight pack_terrain_height(int type, float value, float scale, float snow)
+{
+	TerrainHeight height;
+	if (type == TERRAIN_CHUNK_WATER)
+	{
+		height.height = quantize_unorm16(value);
+		height.snow = quantize_unorm16(scale);
+		return height;
+	}
+
+	float final_height = value * (scale*TERRAIN_HEIGHT_FACTOR);
+	if (snow >= TERRAIN_SNOW_THRESHOLD)
+	{
+		final_height += TERRAIN_SNOW_HEIGHT;
+	}
+	height.height = quantize_unorm16(final_height/TERRAIN_MAX_HEIGHT);
+	height.snow = quantize_unorm16(snow);
+	return height;
+}
+
+float unpack_terrain_height(TerrainHeight height)
+{
+	return ((float)height.height/UINT16_MAX) * TERRAIN_MAX_HEIGHT;
+}
+
+float unpack_terrain_snow(TerrainHeight height)
+{
+	return (float)height.snow/UINT16_MAX;
+}
+
+static float sign_not_zero(float f)
+{
+	return (f < 0.0f) ? -1.0f : 1.0f;
+}
+
+static int8_t quantize_snorm8(float f)
+{
+	return (int8_t)roundf(glm_clamp(f, -1.0f, 1.0f) * 127.0f);
+}
+
+static void encode_octahedral_normal(vec3 normal, int8_t dest[2])
+{
+	float sum = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+	float x = normal[0]/sum;
+	float z = normal[2]/sum;
+	if (normal[1] < 0.0f)
+	{
+		float folded_x = (1.0f - fabsf(z)) * sign_not_zero(x);
+		float folded_z = (1.0f - fabsf(x)) * sign_not_zero(z);
+		x = folded_x;
+		z = folded_z;
+	}
+	dest[0] = quantize_snorm8(x);
+	dest[1] = quantize_snorm8(z);
+}
+
+/* This has to match decode_normal in terrain_shader.etess */
+static void decode_octahedral_normal(const int8_t src[2], vec3 dest)
+{
+	float x = glm_max(src[0]/127.0f, -1.0f);
+	float z = glm_max(src[1]/127.0f, -1.0f);
+	float y = 1.0f - fabsf(x) - fabsf(z);
+	if (y < 0.0f)
+	{
+		float folded_x = (1.0f - fabsf(z)) * sign_not_zero(x);
+		float folded_z = (1.0f - fabsf(x)) * sign_not_zero(z);
+		x = folded_x;
+		z = folded_z;
+	}
+	dest[0] = x;
+	dest[1] = y;
+	dest[2] = z;
+	glm_vec3_normalize(dest);
+}
+
+TerrainNormal pack_terrain_normal(vec3 normal, vec3 snow_normal)
+{
+	TerrainNormal packed;
+	encode_octahedral_normal(normal, packed.normal);
+	encode_octahedral_normal(snow_normal, packed.snow_normal);
+	return packed;
+}
+
+void unpack_terrain_normal(TerrainNormal packed, vec3 normal, vec3 snow_normal)
+{
+	decode_octahedral_normal(packed.normal, normal);
+	decode_octahedral_normal(packed.snow_normal, snow_normal);
+}
+
+unsigned int get_heightmap_buffer_index(TerrainChunk *chunk, int x, int z)
+{
+	x = (x + (chunk->origin_x + chunk->buffer_shift_x)*chunk->width) % chunk->heightmap_width;
+	z = (z + (chunk->origin_z + chunk->buffer_shift_z)*chunk->height) % chunk->heightmap_height;
+	if (x < 0)
+	{
+		x += chunk->heightmap_width;
+	}
+	if (z < 0)
+	{
+		z += chunk->heightmap_height;
+	}
+	return (z * chunk->heightmap_width) + x;
+}
+
+TerrainHeight *get_terrain_block_buffer(TerrainChunk *chunk, int block_x, int block_z)
+{
+	return &chunk->heightmap_buffer[get_heightmap_buffer_index(chunk, block_x*chunk->width, block_z*chunk->height)];
+}
+
+int get_terrain_chunk_block_index(TerrainChunk *chunk, int block_x, int block_z)
+{
+	int half_dimension = chunk->dimension/2;
+	return chunk->center_index + ((block_z - half_dimension)*MAX_TERRAIN_BLOCKS) + (block_x - half_dimension);
+}
+
+void get_heightmap_origin(TerrainChunk *chunk, vec2 dest)
+{
+	dest[0] = (float)chunk->origin_x/(float)chunk->dimension;
+	dest[1] = (float)chunk->origin_z/(float)chunk->dimension;
+}
+
+void get_terrain_heightmap_origin(vec2 dest)
+{
+	glm_vec2_copy(g_terrain_heightmap_origin, dest);
+}
+
+static void B_set_tessellation_uniforms(B_Shader shader, int patch_height_from_heightmap)
 {
+	B_set_uniform_float(shader, "tessellation_scale", g_terrain_tessellation_scale);
+	B_set_uniform_vec3(shader, "camera_position", g_terrain_camera_position);
+	B_set_uniform_int(shader, "patch_height_from_heightmap", patch_height_from_heightmap);
+}
+
+static void set_heightmap_buffer_shift(TerrainChunk *chunk)
+{
+	chunk->buffer_shift_x = (int)(chunk->center_index % MAX_TERRAIN_BLOCKS) - (int)(chunk->buffer_center_index % MAX_TERRAIN_BLOCKS);
+	chunk->buffer_shift_z = (int)(chunk->center_index / MAX_TERRAIN_BLOCKS) - (int)(chunk->buffer_center_index / MAX_TERRAIN_BLOCKS);
+}
 
+/* Uploads the given blocks of buffer, which is laid out like the heightmap with texel_size bytes a texel, to texture */
+static void B_upload_terrain_chunk_texture_blocks(TerrainChunk *chunk, 
+						  GLenum texture_unit,
+						  B_Texture texture,
+						  GLenum format,
+						  GLenum type,
+						  void *buffer,
+						  size_t texel_size,
+						  ivec2 *blocks, 
+						  int num_blocks)
+{
+	glActiveTexture(texture_unit);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	if (num_blocks == chunk->dimension*chunk->dimension)
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, chunk->heightmap_width, chunk->heightmap_height, format, type, buffer);
+		return;
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, chunk->heightmap_width);
+	for (int i = 0; i < num_blocks; ++i)
+	{
+		int x = (blocks[i][0] + chunk->origin_x) % chunk->dimension;
+		int z = (blocks[i][1] + chunk->origin_z) % chunk->dimension;
+		unsigned int index = get_heightmap_buffer_index(chunk, blocks[i][0]*chunk->width, blocks[i][1]*chunk->height);
+		glTexSubImage2D(GL_TEXTURE_2D, 
+				0, 
+				x*chunk->width, 
+				z*chunk->height, 
+				chunk->width, 
+				chunk->height, 
+				format, 
+				type, 
+				(char *)buffer + (index*texel_size));
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+static void B_upload_terrain_chunk_blocks(TerrainChunk *chunk, ivec2 *blocks, int num_blocks)
+{
 	unsigned int texture = GL_TEXTURE0;	
 	if (chunk->type == TERRAIN_CHUNK_WATER)
 	{
 		texture = GL_TEXTURE1;
 	}
+	B_upload_terrain_chunk_texture_blocks(chunk, 
+					      texture, 
+					      chunk->heightmap, 
+					      GL_RG, 
+					      GL_UNSIGNED_SHORT, 
+					      chunk->heightmap_buffer, 
+					      sizeof(TerrainHeight), 
+					      blocks, 
+					      num_blocks);
+
+	/* More blocks' normals change than heights, see get_terrain_normal_blocks */
+	if ((chunk->normal_buffer != NULL) && (num_blocks > 0))
+	{
+		ivec2 *normal_blocks = BG_MALLOC(ivec2, chunk->dimension*chunk->dimension);
+		int num_normal_blocks = get_terrain_normal_blocks(chunk, blocks, num_blocks, normal_blocks);
+		B_upload_terrain_chunk_texture_blocks(chunk, 
+						      GL_TEXTURE2, 
+						      chunk->normal_map, 
+						      GL_RGBA, 
+						      GL_BYTE, 
+						      chunk->normal_buffer, 
+						      sizeof(TerrainNormal), 
+						      normal_blocks, 
+						      num_normal_blocks);
+		BG_FREE(normal_blocks);
+	}
+}
+
+/* Generates the whole heightmap on the GPU. The blocks go in draw_blocks (they're only used for drawing later on in
+ * the frame) and each dispatch does blocks_per_dispatch of them, one per layer of work groups. That's always all of
+ * them, except when benchmark_terrain_chunk_generation compares against generating a block at a time. */
+static void B_dispatch_terrain_chunk_generation(TerrainChunk *chunk, uint64_t player_block_index, int blocks_per_dispatch)
+{
 	int x_max = chunk->dimension/2;
-	int x_offset = -x_max;
-	int z_offset = -MAX_TERRAIN_BLOCKS*x_max;
-	int x_counter = 0;
-	int z_counter = 0;
+	int num_blocks = 0;
+	for (int z_offset = -x_max; z_offset <= x_max; ++z_offset)
+	{
+		for (int x_offset = -x_max; x_offset <= x_max; ++x_offset)
+		{
+			int index = player_block_index + (z_offset*MAX_TERRAIN_BLOCKS) + x_offset;
+			if ((chunk->type == TERRAIN_CHUNK_WATER) && !terrain_block_has_water(index))
+			{
+				continue;
+			}
+			EnvironmentCondition environment_condition = get_environment_condition(index);
+			TerrainDrawBlock *block = &chunk->draw_blocks[num_blocks++];
+			block->x_offset = x_offset;
+			block->z_offset = z_offset;
+			block->temperature = environment_condition.temperature;
+			block->precipitation = environment_condition.precipitation;
+		}
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunk->draw_block_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(TerrainDrawBlock)*chunk->dimension*chunk->dimension, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(TerrainDrawBlock)*num_blocks, chunk->draw_blocks);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TERRAIN_DRAW_BLOCK_BINDING, chunk->draw_block_buffer);
+
 	glUseProgram(chunk->compute_shader);
-	glActiveTexture(texture);
-	glBindTexture(GL_TEXTURE_2D, chunk->heightmap);
 	if (chunk->type == TERRAIN_CHUNK_WATER)
 	{
 		B_set_uniform_int(chunk->compute_shader, "data", 1);
-		glBindImageTexture(1, chunk->heightmap, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glBindImageTexture(1, chunk->heightmap, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16);
 	}
 	else
 	{
 		B_set_uniform_int(chunk->compute_shader, "data", 0);
-		glBindImageTexture(0, chunk->heightmap, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glBindImageTexture(0, chunk->heightmap, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16);
 	}
 	B_set_uniform_float(chunk->compute_shader, "xz_scale", TERRAIN_XZ_SCALE);
+	B_set_uniform_float(chunk->compute_shader, "max_height", TERRAIN_MAX_HEIGHT);
+	B_set_uniform_int(chunk->compute_shader, "player_block_x", player_block_index % MAX_TERRAIN_BLOCKS);
+	B_set_uniform_int(chunk->compute_shader, "player_block_z", player_block_index / MAX_TERRAIN_BLOCKS);
+	B_set_uniform_int(chunk->compute_shader, "half_dimension", x_max);
+	for (int first_block = 0; first_block < num_blocks; first_block += blocks_per_dispatch)
+	{
+		B_set_uniform_int(chunk->compute_shader, "first_block", first_block);
+		glDispatchCompute(chunk->width/8, chunk->height/8, mini(blocks_per_dispatch, num_blocks - first_block));
+		if (first_block + blocks_per_dispatch < num_blocks)
+		{
+			glMemoryBarrier(GL_ALL_BARRIER_BITS);
+		}
+	}
+	/* The normal pass reads the heights as an image, the terrain shaders sample them and the readback copies them */
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+/* Works out the whole normal map from the heightmap texture on the GPU */
+static void B_dispatch_terrain_chunk_normals(TerrainChunk *chunk)
+{
+	glUseProgram(chunk->normal_compute_shader);
+	B_set_uniform_float(chunk->normal_compute_shader, "max_height", TERRAIN_MAX_HEIGHT);
+	B_set_uniform_float(chunk->normal_compute_shader, "texel_spacing", (TERRAIN_XZ_SCALE*4.0f)/chunk->width);
+	B_set_uniform_float(chunk->normal_compute_shader, "snow_normal_flatness", TERRAIN_SNOW_NORMAL_FLATNESS);
+	glBindImageTexture(0, chunk->heightmap, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG16);
+	glBindImageTexture(2, chunk->normal_map, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8_SNORM);
+	glDispatchCompute(chunk->heightmap_width/8, chunk->heightmap_height/8, 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+/* Applies the logged edits to the freshly generated heightmap texture, so they don't disappear until the readback
+ * gets back and reapply_terrain_edits puts them in heightmap_buffer. Has to go before the normal pass. */
+static void B_dispatch_terrain_chunk_edits(TerrainChunk *chunk)
+{
+	chunk->readback_num_edits = get_num_terrain_edits();
+	TerrainChunkEdit *edits = NULL;
+	int num_edits = get_terrain_chunk_edits(chunk, &edits);
+	if (num_edits == 0)
+	{
+		BG_FREE(edits);
+		return;
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunk->edit_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(TerrainChunkEdit)*num_edits, edits, GL_STREAM_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TERRAIN_EDIT_BINDING, chunk->edit_buffer);
+	BG_FREE(edits);
+
+	glUseProgram(chunk->edit_compute_shader);
+	B_set_uniform_float(chunk->edit_compute_shader, "max_height", TERRAIN_MAX_HEIGHT);
+	B_set_uniform_int(chunk->edit_compute_shader, "num_edits", num_edits);
+	glBindImageTexture(0, chunk->heightmap, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG16);
+	glDispatchCompute(chunk->heightmap_width/8, chunk->heightmap_height/8, 1);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+void B_update_terrain_chunk(TerrainChunk *chunk, uint64_t player_block_index)
+{
+	if (CPU_HEIGHTMAP_GENERATION)
+	{
+		ivec2 *new_blocks = BG_MALLOC(ivec2, chunk->dimension*chunk->dimension);
+		int num_new_blocks = scroll_terrain_chunk_heightmap(chunk, player_block_index, new_blocks);
+		B_upload_terrain_chunk_blocks(chunk, new_blocks, num_new_blocks);
+		mark_terrain_lod_meshes_dirty(chunk, new_blocks, num_new_blocks);
+		BG_FREE(new_blocks);
+		if (chunk->type == TERRAIN_CHUNK_LAND)
+		{
+			get_heightmap_origin(chunk, g_terrain_heightmap_origin);
+		}
+		return;
+	}
+
+	/* The compute shaders always write the whole heightmap starting from the top left. heightmap_buffer
+	 * isn't updated until the readback finishes, so until then lookups are shifted to where it's centered. */
+	chunk->center_index = player_block_index;
+	chunk->origin_x = 0;
+	chunk->origin_z = 0;
+	chunk->heightmap_generated = 1;
+	set_heightmap_buffer_shift(chunk);
+	if (chunk->type == TERRAIN_CHUNK_LAND)
+	{
+		get_heightmap_origin(chunk, g_terrain_heightmap_origin);
+	}
+
+	unsigned int texture = GL_TEXTURE0;	
+	if (chunk->type == TERRAIN_CHUNK_WATER)
+	{
+		texture = GL_TEXTURE1;
+	}
+	glActiveTexture(texture);
+	glBindTexture(GL_TEXTURE_2D, chunk->heightmap);
+	B_dispatch_terrain_chunk_generation(chunk, player_block_index, chunk->dimension*chunk->dimension);
+
+	if (chunk->type == TERRAIN_CHUNK_LAND)
+	{
+		B_dispatch_terrain_chunk_edits(chunk);
+		B_dispatch_terrain_chunk_normals(chunk);
+	}
+	glActiveTexture(texture);
+	glBindTexture(GL_TEXTURE_2D, chunk->heightmap);
+
+	/* A readback that's still in flight is out of date now, so it's dropped */
+	if (chunk->readback_fence)
+	{
+		glDeleteSync(chunk->readback_fence);
+	}
+	chunk->current_readback_buffer = !chunk->current_readback_buffer;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, chunk->readback_buffers[chunk->current_readback_buffer]);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_UNSIGNED_SHORT, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	chunk->readback_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	chunk->readback_center_index = player_block_index;
+	chunk->readback_frames_in_flight = 0;
+}
+
+/* Uploads a rectangle of texels of buffer (counted from the chunk's top left corner, and laid out like the heightmap
+ * with texel_size bytes a texel) to texture. The ring buffer only wraps between blocks, so it goes a block at a time. */
+static void B_upload_terrain_chunk_texture_rect(TerrainChunk *chunk, 
+						B_Texture texture,
+						GLenum format,
+						GLenum type,
+						void *buffer,
+						size_t texel_size,
+						int min_x,
+						int min_z,
+						int max_x,
+						int max_z)
+{
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, chunk->heightmap_width);
+	for (int block_z = min_z/chunk->height; block_z <= max_z/chunk->height; ++block_z)
+	{
+		for (int block_x = min_x/chunk->width; block_x <= max_x/chunk->width; ++block_x)
+		{
+			int first_x = maxi(min_x, block_x*chunk->width);
+			int first_z = maxi(min_z, block_z*chunk->height);
+			int last_x = mini(max_x, ((block_x+1)*chunk->width) - 1);
+			int last_z = mini(max_z, ((block_z+1)*chunk->height) - 1);
+			unsigned int index = get_heightmap_buffer_index(chunk, first_x, first_z);
+			glTexSubImage2D(GL_TEXTURE_2D, 
+					0, 
+					index % chunk->heightmap_width, 
+					index / chunk->heightmap_width, 
+					(last_x - first_x) + 1, 
+					(last_z - first_z) + 1, 
+					format, 
+					type, 
+					(char *)buffer + (index*texel_size));
+			if ((buffer == chunk->heightmap_buffer) && chunk->height_pyramid.num_levels)
+			{
+				update_height_pyramid_region(&chunk->height_pyramid,
+							     chunk->heightmap_buffer,
+							     index % chunk->heightmap_width,
+							     index / chunk->heightmap_width,
+							     (last_x - first_x) + 1,
+							     (last_z - first_z) + 1);
+			}
+		}
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+void B_upload_terrain_chunk_edits(TerrainChunk *chunk)
+{
+	/* While a readback is in flight the texture and heightmap_buffer aren't laid out the same. Everything gets
+	 * edited and uploaded again once it's copied anyway. */
+	if ((chunk->num_dirty_rects == 0) || (chunk->readback_fence != NULL))
+	{
+		return;
+	}
+
+	int64_t first_x = 0;
+	int64_t first_z = 0;
+	get_terrain_chunk_first_texel(chunk, &first_x, &first_z);
+	uint8_t *changed_blocks = BG_MALLOC(uint8_t, chunk->dimension*chunk->dimension);
+	glActiveTexture(GL_TEXTURE0);
+	for (int i = 0; i < chunk->num_dirty_rects; ++i)
+	{
+		/* The chunk might have moved since the edit, so whatever isn't in it anymore is skipped */
+		TerrainTexelRect *rect = &chunk->dirty_rects[i];
+		int min_x = maxi((int)(rect->min_x - first_x), 0);
+		int min_z = maxi((int)(rect->min_z - first_z), 0);
+		int max_x = mini((int)(rect->max_x - first_x), chunk->heightmap_width - 1);
+		int max_z = mini((int)(rect->max_z - first_z), chunk->heightmap_height - 1);
+		if ((min_x > max_x) || (min_z > max_z))
+		{
+			continue;
+		}
+		B_upload_terrain_chunk_texture_rect(chunk, 
+						    chunk->heightmap, 
+						    GL_RG, 
+						    GL_UNSIGNED_SHORT, 
+						    chunk->heightmap_buffer, 
+						    sizeof(TerrainHeight), 
+						    min_x, 
+						    min_z, 
+						    max_x, 
+						    max_z);
+
+		/* The normals next to the edit change too, since they come from the slopes */
+		min_x = maxi(min_x - 1, 0);
+		min_z = maxi(min_z - 1, 0);
+		max_x = mini(max_x + 1, chunk->heightmap_width - 1);
+		max_z = mini(max_z + 1, chunk->heightmap_height - 1);
+		if (chunk->normal_buffer != NULL)
+		{
+			generate_terrain_rect_normals(chunk, min_x, min_z, (max_x - min_x) + 1, (max_z - min_z) + 1);
+			glActiveTexture(GL_TEXTURE2);
+			B_upload_terrain_chunk_texture_rect(chunk, 
+							    chunk->normal_map, 
+							    GL_RGBA, 
+							    GL_BYTE, 
+							    chunk->normal_buffer, 
+							    sizeof(TerrainNormal), 
+							    min_x, 
+							    min_z, 
+							    max_x, 
+							    max_z);
+			glActiveTexture(GL_TEXTURE0);
+		}
+		for (int block_z = min_z/chunk->height; block_z <= max_z/chunk->height; ++block_z)
+		{
+			for (int block_x = min_x/chunk->width; block_x <= max_x/chunk->width; ++block_x)
+			{
+				changed_blocks[(block_z*chunk->dimension) + block_x] = 1;
+			}
+		}
+	}
+	chunk->num_dirty_rects = 0;
+
+	if ((chunk->type == TERRAIN_CHUNK_LAND) && (chunk->normal_buffer == NULL))
+	{
+		B_dispatch_terrain_chunk_normals(chunk);
+	}
+	if (chunk->height_pyramid.num_levels)
+	{
+		update_terrain_water_mask(chunk);
+	}
+
+	ivec2 *blocks = BG_MALLOC(ivec2, chunk->dimension*chunk->dimension);
+	int num_blocks = 0;
 	for (int i = 0; i < chunk->dimension*chunk->dimension; ++i)
 	{
-		int index = player_block_index + z_offset + x_offset;
-		EnvironmentCondition environment_condition = get_environment_condition(index);
-		B_set_uniform_int(chunk->compute_shader, "my_block_index", index);
-		B_set_uniform_int(chunk->compute_shader, "x_counter", x_counter);
-		B_set_uniform_int(chunk->compute_shader, "z_counter", z_counter);
-		B_set_uniform_int(chunk->compute_shader, "temperature", environment_condition.temperature); 
-		B_set_uniform_float(chunk->compute_shader, "precipitation", environment_condition.precipitation); 
-		x_counter++;
-		x_offset++;
-		if (x_offset > x_max)
+		if (changed_blocks[i])
+		{
+			blocks[num_blocks][0] = i % chunk->dimension;
+			blocks[num_blocks][1] = i / chunk->dimension;
+			num_blocks++;
+		}
+	}
+	mark_terrain_lod_meshes_dirty(chunk, blocks, num_blocks);
+	BG_FREE(blocks);
+	BG_FREE(changed_blocks);
+}
+
+void B_generate_new_terrain_water_blocks(TerrainChunk *water_chunk)
+{
+	uint64_t *indices = NULL;
+	int num_indices = take_new_terrain_water_blocks(&indices);
+	/* Almost every frame, nothing has just become wet */
+	if (num_indices == 0)
+	{
+		return;
+	}
+	int half_dimension = water_chunk->dimension/2;
+	ivec2 *blocks = BG_MALLOC(ivec2, maxi(num_indices, 1));
+	int num_blocks = 0;
+	for (int i = 0; i < num_indices; ++i)
+	{
+		int block_x = (int)(indices[i] % MAX_TERRAIN_BLOCKS) - (int)(water_chunk->center_index % MAX_TERRAIN_BLOCKS) + half_dimension;
+		int block_z = (int)(indices[i] / MAX_TERRAIN_BLOCKS) - (int)(water_chunk->center_index / MAX_TERRAIN_BLOCKS) + half_dimension;
+		/* Blocks the water chunk doesn't have are generated when it gets to them anyway */
+		if ((block_x < 0) || (block_z < 0) || (block_x >= water_chunk->dimension) || (block_z >= water_chunk->dimension))
+		{
+			continue;
+		}
+		blocks[num_blocks][0] = block_x;
+		blocks[num_blocks][1] = block_z;
+		num_blocks++;
+	}
+	BG_FREE(indices);
+
+	if (num_blocks > 0)
+	{
+		if (CPU_HEIGHTMAP_GENERATION)
+		{
+			generate_terrain_chunk_blocks(water_chunk, blocks, num_blocks);
+			B_upload_terrain_chunk_blocks(water_chunk, blocks, num_blocks);
+			mark_terrain_lod_meshes_dirty(water_chunk, blocks, num_blocks);
+		}
+		else
+		{
+			/* The compute shaders always write the whole heightmap */
+			B_update_terrain_chunk(water_chunk, water_chunk->center_index);
+		}
+	}
+	BG_FREE(blocks);
+}
+
+/* Reads a GL_TIME_ELAPSED query's result into elapsed if the GPU has it yet. Returns 0 without waiting if it doesn't. */
+static int B_get_query_elapsed(unsigned int query, int issued, GLuint64 *elapsed)
+{
+	if (!issued)
+	{
+		return 0;
+	}
+	GLint available = 0;
+	glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+	{
+		return 0;
+	}
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, elapsed);
+	return 1;
+}
+
+void B_benchmark_terrain_chunk_generation(int num_runs)
+{
+	const int dimensions[3] = { 3, 9, 21 };
+	int old_dimension = get_terrain_chunk_dimension();
+	/* Each run's GPU time is read during the next run, so the queries take turns */
+	unsigned int queries[2] = { 0, 0 };
+	glGenQueries(2, queries);
+	for (int i = 0; i < 3; ++i)
+	{
+		set_terrain_chunk_dimension(dimensions[i]);
+		TerrainChunk chunk = create_terrain_chunk(0, TERRAIN_CHUNK_LAND, PLAYER_TERRAIN_INDEX_START);
+		int num_blocks = chunk.dimension*chunk.dimension;
+		/* A block per dispatch with a full barrier after each is how it used to be done */
+		const int blocks_per_dispatch[2] = { 1, num_blocks };
+		double milliseconds[2] = { 0.0, 0.0 };
+		/* Some drivers (Mesa's llvmpipe, for one) report 0 for GL_TIME_ELAPSED, so the wall clock time with a
+		 * glFinish() after each run is measured too */
+		double wall_milliseconds[2] = { 0.0, 0.0 };
+		for (int j = 0; j < 2; ++j)
+		{
+			GLuint64 total_elapsed = 0;
+			int num_elapsed = 0;
+			double total_wall_seconds = 0.0;
+			int issued[2] = { 0, 0 };
+			for (int run = 0; run < num_runs; ++run)
+			{
+				GLuint64 elapsed = 0;
+				struct timespec start;
+				struct timespec end;
+				unsigned int query = queries[run % 2];
+				unsigned int last_query = queries[(run+1) % 2];
+				glFinish();
+				clock_gettime(CLOCK_MONOTONIC, &start);
+				glBeginQuery(GL_TIME_ELAPSED, query);
+				B_dispatch_terrain_chunk_generation(&chunk, chunk.center_index, blocks_per_dispatch[j]);
+				glEndQuery(GL_TIME_ELAPSED);
+				issued[run % 2] = 1;
+				if (B_get_query_elapsed(last_query, issued[(run+1) % 2], &elapsed))
+				{
+					total_elapsed += elapsed;
+					++num_elapsed;
+				}
+				issued[(run+1) % 2] = 0;
+				glFinish();
+				clock_gettime(CLOCK_MONOTONIC, &end);
+				total_wall_seconds += (double)(end.tv_sec - start.tv_sec) + ((double)(end.tv_nsec - start.tv_nsec)/1e9);
+			}
+			/* The last run's result is the only one that's waited for, after all of the runs are timed */
+			GLuint64 elapsed = 0;
+			if (num_runs > 0)
+			{
+				glGetQueryObjectui64v(queries[(num_runs-1) % 2], GL_QUERY_RESULT, &elapsed);
+				total_elapsed += elapsed;
+				++num_elapsed;
+			}
+			milliseconds[j] = (num_elapsed > 0) ? ((double)total_elapsed/num_elapsed)/1e6 : 0.0;
+			wall_milliseconds[j] = (total_wall_seconds/num_runs)*1e3;
+		}
+		printf("%ix%i blocks: %.3f ms a block at a time, %.3f ms in one dispatch (GPU time)\n", 
+		       chunk.dimension, chunk.dimension, milliseconds[0], milliseconds[1]);
+		printf("%ix%i blocks: %.3f ms a block at a time, %.3f ms in one dispatch (wall clock)\n", 
+		       chunk.dimension, chunk.dimension, wall_milliseconds[0], wall_milliseconds[1]);
+		free_terrain_chunk(&chunk);
+	}
+	glDeleteQueries(2, queries);
+	set_terrain_chunk_dimension(old_dimension);
+}
+
+static void B_read_terrain_chunk_heightmap(TerrainChunk *chunk, TerrainHeight *dest)
+{
+	glFinish();
+	glBindTexture(GL_TEXTURE_2D, chunk->heightmap);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_UNSIGNED_SHORT, dest);
+}
+
+/* Counts the texels whose quantized heights differ, and prints how many there were out of how many the edits touched */
+static int compare_terrain_edit_heights(const char *name, TerrainHeight *a, TerrainHeight *b, TerrainHeight *unedited, int size)
+{
+	int num_edited = 0;
+	int num_mismatches = 0;
+	int max_difference = 0;
+	for (int i = 0; i < size; ++i)
+	{
+		int difference = abs((int)a[i].height - (int)b[i].height);
+		num_edited += (a[i].height != unedited[i].height);
+		num_mismatches += (difference != 0);
+		max_difference = maxi(max_difference, difference);
+	}
+	printf("%s: %i of %i edited texels differ, by at most %i\n", name, num_mismatches, num_edited, max_difference);
+	return num_mismatches;
+}
+
+int B_check_terrain_edits(void)
+{
+	int old_dimension = get_terrain_chunk_dimension();
+	set_terrain_chunk_dimension(5);
+	TerrainChunk chunk = create_terrain_chunk(0, TERRAIN_CHUNK_LAND, PLAYER_TERRAIN_INDEX_START);
+	TerrainHeight *unedited = BG_MALLOC(TerrainHeight, chunk.heightmap_size);
+	memcpy(unedited, chunk.heightmap_buffer, chunk.heightmap_size*sizeof(TerrainHeight));
+
+	/* The player's block goes from (0, 0) to (block_width, block_width). One edit in the middle of a block, one
+	 * over a corner between four, one that raises the ground over part of the first, and one on the chunk's edge. */
+	float block_width = TERRAIN_XZ_SCALE*4.0f;
+	deform_terrain(&chunk, VEC3(block_width*0.5f, 0.0f, block_width*0.5f), 300.0f, 200.0f);
+	deform_terrain(&chunk, VEC3(block_width, 0.0f, block_width), 500.0f, 400.0f);
+	deform_terrain(&chunk, VEC3(block_width*0.6f, 0.0f, block_width*0.4f), 200.0f, -150.0f);
+	deform_terrain(&chunk, VEC3(-block_width*2.0f, 0.0f, block_width*0.3f), 250.0f, 300.0f);
+	B_upload_terrain_chunk_edits(&chunk);
+
+	int num_mismatches = 0;
+	TerrainHeight *heights = BG_MALLOC(TerrainHeight, chunk.heightmap_size);
+	TerrainHeight *gpu_heights = BG_MALLOC(TerrainHeight, chunk.heightmap_size);
+
+	/* The edits went into the texture through the dirty rectangles */
+	B_read_terrain_chunk_heightmap(&chunk, heights);
+	num_mismatches += compare_terrain_edit_heights("Uploaded edits", chunk.heightmap_buffer, heights, unedited, chunk.heightmap_size);
+
+	/* A chunk generated from scratch gets the edits replayed from the log, on the CPU by
+	 * apply_terrain_edits_to_block or on the GPU by terrain_edit_shader.comp, depending on CPU_HEIGHTMAP_GENERATION */
+	TerrainChunk regenerated = create_terrain_chunk(0, TERRAIN_CHUNK_LAND, PLAYER_TERRAIN_INDEX_START);
+	num_mismatches += compare_terrain_edit_heights("Regenerated chunk", 
+						       chunk.heightmap_buffer, 
+						       regenerated.heightmap_buffer, 
+						       unedited, 
+						       chunk.heightmap_size);
+	free_terrain_chunk(&regenerated);
+
+	/* Whichever path the game uses, the GPU edit pass has to come out the same as the CPU one on the same heights */
+	B_Shader edit_compute_shader = chunk.edit_compute_shader;
+	if (edit_compute_shader == 0)
+	{
+		chunk.edit_compute_shader = B_compile_compute_shader("render_progs/terrain_edit_shader.comp");
+		glGenBuffers(1, &chunk.edit_buffer);
+	}
+	B_dispatch_terrain_chunk_generation(&chunk, chunk.center_index, chunk.dimension*chunk.dimension);
+	B_read_terrain_chunk_heightmap(&chunk, heights);
+	memcpy(unedited, heights, chunk.heightmap_size*sizeof(TerrainHeight));
+	for (int block_z = 0; block_z < chunk.dimension; ++block_z)
+	{
+		for (int block_x = 0; block_x < chunk.dimension; ++block_x)
+		{
+			apply_terrain_edits_to_block(get_terrain_chunk_block_index(&chunk, block_x, block_z), 
+						     &heights[(block_z*chunk.height*chunk.heightmap_width) + (block_x*chunk.width)], 
+						     chunk.heightmap_width);
+		}
+	}
+	B_dispatch_terrain_chunk_generation(&chunk, chunk.center_index, chunk.dimension*chunk.dimension);
+	B_dispatch_terrain_chunk_edits(&chunk);
+	B_read_terrain_chunk_heightmap(&chunk, gpu_heights);
+	num_mismatches += compare_terrain_edit_heights("GPU edit pass", heights, gpu_heights, unedited, chunk.heightmap_size);
+	if (edit_compute_shader == 0)
+	{
+		B_free_shader(chunk.edit_compute_shader);
+	}
+
+	BG_FREE(heights);
+	BG_FREE(gpu_heights);
+	BG_FREE(unedited);
+	free_terrain_chunk(&chunk);
+	free_terrain_edits();
+	set_terrain_chunk_dimension(old_dimension);
+	return num_mismatches;
+}
+
+static void B_copy_terrain_chunk_readback(TerrainChunk *chunk)
+{
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, chunk->readback_buffers[chunk->current_readback_buffer]);
+	TerrainHeight *heights = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, chunk->heightmap_size*sizeof(TerrainHeight), GL_MAP_READ_BIT);
+	if (heights == NULL)
+	{
+		fprintf(stderr, "B_copy_terrain_chunk_readback error: could not map readback buffer\n");
+		exit(-1);
+	}
+	memcpy(chunk->heightmap_buffer, heights, chunk->heightmap_size*sizeof(TerrainHeight));
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (chunk->height_pyramid.num_levels)
+	{
+		update_height_pyramid_region(&chunk->height_pyramid, chunk->heightmap_buffer, 0, 0, chunk->heightmap_width, chunk->heightmap_height);
+	}
+
+	glDeleteSync(chunk->readback_fence);
+	chunk->readback_fence = NULL;
+	chunk->buffer_center_index = chunk->readback_center_index;
+	set_heightmap_buffer_shift(chunk);
+	/* The edits made before the heightmap was generated are already in it. The ones made since go on top here, and
+	 * are uploaded with the others. */
+	if (chunk->type == TERRAIN_CHUNK_LAND)
+	{
+		reapply_terrain_edits(chunk, chunk->readback_num_edits);
+	}
+	mark_terrain_lod_meshes_dirty(chunk, NULL, 0);
+	if (chunk->height_pyramid.num_levels)
+	{
+		update_terrain_water_mask(chunk);
+	}
+	chunk->last_readback_frames_in_flight = chunk->readback_frames_in_flight;
+	if (BENCHMARK)
+	{
+		printf("Heightmap readback was in flight for %i frames\n", chunk->readback_frames_in_flight);
+	}
+}
+
+void B_poll_terrain_chunk_readback(TerrainChunk *chunk)
+{
+	if (chunk->readback_fence == NULL)
+	{
+		return;
+	}
+	chunk->readback_frames_in_flight++;
+	GLenum status = glClientWaitSync(chunk->readback_fence, 0, 0);
+	if ((status == GL_ALREADY_SIGNALED) || (status == GL_CONDITION_SATISFIED))
+	{
+		B_copy_terrain_chunk_readback(chunk);
+	}
+}
+
+void B_finish_terrain_chunk_readback(TerrainChunk *chunk)
+{
+	if (chunk->readback_fence == NULL)
+	{
+		return;
+	}
+	GLenum status = GL_TIMEOUT_EXPIRED;
+	while ((status != GL_ALREADY_SIGNALED) && (status != GL_CONDITION_SATISFIED))
+	{
+		status = glClientWaitSync(chunk->readback_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		if (status == GL_WAIT_FAILED)
+		{
+			fprintf(stderr, "B_finish_terrain_chunk_readback error: glClientWaitSync failed\n");
+			exit(-1);
+		}
+	}
+	B_copy_terrain_chunk_readback(chunk);
+}
+
+void B_resize_terrain_chunk(TerrainChunk *chunk, int dimension)
+{
+	if (dimension == chunk->dimension)
+	{
+		return;
+	}
+	/* A readback of the old size can't be copied into the new buffer */
+	if (chunk->readback_fence)
+	{
+		glDeleteSync(chunk->readback_fence);
+		chunk->readback_fence = NULL;
+	}
+
+	TerrainChunk old_chunk = *chunk;
+	chunk->dimension = dimension;
+	chunk->heightmap_width = chunk->width*dimension;
+	chunk->heightmap_height = chunk->height*dimension;
+	chunk->heightmap_size = chunk->heightmap_width*chunk->heightmap_height;
+	chunk->heightmap_buffer = BG_MALLOC(TerrainHeight, chunk->heightmap_size);
+	if (old_chunk.normal_buffer != NULL)
+	{
+		BG_FREE(old_chunk.normal_buffer);
+		chunk->normal_buffer = BG_MALLOC(TerrainNormal, chunk->heightmap_size);
+	}
+	chunk->origin_x = 0;
+	chunk->origin_z = 0;
+	chunk->buffer_shift_x = 0;
+	chunk->buffer_shift_z = 0;
+	if (chunk->type == TERRAIN_CHUNK_LAND)
+	{
+		g_terrain_heightmap_width = chunk->heightmap_width;
+		g_terrain_heightmap_height = chunk->heightmap_height;
+		free_height_pyramid(&chunk->height_pyramid);
+		chunk->height_pyramid = create_height_pyramid(chunk->heightmap_width, chunk->heightmap_height);
+	}
+
+	BG_FREE(chunk->draw_blocks);
+	chunk->draw_blocks = BG_MALLOC(TerrainDrawBlock, dimension*dimension);
+	if (USE_MESHED_TERRAIN)
+	{
+		B_free_terrain_lod_meshes(&old_chunk);
+		B_create_terrain_lod_meshes(chunk);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunk->draw_block_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(TerrainDrawBlock)*dimension*dimension, NULL, GL_STREAM_DRAW);
+
+	/* The texture keeps its name (the plants have it too), it just gets new storage */
+	glBindTexture(GL_TEXTURE_2D, chunk->heightmap);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, chunk->heightmap_width, chunk->heightmap_height, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
+	if (chunk->type == TERRAIN_CHUNK_LAND)
+	{
+		glBindTexture(GL_TEXTURE_2D, chunk->normal_map);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8_SNORM, chunk->heightmap_width, chunk->heightmap_height, 0, GL_RGBA, GL_BYTE, NULL);
+	}
+
+	if (!CPU_HEIGHTMAP_GENERATION)
+	{
+		/* The compute shaders always write the whole heightmap anyway */
+		for (int i = 0; i < 2; ++i)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, chunk->readback_buffers[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, chunk->heightmap_size*sizeof(TerrainHeight), NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		BG_FREE(old_chunk.heightmap_buffer);
+		B_update_terrain_chunk(chunk, chunk->center_index);
+		B_finish_terrain_chunk_readback(chunk);
+		return;
+	}
+
+	/* Both chunks are centered on the same block, so the blocks they have in common are just shifted over by
+	 * the difference in their half dimensions. Those are copied over, and only the rest are generated. */
+	int shift = (old_chunk.dimension/2) - (dimension/2);
+	ivec2 *blocks = BG_MALLOC(ivec2, dimension*dimension);
+	ivec2 *new_blocks = BG_MALLOC(ivec2, dimension*dimension);
+	int num_new_blocks = 0;
+	for (int i = 0; i < dimension*dimension; ++i)
+	{
+		int x = i % dimension;
+		int z = i / dimension;
+		blocks[i][0] = x;
+		blocks[i][1] = z;
+		int old_x = x + shift;
+		int old_z = z + shift;
+		if ((old_x < 0) || (old_x >= old_chunk.dimension) || (old_z < 0) || (old_z >= old_chunk.dimension))
+		{
+			new_blocks[num_new_blocks][0] = x;
+			new_blocks[num_new_blocks][1] = z;
+			num_new_blocks++;
+			continue;
+		}
+		TerrainHeight *src = get_terrain_block_buffer(&old_chunk, old_x, old_z);
+		TerrainHeight *dest = get_terrain_block_buffer(chunk, x, z);
+		for (int row = 0; row < chunk->height; ++row)
+		{
+			memcpy(&dest[row*chunk->heightmap_width], &src[row*old_chunk.heightmap_width], chunk->width*sizeof(TerrainHeight));
+		}
+	}
+	BG_FREE(old_chunk.heightmap_buffer);
+
+	/* The new blocks are still zeros here, so the water mask waits for generate_terrain_chunk_blocks to rebuild it */
+	if (chunk->height_pyramid.num_levels)
+	{
+		update_height_pyramid_region(&chunk->height_pyramid, chunk->heightmap_buffer, 0, 0, chunk->heightmap_width, chunk->heightmap_height);
+	}
+	generate_terrain_chunk_blocks(chunk, new_blocks, num_new_blocks);
+	/* The normals weren't copied over, and it's simplest to just redo all of them */
+	if (chunk->normal_buffer != NULL)
+	{
+		generate_terrain_chunk_normals(chunk, blocks, dimension*dimension);
+	}
+	B_upload_terrain_chunk_blocks(chunk, blocks, dimension*dimension);
+	if (chunk->type == TERRAIN_CHUNK_LAND)
+	{
+		get_heightmap_origin(chunk, g_terrain_heightmap_origin);
+	}
+
+	BG_FREE(blocks);
+	BG_FREE(new_blocks);
+}
+
+TerrainChunk create_terrain_chunk(unsigned int g_buffer, int type, unsigned long terrain_index)
+{
+	TerrainChunk chunk = {0};
+
+	chunk.type = type;
+	chunk.dimension = get_terrain_chunk_dimension();
+
+	chunk.width = 64;
+	chunk.height = 64;
+	chunk.terrain_mesh = B_create_terrain_mesh(g_buffer);
+
+	chunk.heightmap_width = chunk.width*chunk.dimension;
+	chunk.heightmap_height = chunk.height*chunk.dimension;
+	if (type == TERRAIN_CHUNK_LAND)
+	{
+		g_terrain_heightmap_width = chunk.heightmap_width;
+		g_terrain_heightmap_height = chunk.heightmap_height;
+		chunk.compute_shader = B_compile_compute_shader("render_progs/land_heightmap_gen_shader.comp");
+		if (!CPU_HEIGHTMAP_GENERATION)
+		{
+			chunk.normal_compute_shader = B_compile_compute_shader("render_progs/terrain_normal_gen_shader.comp");
+			chunk.edit_compute_shader = B_compile_compute_shader("render_progs/terrain_edit_shader.comp");
+			glGenBuffers(1, &chunk.edit_buffer);
+		}
+	}
+	else
+	{
+		chunk.compute_shader = B_compile_compute_shader("render_progs/water_heightmap_gen_shader.comp");
+	}
+	
+	chunk.g_buffer = g_buffer;
+	chunk.heightmap_size = chunk.heightmap_width * chunk.heightmap_height;
+	chunk.heightmap_buffer = BG_MALLOC(TerrainHeight, chunk.heightmap_size);
+	if (type == TERRAIN_CHUNK_LAND)
+	{
+		chunk.height_pyramid = create_height_pyramid(chunk.heightmap_width, chunk.heightmap_height);
+		if (CPU_HEIGHTMAP_GENERATION)
 		{
-			x_offset = -x_max;
-			x_counter = 0;
-			z_offset += MAX_TERRAIN_BLOCKS;
-			z_counter++;
+			chunk.normal_buffer = BG_MALLOC(TerrainNormal, chunk.heightmap_size);
 		}
+	}
 
-		glDispatchCompute(chunk->width/8, chunk->height/8, 1);
-		glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	chunk.tessellation_level = 16.0;
+	chunk.draw_blocks = BG_MALLOC(TerrainDrawBlock, chunk.dimension*chunk.dimension);
+	glGenBuffers(1, &chunk.draw_block_buffer);
+	if (BENCHMARK)
+	{
+		glGenQueries(2, chunk.draw_time_queries);
 	}
-	glBindTexture(GL_TEXTURE_2D, chunk->heightmap);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, chunk->heightmap_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunk.draw_block_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(TerrainDrawBlock)*chunk.dimension*chunk.dimension, NULL, GL_STREAM_DRAW);
+	
+	B_send_terrain_chunk_to_gpu(&chunk);
+	if (USE_MESHED_TERRAIN)
+	{
+		B_create_terrain_lod_meshes(&chunk);
+	}
+
+	chunk.buffer_center_index = terrain_index;
+	B_update_terrain_chunk(&chunk, terrain_index);
+	B_finish_terrain_chunk_readback(&chunk);
+	return chunk;
 }
 
-TerrainChunk create_terrain_chunk(unsigned int g_buffer, int type, unsigned long terrain_index)
+TerrainChunk create_server_terrain_chunk(int type, uint64_t terrain_index)
 {
 	TerrainChunk chunk = {0};
 
 	chunk.type = type;
 	chunk.dimension = get_terrain_chunk_dimension();
 
-	chunk.width = 64;
-	chunk.height = 64;
-	chunk.terrain_mesh = B_create_terrain_mesh(g_buffer);
+	chunk.width = HEIGHTMAP_BLOCK_WIDTH;
+	chunk.height = HEIGHTMAP_BLOCK_WIDTH;
 
 	chunk.heightmap_width = chunk.width*chunk.dimension;
 	chunk.heightmap_height = chunk.height*chunk.dimension;
@@ -131,25 +1088,34 @@ TerrainChunk create_terrain_chunk(unsigned int g_buffer, int type, unsigned long
 	{
 		g_terrain_heightmap_width = chunk.heightmap_width;
 		g_terrain_heightmap_height = chunk.heightmap_height;
-		chunk.compute_shader = B_compile_compute_shader("render_progs/land_heightmap_gen_shader.comp");
-	}
-	else
-	{
-		chunk.compute_shader = B_compile_compute_shader("render_progs/water_heightmap_gen_shader.comp");
 	}
-	
-	chunk.g_buffer = g_buffer;
+
 	chunk.heightmap_size = chunk.heightmap_width * chunk.heightmap_height;
 	chunk.heightmap_buffer = BG_MALLOC(TerrainHeight, chunk.heightmap_size);
+	if (type == TERRAIN_CHUNK_LAND)
+	{
+		chunk.height_pyramid = create_height_pyramid(chunk.heightmap_width, chunk.heightmap_height);
+	}
 
 	chunk.tessellation_level = 16.0;
-	
-	B_send_terrain_chunk_to_gpu(&chunk);
 
-	B_update_terrain_chunk(&chunk, terrain_index);
+	generate_terrain_chunk_heightmap(&chunk, terrain_index);
 	return chunk;
 }
 
+void update_server_terrain_chunk(TerrainChunk *chunk, uint64_t player_block_index)
+{
+	ivec2 *new_blocks = BG_MALLOC(ivec2, chunk->dimension*chunk->dimension);
+	scroll_terrain_chunk_heightmap(chunk, player_block_index, new_blocks);
+	BG_FREE(new_blocks);
+}
+
+void free_server_terrain_chunk(TerrainChunk *chunk)
+{
+	free_height_pyramid(&chunk->height_pyramid);
+	BG_FREE(chunk->heightmap_buffer);
+}
+
 int get_terrain_heightmap_index_from_position(vec2 pos)
 {
 	int heightmap_width = 0;
@@ -179,8 +1145,36 @@ void B_send_terrain_chunk_to_gpu(TerrainChunk *chunk)
 	unsigned int heightmap = 0;
 	glGenTextures(1, &heightmap);
 	glBindTexture(GL_TEXTURE_2D, heightmap);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, chunk->heightmap_width, chunk->heightmap_height, 0, GL_RGBA, GL_FLOAT, NULL);
-	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, chunk->heightmap_width, chunk->heightmap_height, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
+	/* The heightmap is only sampled in the tessellation and geometry stages, where there are no derivatives
+	 * to pick a mip level with, so it doesn't need mipmaps. It does need to repeat, since it's a ring buffer. */
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	/* The normal map has the same layout as the heightmap */
+	if (chunk->type == TERRAIN_CHUNK_LAND)
+	{
+		glGenTextures(1, &chunk->normal_map);
+		glBindTexture(GL_TEXTURE_2D, chunk->normal_map);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8_SNORM, chunk->heightmap_width, chunk->heightmap_height, 0, GL_RGBA, GL_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
+
+	if (!CPU_HEIGHTMAP_GENERATION)
+	{
+		glGenBuffers(2, chunk->readback_buffers);
+		for (int i = 0; i < 2; ++i)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, chunk->readback_buffers[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, chunk->heightmap_size*sizeof(TerrainHeight), NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
 
 	chunk->heightmap = heightmap;
 }
@@ -216,220 +1210,111 @@ TerrainMesh B_create_terrain_mesh(unsigned int g_buffer)
 }
 
 
-void B_draw_water_mesh(TerrainMesh mesh, 
-			B_Shader shader, 
-			mat4 projection_view,
-			uint64_t my_block_index, 
-			uint64_t player_block_index, 
-			float tessellation_level,
-			B_Texture water_heightmap,
-			float terrain_chunk_dimension,
-			int heightmap_width,
-			int heightmap_height,
-			B_Texture land_heightmap,
-			float camera_height)
+static void B_set_frustum_corner_uniforms(B_Shader shader, mat4 projection_view)
 {
-
-	float time = (float)(SDL_GetTicks64()/150.0f);
-	glUseProgram(shader);
-	EnvironmentCondition cond = get_environment_condition(my_block_index);
-	if (cond.precipitation < 0.2)
-	{
-		return;
-	}
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, land_heightmap);
-	B_set_uniform_int(shader, "land_heightmap", 0);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, water_heightmap);
-	B_set_uniform_int(shader, "water_heightmap", 1);
-	B_set_uniform_int(shader, "heightmap_width", heightmap_width);
-	B_set_uniform_int(shader, "heightmap_height", heightmap_height);
-
-	B_set_uniform_mat4(shader, "projection_view_space", projection_view);
-	B_set_uniform_float(shader, "time", time);
-	B_set_uniform_int(shader, "patches_per_column", mesh.num_rows);
-	B_set_uniform_float(shader, "tessellation_level", tessellation_level);
-	B_set_uniform_int(shader, "my_block_index", my_block_index);
-	B_set_uniform_int(shader, "player_block_index", player_block_index);
-	B_set_uniform_float(shader, "xz_scale", TERRAIN_XZ_SCALE);
-	B_set_uniform_float(shader, "height_factor", 22.0f);
-	B_set_uniform_float(shader, "sea_level", SEA_LEVEL);
-	B_set_uniform_float(shader, "camera_height", camera_height);
-	B_set_uniform_float(shader, "terrain_chunk_dimension", terrain_chunk_dimension);
-	B_set_uniform_int(shader, "temperature", cond.temperature);
-
+	vec3 frustum_corners[8];
 	if (USE_ALT_CAMERA)
 	{
 		mat4 alt_proj_view;
 		get_alt_projection_view(alt_proj_view);
-		vec3 frustum_corners[8];
 		get_frustum_corners(alt_proj_view, frustum_corners);
-		for (int i = 0; i < 8; ++i)
-		{
-			char name[128] = {0};
-			snprintf(name, 128, "frustum_corners[%i]", i);
-			B_set_uniform_vec3(shader, name, frustum_corners[i]);
-		}
-
 	}
 	else
 	{
-		vec3 frustum_corners[8];
 		get_frustum_corners(projection_view, frustum_corners);
-		for (int i = 0; i < 8; ++i)
-		{
-			char name[128] = {0};
-			snprintf(name, 128, "frustum_corners[%i]", i);
-			B_set_uniform_vec3(shader, name, frustum_corners[i]);
-		}
 	}
-	
-	glBindVertexArray(mesh.vao);
-	glDrawArrays(GL_PATCHES, 0, mesh.num_vertices);
+	for (int i = 0; i < 8; ++i)
+	{
+		char name[128] = {0};
+		snprintf(name, 128, "frustum_corners[%i]", i);
+		B_set_uniform_vec3(shader, name, frustum_corners[i]);
+	}
 }
 
-void B_draw_terrain_mesh(TerrainMesh mesh, 
-			B_Shader shader, 
-			mat4 projection_view,
-			uint64_t my_block_index, 
-			uint64_t player_block_index, 
-			float tessellation_level, 
-			B_Texture heightmap,
-			float terrain_chunk_dimension,
-			int heightmap_width,
-			int heightmap_height)
+/* Sets everything the water shader needs that's the same for every block in the chunk */
+static void B_set_water_chunk_uniforms(TerrainChunk *chunk, B_Shader shader, mat4 projection_view, B_Texture land_heightmap)
 {
+	float time = (float)(SDL_GetTicks64()/150.0f);
 	glUseProgram(shader);
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, heightmap);
-	EnvironmentCondition cond = get_environment_condition(my_block_index);
-	B_set_uniform_int(shader, "heightmap", 0);
-	B_set_uniform_int(shader, "heightmap_width", heightmap_width);
-	B_set_uniform_int(shader, "heightmap_height", heightmap_height);
-	B_set_uniform_float(shader, "camera_height", get_camera_height());
+	glBindTexture(GL_TEXTURE_2D, land_heightmap);
+	B_set_uniform_int(shader, "land_heightmap", 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, chunk->heightmap);
+	B_set_uniform_int(shader, "water_heightmap", 1);
+	B_set_uniform_int(shader, "heightmap_width", chunk->heightmap_width);
+	B_set_uniform_int(shader, "heightmap_height", chunk->heightmap_height);
+	vec2 heightmap_origin;
+	get_heightmap_origin(chunk, heightmap_origin);
+	vec2 land_heightmap_origin;
+	get_terrain_heightmap_origin(land_heightmap_origin);
+	B_set_uniform_vec2(shader, "heightmap_origin", heightmap_origin);
+	B_set_uniform_vec2(shader, "land_heightmap_origin", land_heightmap_origin);
 
 	B_set_uniform_mat4(shader, "projection_view_space", projection_view);
-	B_set_uniform_int(shader, "patches_per_column", mesh.num_rows);
-	B_set_uniform_float(shader, "tessellation_level", tessellation_level);
-	B_set_uniform_int(shader, "my_block_index", my_block_index);
-	B_set_uniform_int(shader, "player_block_index", player_block_index);
+	B_set_uniform_float(shader, "time", time);
+	B_set_uniform_int(shader, "patches_per_column", chunk->terrain_mesh.num_rows);
+	B_set_uniform_float(shader, "tessellation_level", chunk->tessellation_level);
+	B_set_tessellation_uniforms(shader, 0);
 	B_set_uniform_float(shader, "xz_scale", TERRAIN_XZ_SCALE);
-	B_set_uniform_float(shader, "height_factor", TERRAIN_HEIGHT_FACTOR);
-	B_set_uniform_int(shader, "temperature", cond.temperature);
-	B_set_uniform_float(shader, "precipitation", cond.precipitation);
+	B_set_uniform_float(shader, "height_factor", 22.0f);
+	B_set_uniform_float(shader, "max_height", TERRAIN_MAX_HEIGHT);
 	B_set_uniform_float(shader, "sea_level", SEA_LEVEL);
-	B_set_uniform_float(shader, "terrain_chunk_dimension", (float)terrain_chunk_dimension);
-	B_set_uniform_int(shader, "draw_debug", 0);
-	B_set_uniform_float(shader, "db_grass_patch_max_distance", 0.0f);
-	for (int i = 0; i < 9; ++i)
-	{
-		char name[128] = {0};
-		snprintf(name, 128, "db_grass_patch_centers[%i]", i);
-		B_set_uniform_vec3(shader, name, VEC3_ZERO);
-	}
-
-	if (USE_ALT_CAMERA)
-	{
-		vec3 frustum_corners[8];
-		mat4 alt_proj_view;
-		get_alt_projection_view(alt_proj_view);
-		get_frustum_corners(alt_proj_view, frustum_corners);
-		for (int i = 0; i < 8; ++i)
-		{
-			char name[128] = {0};
-			snprintf(name, 128, "frustum_corners[%i]", i);
-			B_set_uniform_vec3(shader, name, frustum_corners[i]);
-		}
+	B_set_uniform_float(shader, "camera_height", get_camera_height());
+	B_set_uniform_float(shader, "terrain_chunk_dimension", chunk->dimension);
+	B_set_frustum_corner_uniforms(shader, projection_view);
+}
 
-	}
-	else
-	{
-		vec3 frustum_corners[8];
-		get_frustum_corners(projection_view, frustum_corners);
-		for (int i = 0; i < 8; ++i)
-		{
-			char name[128] = {0};
-			snprintf(name, 128, "frustum_corners[%i]", i);
-			B_set_uniform_vec3(shader, name, frustum_corners[i]);
-		}
-	}
-	glBindVertexArray(mesh.vao);
-	glDrawArrays(GL_PATCHES, 0, mesh.num_vertices);
-}
-
-void B_draw_terrain_mesh_debug(TerrainMesh mesh, 
-				B_Shader shader, 
-				mat4 projection_view,
-				uint64_t my_block_index, 
-				uint64_t player_block_index, 
-				float tessellation_level, 
-				B_Texture heightmap,
-				float terrain_chunk_dimension,
-				int heightmap_width,
-				int heightmap_height,
-				vec3 grass_patch_centers[9],
-				float grass_patch_max_distance)
+/* Sets everything the land shader needs that's the same for every block in the chunk. grass_patch_centers
+ * is only used when draw_debug is set. */
+static void B_set_land_chunk_uniforms(TerrainChunk *chunk, 
+				      B_Shader shader, 
+				      mat4 projection_view, 
+				      int draw_debug, 
+				      vec3 grass_patch_centers[9], 
+				      float grass_patch_max_distance)
 {
 	glUseProgram(shader);
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, heightmap);
-	EnvironmentCondition cond = get_environment_condition(my_block_index);
+	glBindTexture(GL_TEXTURE_2D, chunk->heightmap);
 	B_set_uniform_int(shader, "heightmap", 0);
-	B_set_uniform_int(shader, "heightmap_width", heightmap_width);
-	B_set_uniform_int(shader, "heightmap_height", heightmap_height);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, chunk->normal_map);
+	B_set_uniform_int(shader, "normal_map", 2);
+	B_set_uniform_int(shader, "heightmap_width", chunk->heightmap_width);
+	B_set_uniform_int(shader, "heightmap_height", chunk->heightmap_height);
+	vec2 heightmap_origin;
+	get_heightmap_origin(chunk, heightmap_origin);
+	B_set_uniform_vec2(shader, "heightmap_origin", heightmap_origin);
 	B_set_uniform_float(shader, "camera_height", get_camera_height());
 
 	B_set_uniform_mat4(shader, "projection_view_space", projection_view);
-	B_set_uniform_int(shader, "patches_per_column", mesh.num_rows);
-	B_set_uniform_float(shader, "tessellation_level", tessellation_level);
-	B_set_uniform_int(shader, "my_block_index", my_block_index);
-	B_set_uniform_int(shader, "player_block_index", player_block_index);
+	B_set_uniform_int(shader, "patches_per_column", chunk->terrain_mesh.num_rows);
+	B_set_uniform_float(shader, "tessellation_level", chunk->tessellation_level);
+	B_set_tessellation_uniforms(shader, 1);
 	B_set_uniform_float(shader, "xz_scale", TERRAIN_XZ_SCALE);
 	B_set_uniform_float(shader, "height_factor", TERRAIN_HEIGHT_FACTOR);
-	B_set_uniform_int(shader, "temperature", cond.temperature);
-	B_set_uniform_float(shader, "precipitation", cond.precipitation);
+	B_set_uniform_float(shader, "max_height", TERRAIN_MAX_HEIGHT);
 	B_set_uniform_float(shader, "sea_level", SEA_LEVEL);
-	B_set_uniform_float(shader, "terrain_chunk_dimension", (float)terrain_chunk_dimension);
-	B_set_uniform_int(shader, "draw_debug", 1);
+	B_set_uniform_float(shader, "terrain_chunk_dimension", (float)chunk->dimension);
+	B_set_uniform_int(shader, "draw_debug", draw_debug);
 	B_set_uniform_float(shader, "db_grass_patch_max_distance", grass_patch_max_distance);
 	for (int i = 0; i < 9; ++i)
 	{
 		char name[128] = {0};
 		snprintf(name, 128, "db_grass_patch_centers[%i]", i);
-		B_set_uniform_vec3(shader, name, grass_patch_centers[i]);
-	}
-
-	if (USE_ALT_CAMERA)
-	{
-		vec3 frustum_corners[8];
-		mat4 alt_proj_view;
-		get_alt_projection_view(alt_proj_view);
-		get_frustum_corners(alt_proj_view, frustum_corners);
-		for (int i = 0; i < 8; ++i)
+		if (draw_debug)
 		{
-			char name[128] = {0};
-			snprintf(name, 128, "frustum_corners[%i]", i);
-			B_set_uniform_vec3(shader, name, frustum_corners[i]);
+			B_set_uniform_vec3(shader, name, grass_patch_centers[i]);
 		}
-
-	}
-	else
-	{
-		vec3 frustum_corners[8];
-		get_frustum_corners(projection_view, frustum_corners);
-		for (int i = 0; i < 8; ++i)
+		else
 		{
-			char name[128] = {0};
-			snprintf(name, 128, "frustum_corners[%i]", i);
-			B_set_uniform_vec3(shader, name, frustum_corners[i]);
+			B_set_uniform_vec3(shader, name, VEC3_ZERO);
 		}
 	}
-	glBindVertexArray(mesh.vao);
-	glDrawArrays(GL_PATCHES, 0, mesh.num_vertices);
+	B_set_frustum_corner_uniforms(shader, projection_view);
 }
 
 void get_block_corners(vec3 dest[4], int index)
@@ -456,223 +1341,293 @@ void get_block_corners(vec3 dest[4], int index)
 	dest[3][2] = (z_index+1) * (TERRAIN_XZ_SCALE*4) - (TERRAIN_XZ_SCALE*4.0f*half_dimension);
 }
 
-void draw_land_terrain_chunk_debug(TerrainChunk *chunk, 
-				   B_Shader shader, 
-				   mat4 projection_view, 
-				   uint64_t player_block_index, 
-				   vec3 player_facing,
-				   vec3 grass_patch_centers[9],
-				   float grass_patch_max_distance)
+/* Fills chunk->draw_blocks with the blocks that need to be drawn this frame, and returns how many there are. */
+static int get_visible_terrain_blocks(TerrainChunk *chunk, mat4 projection_view, uint64_t player_block_index)
 {
-	int x_max = chunk->dimension/2;
-	int x_offset = -(x_max);
-	int z_offset = -(MAX_TERRAIN_BLOCKS*(x_max));
-	vec3 frustum_corners[8];
+	int half_dimension = chunk->dimension/2;
+	vec4 frustum_planes[6];
 	if (USE_ALT_CAMERA)
 	{
 		mat4 alt_projv;
 		get_alt_projection_view(alt_projv);
-		get_frustum_corners(alt_projv, frustum_corners);
+		glm_frustum_planes(alt_projv, frustum_planes);
 	}
 	else
 	{
-		get_frustum_corners(projection_view, frustum_corners);
+		glm_frustum_planes(projection_view, frustum_planes);
 	}
 
+	int num_blocks = 0;
+	chunk->num_culled_blocks = 0;
 	for (int i = 0; i < chunk->dimension*chunk->dimension; ++i)
 	{
-		uint64_t index = player_block_index + z_offset + x_offset;
-		x_offset++;
-		if (x_offset > x_max)
-		{
-			z_offset += MAX_TERRAIN_BLOCKS;
-			x_offset = -x_max;
-		}
-
-		if (z_offset > MAX_TERRAIN_BLOCKS*x_max)
-		{
-			z_offset = -(MAX_TERRAIN_BLOCKS*(x_max));
-		}
+		int x_offset = (i % chunk->dimension) - half_dimension;
+		int z_offset = (i / chunk->dimension) - half_dimension;
+		uint64_t index = player_block_index + (z_offset*MAX_TERRAIN_BLOCKS) + x_offset;
 
-		/* If all four corners of the block are behind the player, don't draw. */
+		/* The block's bounding box goes from the lowest to the highest point of its heightmap, so if all
+		 * of it is outside of the frustum none of the block can be seen. */
 		vec3 block_corners[4] = {0};
 		get_block_corners(block_corners, i);
-
-		int corner_count = 0;
-		for (int j = 0; j < 4; ++j)
+		vec2 min_xz = { block_corners[0][0], block_corners[0][2] };
+		vec2 max_xz = { block_corners[3][0], block_corners[3][2] };
+		vec2 height_bounds;
+		if (!get_terrain_height_bounds(chunk, min_xz, max_xz, height_bounds))
 		{
-			block_corners[j][1] = get_raw_terrain_height_outside_bounds(block_corners[j], chunk);
-			if (which_side(player_facing, frustum_corners[0], block_corners[j]))
-			{
-				corner_count++;
-			}
+			height_bounds[0] = 0.0f;
+			height_bounds[1] = TERRAIN_MAX_HEIGHT;
 		}
-		if (corner_count >= 4)
+		vec3 bounding_box[2] = { { min_xz[0], height_bounds[0], min_xz[1] }, 
+					 { max_xz[0], height_bounds[1], max_xz[1] } };
+		if (!glm_aabb_frustum(bounding_box, frustum_planes))
 		{
+			chunk->num_culled_blocks++;
 			continue;
 		}
-		
-		if (chunk->type != TERRAIN_CHUNK_LAND)
+
+		/* Water that's all under the land, or in a desert, would never make it through the depth test */
+		if ((chunk->type == TERRAIN_CHUNK_WATER) && !terrain_block_has_water(index))
 		{
-			fprintf(stderr, "B_draw_land_terrain_chunk error: invalid chunk type\n");
-			exit(-1);
+			continue;
 		}
-		B_draw_terrain_mesh_debug(chunk->terrain_mesh,
-					    shader,
-					    projection_view,
-					    index,
-					    player_block_index,
-					    chunk->tessellation_level,
-					    chunk->heightmap,
-					    chunk->dimension,
-					    chunk->heightmap_width,
-					    chunk->heightmap_height,
-					    grass_patch_centers,
-					    grass_patch_max_distance);
 
-	}
+		EnvironmentCondition cond = get_environment_condition(index);
 
+		TerrainDrawBlock *block = &chunk->draw_blocks[num_blocks];
+		block->x_offset = x_offset;
+		block->z_offset = z_offset;
+		block->temperature = cond.temperature;
+		block->precipitation = cond.precipitation;
+		num_blocks++;
+	}
+	return num_blocks;
 }
-void draw_land_terrain_chunk(TerrainChunk *chunk, B_Shader shader, mat4 projection_view, uint64_t player_block_index, vec3 player_facing)
+
+/* Uploads the first num_blocks of chunk->draw_blocks and draws them. The uniforms have to be set already. */
+static void B_draw_terrain_chunk_blocks(TerrainChunk *chunk, B_Shader shader, int num_blocks)
 {
-	int x_max = chunk->dimension/2;
-	int x_offset = -(x_max);
-	int z_offset = -(MAX_TERRAIN_BLOCKS*(x_max));
-	vec3 frustum_corners[8];
-	if (USE_ALT_CAMERA)
+	if (num_blocks <= 0)
 	{
-		mat4 alt_projv;
-		get_alt_projection_view(alt_projv);
-		get_frustum_corners(alt_projv, frustum_corners);
+		return;
 	}
-	else
+	if (USE_MESHED_TERRAIN)
 	{
-		get_frustum_corners(projection_view, frustum_corners);
+		B_draw_terrain_lod_meshes(chunk, shader, num_blocks, g_terrain_camera_position);
+		return;
 	}
 
-	for (int i = 0; i < chunk->dimension*chunk->dimension; ++i)
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunk->draw_block_buffer);
+	/* Orphan last frame's blocks, so this doesn't have to wait on draws that might still be reading them */
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(TerrainDrawBlock)*chunk->dimension*chunk->dimension, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(TerrainDrawBlock)*num_blocks, chunk->draw_blocks);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TERRAIN_DRAW_BLOCK_BINDING, chunk->draw_block_buffer);
+
+	glBindVertexArray(chunk->terrain_mesh.vao);
+	if (USE_INSTANCED_TERRAIN)
+	{
+		B_set_uniform_int(shader, "first_draw_block", 0);
+		glDrawArraysInstanced(GL_PATCHES, 0, chunk->terrain_mesh.num_vertices, num_blocks);
+	}
+	else
 	{
-		uint64_t index = player_block_index + z_offset + x_offset;
-		x_offset++;
-		if (x_offset > x_max)
+		for (int i = 0; i < num_blocks; ++i)
 		{
-			z_offset += MAX_TERRAIN_BLOCKS;
-			x_offset = -x_max;
+			B_set_uniform_int(shader, "first_draw_block", i);
+			glDrawArrays(GL_PATCHES, 0, chunk->terrain_mesh.num_vertices);
 		}
+	}
+}
 
-		if (z_offset > MAX_TERRAIN_BLOCKS*x_max)
-		{
-			z_offset = -(MAX_TERRAIN_BLOCKS*(x_max));
-		}
+/* Drops the land blocks that are hidden behind nearer ridges from the first num_blocks of draw_blocks */
+static int get_unoccluded_land_blocks(TerrainChunk *chunk, int num_blocks)
+{
+	chunk->num_occluded_blocks = 0;
+	if (!USE_HORIZON_CULLING)
+	{
+		return num_blocks;
+	}
+	uint64_t start = SDL_GetPerformanceCounter();
+	int num_unoccluded_blocks = cull_terrain_blocks_behind_horizon(chunk, num_blocks, g_terrain_camera_position);
+	chunk->num_occluded_blocks = num_blocks - num_unoccluded_blocks;
+	if (BENCHMARK)
+	{
+		chunk->horizon_culling_milliseconds = ((SDL_GetPerformanceCounter() - start)*1000.0)/SDL_GetPerformanceFrequency();
+	}
+	return num_unoccluded_blocks;
+}
 
-		/* If all four corners of the block are behind the player, don't draw. */
-		vec3 block_corners[4] = {0};
-		get_block_corners(block_corners, i);
+/* Culls the chunk's blocks into draw_blocks, and remembers what for so get_terrain_draw_blocks can use them */
+static void find_terrain_draw_blocks(TerrainChunk *chunk, mat4 projection_view, uint64_t player_block_index)
+{
+	int num_blocks = get_visible_terrain_blocks(chunk, projection_view, player_block_index);
+	if (chunk->type == TERRAIN_CHUNK_LAND)
+	{
+		num_blocks = get_unoccluded_land_blocks(chunk, num_blocks);
+	}
+	chunk->num_draw_blocks = num_blocks;
+	chunk->draw_blocks_ready = 1;
+	glm_mat4_copy(projection_view, chunk->draw_blocks_projection_view);
+	chunk->draw_blocks_player_index = player_block_index;
+}
+
+/* Returns how many of draw_blocks to draw. update_terrain_tessellation has usually culled them already this frame, and
+ * they're only culled again if it hasn't, or if it was for a different view. */
+static int get_terrain_draw_blocks(TerrainChunk *chunk, mat4 projection_view, uint64_t player_block_index)
+{
+	if (!chunk->draw_blocks_ready || 
+	    (chunk->draw_blocks_player_index != player_block_index) || 
+	    (memcmp(chunk->draw_blocks_projection_view, projection_view, sizeof(mat4)) != 0))
+	{
+		find_terrain_draw_blocks(chunk, projection_view, player_block_index);
+	}
+	chunk->draw_blocks_ready = 0;
+	return chunk->num_draw_blocks;
+}
 
-		int corner_count = 0;
-		for (int j = 0; j < 4; ++j)
+/* Gets the distance from the camera to the middle of every patch of the blocks in draw_blocks, in the order they're
+ * drawn */
+static int get_terrain_patch_distances(TerrainChunk *chunk, vec3 camera_position, float *dest)
+{
+	int patches_per_column = chunk->terrain_mesh.num_rows;
+	float patch_width = TERRAIN_XZ_SCALE;
+	int num_patches = 0;
+	for (int i = 0; i < chunk->num_draw_blocks; ++i)
+	{
+		TerrainDrawBlock *block = &chunk->draw_blocks[i];
+		for (int j = 0; j < patches_per_column*patches_per_column; ++j)
 		{
-			block_corners[j][1] = get_raw_terrain_height_outside_bounds(block_corners[j], chunk);
-			if (which_side(player_facing, frustum_corners[0], block_corners[j]))
+			vec3 center;
+			center[0] = ((block->x_offset*patches_per_column) + (j % patches_per_column) + 0.5f)*patch_width;
+			center[2] = ((block->z_offset*patches_per_column) + (j / patches_per_column) + 0.5f)*patch_width;
+			center[1] = SEA_LEVEL;
+			if (chunk->type == TERRAIN_CHUNK_LAND)
 			{
-				corner_count++;
+				center[1] = get_raw_terrain_height_outside_bounds(center, chunk);
 			}
+			dest[num_patches++] = glm_vec3_distance(center, camera_position);
 		}
-		if (corner_count >= 4)
-		{
-			continue;
-		}
-		
-		if (chunk->type != TERRAIN_CHUNK_LAND)
-		{
-			fprintf(stderr, "B_draw_land_terrain_chunk error: invalid chunk type\n");
-			exit(-1);
-		}
-		B_draw_terrain_mesh(chunk->terrain_mesh,
-					    shader,
-					    projection_view,
-					    index,
-					    player_block_index,
-					    chunk->tessellation_level,
-					    chunk->heightmap,
-					    chunk->dimension,
-					    chunk->heightmap_width,
-					    chunk->heightmap_height);
 	}
-
+	return num_patches;
 }
-void draw_water_terrain_chunk(TerrainChunk *chunk, B_Texture land_heightmap, B_Shader shader, mat4 projection_view, uint64_t player_block_index, vec3 player_facing)
+
+static float get_tessellated_triangle_count(float *distances, int num_patches, float max_level, float scale)
 {
-	int x_max = chunk->dimension/2;
-	int x_offset = -(x_max);
-	int z_offset = -(MAX_TERRAIN_BLOCKS*(x_max));
-	vec3 frustum_corners[8];
-	if (USE_ALT_CAMERA)
-	{
-		mat4 alt_projv;
-		get_alt_projection_view(alt_projv);
-		get_frustum_corners(alt_projv, frustum_corners);
-	}
-	else
+	float num_triangles = 0.0f;
+	for (int i = 0; i < num_patches; ++i)
 	{
-		get_frustum_corners(projection_view, frustum_corners);
+		float level = glm_clamp((TERRAIN_XZ_SCALE*scale)/fmaxf(distances[i], 1.0f), 1.0f, max_level);
+		num_triangles += 2.0f*level*level;
 	}
+	return num_triangles;
+}
 
-	for (int i = 0; i < chunk->dimension*chunk->dimension; ++i)
+void update_terrain_tessellation(TerrainChunk *land_chunk, 
+				 TerrainChunk *water_chunk, 
+				 vec3 camera_position, 
+				 mat4 projection_view, 
+				 uint64_t player_block_index)
+{
+	glm_vec3_copy(camera_position, g_terrain_camera_position);
+	/* Only the blocks that will actually be drawn count against the budget */
+	find_terrain_draw_blocks(land_chunk, projection_view, player_block_index);
+	find_terrain_draw_blocks(water_chunk, projection_view, player_block_index);
+
+	/* How many pixels tall something one unit tall is, one unit from the camera. This has to match the
+	 * projection in camera.c. */
+	int window_width = 0;
+	int window_height = 0;
+	get_window_size(&window_width, &window_height);
+	float pixels_per_unit = ((float)window_height/2.0f)/tanf(RAD(45.0f)/2.0f);
+	float scale = pixels_per_unit/TERRAIN_TESSELLATION_PIXELS;
+
+	int max_patches = land_chunk->dimension*land_chunk->dimension*land_chunk->terrain_mesh.num_rows*land_chunk->terrain_mesh.num_rows;
+	float *land_distances = BG_MALLOC(float, max_patches);
+	float *water_distances = BG_MALLOC(float, max_patches);
+	int num_land_patches = get_terrain_patch_distances(land_chunk, camera_position, land_distances);
+	int num_water_patches = get_terrain_patch_distances(water_chunk, camera_position, water_distances);
+
+	/* If the whole chunk would come to more triangles than the budget, everything is scaled down. Patches that
+	 * are already at the lowest or highest level don't change, so it can take a few tries to get under it. */
+	for (int i = 0; i < 4; ++i)
 	{
-		uint64_t index = player_block_index + z_offset + x_offset;
-		x_offset++;
-		if (x_offset > x_max)
+		float num_triangles = get_tessellated_triangle_count(land_distances, num_land_patches, land_chunk->tessellation_level, scale) +
+				      get_tessellated_triangle_count(water_distances, num_water_patches, water_chunk->tessellation_level, scale);
+		if (num_triangles <= TERRAIN_TRIANGLE_BUDGET)
 		{
-			z_offset += MAX_TERRAIN_BLOCKS;
-			x_offset = -x_max;
-		}
-
-		if (z_offset > MAX_TERRAIN_BLOCKS*x_max)
-		{
-			z_offset = -(MAX_TERRAIN_BLOCKS*(x_max));
+			break;
 		}
+		scale *= sqrtf(TERRAIN_TRIANGLE_BUDGET/num_triangles);
+	}
+	g_terrain_tessellation_scale = scale;
 
-		/* If all four corners of the block are behind the player, don't draw. */
-		vec3 block_corners[4] = {0};
-		get_block_corners(block_corners, i);
+	BG_FREE(land_distances);
+	BG_FREE(water_distances);
+}
 
-		int corner_count = 0;
-		for (int j = 0; j < 4; ++j)
-		{
-			block_corners[j][1] = get_raw_terrain_height_outside_bounds(block_corners[j], chunk);
-			if (which_side(player_facing, frustum_corners[0], block_corners[j]))
-			{
-				corner_count++;
-			}
-		}
-		if (corner_count >= 4)
-		{
-			continue;
-		}
-		
-		if (chunk->type != TERRAIN_CHUNK_WATER)
-		{
-			fprintf(stderr, "B_draw_water_terrain_chunk error: invalid chunk type\n");
-			exit(-1);
-		}
-		B_draw_water_mesh(chunk->terrain_mesh,
-					    shader,
-					    projection_view,
-					    index,
-					    player_block_index,
-					    chunk->tessellation_level,
-					    chunk->heightmap,
-					    chunk->dimension,
-					    chunk->heightmap_width,
-					    chunk->heightmap_height,
-					    land_heightmap,
-					    get_camera_height());
+/* Same as B_draw_terrain_chunk_blocks, but when BENCHMARK is set the draw is timed on the GPU. The two queries take
+ * turns, and the one from the last draw is only read once its result is there, so this never waits for the GPU. */
+static void B_draw_timed_terrain_chunk_blocks(TerrainChunk *chunk, B_Shader shader, int num_blocks)
+{
+	if (!BENCHMARK)
+	{
+		B_draw_terrain_chunk_blocks(chunk, shader, num_blocks);
+		return;
+	}
+	int current = chunk->draw_time_query_index;
+	int last = 1 - current;
+	GLuint64 elapsed = 0;
+	if (B_get_query_elapsed(chunk->draw_time_queries[last], chunk->draw_time_query_issued[last], &elapsed))
+	{
+		chunk->draw_milliseconds = elapsed/1e6;
+		chunk->draw_time_query_issued[last] = 0;
+	}
+	glBeginQuery(GL_TIME_ELAPSED, chunk->draw_time_queries[current]);
+	B_draw_terrain_chunk_blocks(chunk, shader, num_blocks);
+	glEndQuery(GL_TIME_ELAPSED);
+	chunk->draw_time_query_issued[current] = 1;
+	chunk->draw_time_query_index = last;
+}
 
+void draw_land_terrain_chunk_debug(TerrainChunk *chunk, 
+				   B_Shader shader, 
+				   mat4 projection_view, 
+				   uint64_t player_block_index, 
+				   vec3 grass_patch_centers[9],
+				   float grass_patch_max_distance)
+{
+	if (chunk->type != TERRAIN_CHUNK_LAND)
+	{
+		fprintf(stderr, "B_draw_land_terrain_chunk error: invalid chunk type\n");
+		exit(-1);
 	}
+	int num_blocks = get_terrain_draw_blocks(chunk, projection_view, player_block_index);
+	B_set_land_chunk_uniforms(chunk, shader, projection_view, 1, grass_patch_centers, grass_patch_max_distance);
+	B_draw_timed_terrain_chunk_blocks(chunk, shader, num_blocks);
+}
 
+void draw_land_terrain_chunk(TerrainChunk *chunk, B_Shader shader, mat4 projection_view, uint64_t player_block_index)
+{
+	if (chunk->type != TERRAIN_CHUNK_LAND)
+	{
+		fprintf(stderr, "B_draw_land_terrain_chunk error: invalid chunk type\n");
+		exit(-1);
+	}
+	int num_blocks = get_terrain_draw_blocks(chunk, projection_view, player_block_index);
+	B_set_land_chunk_uniforms(chunk, shader, projection_view, 0, NULL, 0.0f);
+	B_draw_timed_terrain_chunk_blocks(chunk, shader, num_blocks);
 }
 
+void draw_water_terrain_chunk(TerrainChunk *chunk, B_Texture land_heightmap, B_Shader shader, mat4 projection_view, uint64_t player_block_index)
+{
+	if (chunk->type != TERRAIN_CHUNK_WATER)
+	{
+		fprintf(stderr, "B_draw_water_terrain_chunk error: invalid chunk type\n");
+		exit(-1);
+	}
+	int num_blocks = get_terrain_draw_blocks(chunk, projection_view, player_block_index);
+	B_set_water_chunk_uniforms(chunk, shader, projection_view, land_heightmap);
+	B_draw_terrain_chunk_blocks(chunk, shader, num_blocks);
+}
 TerrainMesh B_send_terrain_mesh_to_gpu(unsigned int g_buffer, T_Vertex *vertices, int num_vertices, int num_rows)
 {
 	TerrainMesh mesh = {0};
@@ -710,10 +1665,32 @@ void free_terrain_chunk(TerrainChunk *chunk)
 	{
 		B_free_terrain_mesh(chunk->terrain_mesh);
 	}
-	B_Texture textures[2] = { chunk->heightmap, chunk->snow_normal_map };
+	B_Texture textures[2] = { chunk->heightmap, chunk->normal_map };
 	glDeleteTextures(2, textures);
+	if (chunk->readback_fence)
+	{
+		glDeleteSync(chunk->readback_fence);
+	}
+	if (!CPU_HEIGHTMAP_GENERATION)
+	{
+		glDeleteBuffers(2, chunk->readback_buffers);
+	}
+
+	glDeleteBuffers(1, &chunk->draw_block_buffer);
+	if (chunk->edit_buffer)
+	{
+		glDeleteBuffers(1, &chunk->edit_buffer);
+	}
+	if (BENCHMARK)
+	{
+		glDeleteQueries(2, chunk->draw_time_queries);
+	}
+	B_free_terrain_lod_meshes(chunk);
 
+	free_height_pyramid(&chunk->height_pyramid);
+	BG_FREE(chunk->draw_blocks);
 	BG_FREE(chunk->heightmap_buffer);
+	BG_FREE(chunk->normal_buffer);
 }
 
 unsigned int B_compile_compute_shader(const char *comp_path)
@@ -21,6 +21,15 @@
 #include "common.h"
 
 #define TERRAIN_HEIGHT_FACTOR 2500
+/* Heights are stored as a fraction of TERRAIN_MAX_HEIGHT. value and scale are both under 1, so land can't reach it. */
+#define TERRAIN_MAX_HEIGHT 2560.0f
+/* Land that's at least this snowy is raised by TERRAIN_SNOW_HEIGHT */
+#define TERRAIN_SNOW_THRESHOLD 0.355f
+#define TERRAIN_SNOW_HEIGHT 3.0f
+/* Snow slides off land steeper than TERRAIN_SNOW_MAX_SLOPE (rise over run in world units, so 0.8 is about 39 degrees),
+ * losing TERRAIN_SNOW_SLIDE of its snow value for each unit of slope past it */
+#define TERRAIN_SNOW_MAX_SLOPE 0.8f
+#define TERRAIN_SNOW_SLIDE 0.5f
 
 enum TERRAIN_CHUNK_TYPES
 {
@@ -28,14 +37,63 @@ enum TERRAIN_CHUNK_TYPES
 	TERRAIN_CHUNK_LAND,
 };
 
+/* One texel of a heightmap. On the GPU these are GL_RG16 textures, so the shaders read both as 0 to 1.
+ * For land, height is the final height of the ground (snow included) as a fraction of TERRAIN_MAX_HEIGHT, and
+ * snow is the snow value. For water, height and snow hold the value and scale of the waves instead. */
 typedef struct TerrainHeight
 {
-	float		value;
-	float		scale;
-	float		snow;
-	float		padding;
+	uint16_t	height;
+	uint16_t	snow;
 } TerrainHeight;
 
+/* One texel of a land chunk's normal map, which has the same layout as its heightmap. It holds the ground's normal,
+ * and the normal the snow on it is lit with, both octahedral encoded (see pack_terrain_normal). On the GPU it's a
+ * GL_RGBA8_SNORM texture. */
+typedef struct TerrainNormal
+{
+	int8_t		normal[2];
+	int8_t		snow_normal[2];
+} TerrainNormal;
+
+/* Snow is lit as if its slopes were only this steep compared to the ground under it */
+#define TERRAIN_SNOW_NORMAL_FLATNESS 0.015f
+
+/* A rectangle of texels, inclusive, in global texel coordinates (a block's first texel is at
+ * terrain_index%MAX_TERRAIN_BLOCKS * HEIGHTMAP_BLOCK_WIDTH) */
+typedef struct TerrainTexelRect
+{
+	int64_t		min_x;
+	int64_t		min_z;
+	int64_t		max_x;
+	int64_t		max_z;
+} TerrainTexelRect;
+
+/* How many separate edited areas (see terrain_deformation.h) a chunk keeps track of before it starts merging them */
+#define TERRAIN_MAX_DIRTY_RECTS 16
+
+/* The finest level of a HeightPyramid has one cell for every HEIGHT_PYRAMID_CELL_WIDTH x HEIGHT_PYRAMID_CELL_WIDTH texels */
+#define HEIGHT_PYRAMID_CELL_WIDTH 8
+#define MAX_HEIGHT_PYRAMID_LEVELS 16
+
+/* The lowest and highest packed heights (see TerrainHeight) in some area of a heightmap */
+typedef struct HeightBounds
+{
+	uint16_t	min;
+	uint16_t	max;
+} HeightBounds;
+
+/* A min/max mip pyramid over a heightmap, in the heightmap's own (ring buffer) layout. Each level has half the
+ * width and height of the one below it, until the top level is a single cell covering the whole heightmap. */
+typedef struct HeightPyramid
+{
+	int		width;
+	int		height;
+	int		num_levels;
+	int		level_widths[MAX_HEIGHT_PYRAMID_LEVELS];
+	int		level_heights[MAX_HEIGHT_PYRAMID_LEVELS];
+	HeightBounds	*levels[MAX_HEIGHT_PYRAMID_LEVELS];
+} HeightPyramid;
+
 typedef struct TerrainMesh
 {
 	unsigned int	vao;
@@ -49,6 +107,46 @@ typedef struct TerrainMesh
 	int		num_rows;
 } TerrainMesh;
 
+/* What the terrain shaders need to know about one visible block. The heightmap compute shaders use it too, for the
+ * blocks they're generating. This is laid out to match TerrainDrawBlock in the shaders' std430 terrain_draw_blocks
+ * buffer, so don't reorder it. */
+typedef struct TerrainDrawBlock
+{
+	/* How many blocks this one is from the player's, in x and z */
+	int		x_offset;
+	int		z_offset;
+	int		temperature;
+	float		precipitation;
+} TerrainDrawBlock;
+
+/* The shader storage buffer binding the terrain shaders read TerrainDrawBlocks from */
+#define TERRAIN_DRAW_BLOCK_BINDING 0
+/* The binding terrain_edit_shader.comp reads the chunk's TerrainChunkEdits from */
+#define TERRAIN_EDIT_BINDING 1
+
+/* How many levels of detail the meshed terrain (see terrain_mesh.h) has. Level i has a vertex every 1 << i texels. */
+#define TERRAIN_MESH_LOD_LEVELS 4
+
+/* One block's mesh when USE_MESHED_TERRAIN is set. These are kept by where the block is in the heightmap ring buffer,
+ * so a block's mesh stays good until that part of the heightmap is regenerated. */
+typedef struct TerrainMeshBlock
+{
+	/* The level of detail vbo holds, or -1 if it hasn't been meshed yet */
+	int		lod;
+	int		dirty;
+	unsigned int	vao;
+	unsigned int	vbo;
+} TerrainMeshBlock;
+
+typedef struct TerrainLodMeshes
+{
+	/* One for each block of the chunk */
+	TerrainMeshBlock	*blocks;
+	/* Every block at the same level of detail has the same triangles, so they share one index buffer */
+	unsigned int		ebos[TERRAIN_MESH_LOD_LEVELS];
+	int			num_indices[TERRAIN_MESH_LOD_LEVELS];
+} TerrainLodMeshes;
+
 typedef struct TerrainElementMesh
 {
 	unsigned int		vao;
@@ -71,6 +169,11 @@ typedef struct TerrainChunk
 {
 	int		type;
 	TerrainHeight	*heightmap_buffer;
+	/* Only land chunks have one, and only when CPU_HEIGHTMAP_GENERATION is set. Otherwise normal_compute_shader
+	 * writes the normal map straight from the heightmap. */
+	TerrainNormal	*normal_buffer;
+	/* The most a patch is ever tessellated -- at 16, one vertex per heightmap texel. It's also the size of the
+	 * grid get_terrain_height interpolates over. */
 	float		tessellation_level;
 	int		heightmap_width;
 	int		heightmap_height;
@@ -78,13 +181,66 @@ typedef struct TerrainChunk
 	int		height;
 	/* dimension is the width and breadth of the TerrainChunk in terrain_meshes. */
 	int		dimension;
+	/* The heightmap is a ring buffer of blocks, so when the player moves one block over only the new row or
+	 * column has to be generated. center_index is the terrain index the heightmap is currently centered on,
+	 * and (origin_x, origin_z) is the block of the buffer that holds the chunk's top left block. */
+	uint64_t	center_index;
+	int		origin_x;
+	int		origin_z;
+	int		heightmap_generated;
+	/* These are only used when the heightmap is generated on the GPU. It's read back asynchronously into one of
+	 * two pixel buffers, and until readback_fence signals heightmap_buffer still holds the heightmap centered
+	 * on buffer_center_index. (buffer_shift_x, buffer_shift_z) is how many blocks that is away from center_index. */
+	unsigned int	readback_buffers[2];
+	int		current_readback_buffer;
+	GLsync		readback_fence;
+	uint64_t	readback_center_index;
+	uint64_t	buffer_center_index;
+	int		buffer_shift_x;
+	int		buffer_shift_z;
+	int		readback_frames_in_flight;
+	int		last_readback_frames_in_flight;
+	/* How many terrain edits there were when the heightmap was last generated. The ones before that were applied
+	 * by edit_compute_shader, and are already in the readback. */
+	int		readback_num_edits;
 	unsigned int	heightmap_size;
+	/* Only land chunks have one -- water heightmaps don't hold heights. */
+	HeightPyramid	height_pyramid;
+	/* The blocks that passed culling this frame, and the shader storage buffer they're uploaded to */
+	TerrainDrawBlock	*draw_blocks;
+	unsigned int	draw_block_buffer;
+	/* update_terrain_tessellation culls the blocks first, to budget the triangles by. The draw after it, with the
+	 * same projection_view and player block, uses those instead of culling again. */
+	int		num_draw_blocks;
+	int		draw_blocks_ready;
+	mat4		draw_blocks_projection_view;
+	uint64_t	draw_blocks_player_index;
+	/* How many blocks were left out of the last draw because they were outside of the view frustum */
+	int		num_culled_blocks;
+	/* How many of the land blocks in the frustum were left out because they were behind nearer terrain */
+	int		num_occluded_blocks;
+	/* Only measured when BENCHMARK is set: how long the last draw took on the GPU, and how long finding the
+	 * occluded blocks took on the CPU. The GPU time lags a frame behind, so reading it doesn't wait for the draw. */
+	float		draw_milliseconds;
+	float		horizon_culling_milliseconds;
+	unsigned int	draw_time_queries[2];
+	int		draw_time_query_issued[2];
+	int		draw_time_query_index;
+	/* The parts of heightmap_buffer that have been edited since B_upload_terrain_chunk_edits last sent them to the GPU */
+	TerrainTexelRect	dirty_rects[TERRAIN_MAX_DIRTY_RECTS];
+	int		num_dirty_rects;
+	/* Only used when USE_MESHED_TERRAIN is set */
+	TerrainLodMeshes	lod_meshes;
 	TerrainMesh	terrain_mesh;
 	B_Texture 	heightmap;
-	B_Texture	snow_normal_map;
+	/* Land only */
+	B_Texture	normal_map;
 	B_Framebuffer	g_buffer;
 	B_Shader 	compute_shader;
-	B_Shader 	vertex_compute_shader;
+	B_Shader 	normal_compute_shader;
+	/* Land only, and only when the heightmap is generated on the GPU */
+	B_Shader	edit_compute_shader;
+	unsigned int	edit_buffer;
 	//float		*tex_coords[2];
 } TerrainChunk;
 
@@ -123,20 +279,44 @@ void B_send_terrain_mesh_to_gpu_ebo(TerrainMesh *mesh, TerrainVertexData *vertex
  * |-------|-------|-------|
  * */
 TerrainChunk create_terrain_chunk(unsigned int g_buffer, int type, unsigned long terrain_index);
-TerrainChunk create_server_terrain_chunk(void);
+/* The server (and anything else without a GL context) uses these. Only heightmap_buffer is filled in, on the CPU. */
+TerrainChunk create_server_terrain_chunk(int type, uint64_t terrain_index);
+void update_server_terrain_chunk(TerrainChunk *chunk, uint64_t player_block_index);
+void free_server_terrain_chunk(TerrainChunk *chunk);
 TerrainMesh B_create_terrain_mesh(unsigned int g_buffer);
 void free_terrain_chunk(TerrainChunk *block);
 void B_free_terrain_mesh(TerrainMesh mesh);
 void B_send_terrain_chunk_to_gpu(TerrainChunk *block);
 void B_update_terrain_chunk(TerrainChunk *block, uint64_t player_block_index);
+/* Checks whether the heightmap readback started by B_update_terrain_chunk has finished, and if it has, copies it into
+ * heightmap_buffer. This should be called once a frame. B_finish_terrain_chunk_readback waits for it instead. */
+void B_poll_terrain_chunk_readback(TerrainChunk *chunk);
+void B_finish_terrain_chunk_readback(TerrainChunk *chunk);
+/* Changes the chunk's dimension in place. The blocks it already had are kept, only the new ones are generated, and
+ * its shaders, meshes and textures are reused. */
+void B_resize_terrain_chunk(TerrainChunk *chunk, int dimension);
+/* Sends the parts of the chunk that have been edited (see terrain_deformation.h) to the GPU, and brings its height
+ * pyramid, normals, water mask and meshes up to date with them. This should be called once a frame. */
+void B_upload_terrain_chunk_edits(TerrainChunk *chunk);
+/* Generates the blocks of the water chunk that were dry when it was generated, but that the land chunk's water mask
+ * now says can have water (because an edit dug them below TERRAIN_WATER_MAX_LAND_HEIGHT, say). This should be called
+ * once a frame, after B_upload_terrain_chunk_edits. */
+void B_generate_new_terrain_water_blocks(TerrainChunk *water_chunk);
+/* Needs a GL context. Times the GPU heightmap generation with timer queries at a few chunk dimensions, both in one
+ * dispatch and a block at a time, prints the results, and leaves the chunk dimension how it was. */
+void B_benchmark_terrain_chunk_generation(int num_runs);
+/* Needs a GL context. Digs into a chunk and checks that the edits come out the same in the texture after
+ * B_upload_terrain_chunk_edits, in a chunk generated again afterwards, and from terrain_edit_shader.comp as from the
+ * CPU. Prints the results, forgets the edits and returns how many texels didn't match. */
+int B_check_terrain_edits(void);
 unsigned int B_compile_compute_shader(const char *comp_path);
-void draw_land_terrain_chunk(TerrainChunk *block, B_Shader shader, mat4 projection_view, uint64_t player_block_index, vec3 player_facing);
-void draw_water_terrain_chunk(TerrainChunk *block, B_Texture land_heightmap, B_Shader shader, mat4 projection_view, uint64_t player_block_index, vec3 player_facing);
+/* Blocks whose bounding boxes are completely outside of projection_view's frustum aren't drawn. */
+void draw_land_terrain_chunk(TerrainChunk *block, B_Shader shader, mat4 projection_view, uint64_t player_block_index);
+void draw_water_terrain_chunk(TerrainChunk *block, B_Texture land_heightmap, B_Shader shader, mat4 projection_view, uint64_t player_block_index);
 void draw_land_terrain_chunk_debug(TerrainChunk *chunk, 
 				   B_Shader shader, 
 				   mat4 projection_view, 
 				   uint64_t player_block_index, 
-				   vec3 player_facing,
 				   vec3 grass_patch_centers[9],
 				   float grass_patch_max_distance);
 
@@ -144,6 +324,32 @@ void draw_land_terrain_chunk_debug(TerrainChunk *chunk,
  * If it's even, it wil be rounded up to the next odd number. It makes the math a little easier if
  * the terrain chunk has a center tile. */
 int set_terrain_chunk_dimension(int dimension);
+
+/* Converts the raw output of the heightmap generator to and from a TerrainHeight */
+TerrainHeight pack_terrain_height(int type, float value, float scale, float snow);
+float unpack_terrain_height(TerrainHeight height);
+float unpack_terrain_snow(TerrainHeight height);
+/* The octahedral encoding is folded around the y axis, since most terrain normals point up */
+TerrainNormal pack_terrain_normal(vec3 normal, vec3 snow_normal);
+void unpack_terrain_normal(TerrainNormal packed, vec3 normal, vec3 snow_normal);
+
+/* Block and texel coordinates in these are relative to the chunk's top left block, and are wrapped into the ring buffer. */
+unsigned int get_heightmap_buffer_index(TerrainChunk *chunk, int x, int z);
+TerrainHeight *get_terrain_block_buffer(TerrainChunk *chunk, int block_x, int block_z);
+int get_terrain_chunk_block_index(TerrainChunk *chunk, int block_x, int block_z);
+/* The offset of the ring buffer's origin in texture coordinates, for the shaders. */
+void get_heightmap_origin(TerrainChunk *chunk, vec2 dest);
+void get_terrain_heightmap_origin(vec2 dest);
+
+/* Works out how finely the land and water patches are tessellated this frame, from how far they are from the camera.
+ * Each patch edge is split into pieces about TERRAIN_TESSELLATION_PIXELS long on screen (up to one per heightmap
+ * texel, the chunk's tessellation_level), unless the blocks that will be drawn with projection_view come to more
+ * than TERRAIN_TRIANGLE_BUDGET triangles. Call it after the camera moves and before the chunks are drawn. */
+void update_terrain_tessellation(TerrainChunk *land_chunk, 
+				 TerrainChunk *water_chunk, 
+				 vec3 camera_position, 
+				 mat4 projection_view, 
+				 uint64_t player_block_index);
 int get_terrain_chunk_dimension(void);
 void get_terrain_heightmap_size(int *w, int *h);
 TerrainMesh load_terrain_mesh_from_file(B_Framebuffer g_buffer, const char *filename);
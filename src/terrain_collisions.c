@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include "utils.h"
 #include "terrain_collisions.h"
+#include "height_pyramid.h"
 
 vec3 g_interpolation_samples[4] = {0};
 
@@ -44,17 +45,12 @@ int get_pixel_index_from_position(vec3 pos, TerrainChunk *terrain_chunk)
 	pixel_x += section_heightmap_width*offset;
 	pixel_z += section_heightmap_height*offset;
 
-	return (pixel_z * total_heightmap_width) + pixel_x;
+	return get_heightmap_buffer_index(terrain_chunk, pixel_x, pixel_z);
 }
 
 float get_height_from_pixel_index(unsigned int index, TerrainChunk *terrain_chunk)
 {
-	float final_height = terrain_chunk->heightmap_buffer[index].value * (terrain_chunk->heightmap_buffer[index].scale*TERRAIN_HEIGHT_FACTOR);
-	if (terrain_chunk->heightmap_buffer[index].snow >= 0.36)
-	{
-		final_height += 2.5;
-	}
-	return final_height;
+	return unpack_terrain_height(terrain_chunk->heightmap_buffer[index]);
 }
 
 float get_raw_terrain_height_outside_bounds(vec3 pos, TerrainChunk *terrain_chunk)
@@ -74,18 +70,85 @@ float get_raw_terrain_height_outside_bounds(vec3 pos, TerrainChunk *terrain_chun
 
 	unsigned int index = (pixel_z * total_heightmap_width) + pixel_x;
 
-	if (index > terrain_chunk->heightmap_size)
+	if (index >= terrain_chunk->heightmap_size)
 	{
 		fprintf(stderr, "get_raw_terrain_height_outside_bounds error: Trying to access index %u from buffer of size %u.\n", index, terrain_chunk->heightmap_size);
 		exit(-1);
 	}
+	index = get_heightmap_buffer_index(terrain_chunk, pixel_x, pixel_z);
+
+	return unpack_terrain_height(terrain_chunk->heightmap_buffer[index]);
+}
 
-	float final_height = terrain_chunk->heightmap_buffer[index].value * (terrain_chunk->heightmap_buffer[index].scale*TERRAIN_HEIGHT_FACTOR);
-	if (terrain_chunk->heightmap_buffer[index].snow >= 0.36)
+/* Splits the texels min to max (inclusive) along one axis of the chunk into at most two ranges of the ring buffer. */
+static int get_heightmap_buffer_ranges(int min, int max, int offset, int width, int ranges[2][2])
+{
+	int start = (min + offset) % width;
+	int end = start + (max - min);
+	ranges[0][0] = start;
+	if (end < width)
 	{
-		final_height += 2.5;
+		ranges[0][1] = end;
+		return 1;
 	}
-	return final_height;
+	ranges[0][1] = width - 1;
+	ranges[1][0] = 0;
+	ranges[1][1] = end - width;
+	return 2;
+}
+
+int get_terrain_height_bounds(TerrainChunk *terrain_chunk, vec2 min_xz, vec2 max_xz, vec2 dest)
+{
+	if (terrain_chunk->type == TERRAIN_CHUNK_WATER)
+	{
+		/* Water has no pyramid. It's drawn at sea level, and the waves never move it more than half of the
+		 * water shader's height_factor up or down. */
+		dest[0] = SEA_LEVEL - 11.0f;
+		dest[1] = SEA_LEVEL + 11.0f;
+		return 1;
+	}
+
+	int half_dimension = terrain_chunk->dimension/2;
+	float chunk_width = (TERRAIN_XZ_SCALE*4) * terrain_chunk->dimension;
+	float chunk_min = -(TERRAIN_XZ_SCALE*4) * half_dimension;
+
+	/* The ground between two texels is interpolated, so the texels on either side of the rectangle count too. */
+	int min_x = floor(percent(chunk_min, chunk_min + chunk_width, min_xz[0]) * terrain_chunk->heightmap_width);
+	int min_z = floor(percent(chunk_min, chunk_min + chunk_width, min_xz[1]) * terrain_chunk->heightmap_height);
+	int max_x = ceil(percent(chunk_min, chunk_min + chunk_width, max_xz[0]) * terrain_chunk->heightmap_width);
+	int max_z = ceil(percent(chunk_min, chunk_min + chunk_width, max_xz[1]) * terrain_chunk->heightmap_height);
+	min_x = maxi(min_x, 0);
+	min_z = maxi(min_z, 0);
+	max_x = mini(max_x, terrain_chunk->heightmap_width - 1);
+	max_z = mini(max_z, terrain_chunk->heightmap_height - 1);
+	if ((min_x > max_x) || (min_z > max_z))
+	{
+		return 0;
+	}
+
+	unsigned int origin = get_heightmap_buffer_index(terrain_chunk, 0, 0);
+	int x_ranges[2][2];
+	int z_ranges[2][2];
+	int num_x_ranges = get_heightmap_buffer_ranges(min_x, max_x, origin % terrain_chunk->heightmap_width, terrain_chunk->heightmap_width, x_ranges);
+	int num_z_ranges = get_heightmap_buffer_ranges(min_z, max_z, origin / terrain_chunk->heightmap_width, terrain_chunk->heightmap_height, z_ranges);
+
+	HeightBounds bounds = { UINT16_MAX, 0 };
+	for (int z = 0; z < num_z_ranges; ++z)
+	{
+		for (int x = 0; x < num_x_ranges; ++x)
+		{
+			get_height_pyramid_bounds(&terrain_chunk->height_pyramid,
+						  terrain_chunk->heightmap_buffer,
+						  x_ranges[x][0],
+						  z_ranges[z][0],
+						  x_ranges[x][1],
+						  z_ranges[z][1],
+						  &bounds);
+		}
+	}
+	dest[0] = unpack_terrain_height((TerrainHeight){ bounds.min, 0 });
+	dest[1] = unpack_terrain_height((TerrainHeight){ bounds.max, 0 });
+	return 1;
 }
 
 float get_raw_terrain_height(vec3 pos, TerrainChunk *terrain_chunk)
@@ -109,18 +172,14 @@ float get_raw_terrain_height(vec3 pos, TerrainChunk *terrain_chunk)
 
 	unsigned int index = (pixel_z * total_heightmap_width) + pixel_x;
 
-	if (index > terrain_chunk->heightmap_size)
+	if (index >= terrain_chunk->heightmap_size)
 	{
 		fprintf(stderr, "get_raw_terrain_height error: Trying to access index %u from buffer of size %u.\n", index, terrain_chunk->heightmap_size);
 		exit(-1);
 	}
+	index = get_heightmap_buffer_index(terrain_chunk, pixel_x, pixel_z);
 
-	float final_height = terrain_chunk->heightmap_buffer[index].value * (terrain_chunk->heightmap_buffer[index].scale*TERRAIN_HEIGHT_FACTOR);
-	if (terrain_chunk->heightmap_buffer[index].snow >= 0.36)
-	{
-		final_height += 2.5;
-	}
-	return final_height;
+	return unpack_terrain_height(terrain_chunk->heightmap_buffer[index]);
 }
 
 
@@ -129,32 +188,6 @@ void snap_to_ground(vec3 pos, TerrainChunk *terrain_chunk)
 	pos[1] = get_terrain_height(pos, terrain_chunk);
 }
 
-void get_four_nearest_heights(vec3 pos, TerrainChunk *terrain_chunk, vec4 dest)
-{
-	float grid_square_width = TERRAIN_XZ_SCALE / terrain_chunk->tessellation_level;
-	float grid_square_height = TERRAIN_XZ_SCALE / terrain_chunk->tessellation_level;
-
-	vec3 height0;
-	vec3 height1;
-	vec3 height2;
-	vec3 height3;
-
-	float grid_x_min = (pos[0] - fmodf(pos[0], grid_square_width));
-	float grid_z_min = (pos[2] - fmodf(pos[2], grid_square_height));
-	float grid_x_max = grid_x_min + grid_square_width;
-	float grid_z_max = grid_z_min + grid_square_height;
-
-	glm_vec3_copy(VEC3(grid_x_min, 0, grid_z_min), height0);
-	glm_vec3_copy(VEC3(grid_x_min, 0, grid_z_max), height1);
-	glm_vec3_copy(VEC3(grid_x_max, 0, grid_z_min), height2);
-	glm_vec3_copy(VEC3(grid_x_max, 0, grid_z_max), height3);
-
-	dest[0] = get_raw_terrain_height(height0, terrain_chunk);
-	dest[1] = get_raw_terrain_height(height1, terrain_chunk);
-	dest[2] = get_raw_terrain_height(height2, terrain_chunk);
-	dest[3] = get_raw_terrain_height(height3, terrain_chunk);
-}
-
 float barrycentrically_interpolate(vec3 p1, vec3 p2, vec3 p3, vec3 pos)
 {
 		float det = (p2[2] - p3[2]) * (p1[0] - p3[0]) + (p3[0] - p2[0]) * (p1[2] - p3[2]);
@@ -166,44 +199,115 @@ float barrycentrically_interpolate(vec3 p1, vec3 p2, vec3 p3, vec3 pos)
 }
 
 
-float get_terrain_height(vec3 pos, TerrainChunk *terrain_chunk)
+/* get_terrain_heights works on four positions at a time */
+typedef float v4f __attribute__((vector_size(16)));
+typedef int v4i __attribute__((vector_size(16)));
+
+/* Rounds halfway cases away from zero, like round() */
+static inline v4i round_v4f(v4f x)
+{
+	v4i half = (v4i)((v4f){0.5f, 0.5f, 0.5f, 0.5f});
+	half |= (v4i)x & INT32_MIN;
+	return __builtin_convertvector(x + (v4f)half, v4i);
+}
+
+/* Same as get_raw_terrain_height, for the corner of the grid square each lane is in */
+static inline v4f get_raw_terrain_heights(TerrainChunk *terrain_chunk, v4f x, v4f z, v4i offset_x, v4i offset_z)
 {
-	vec4 heights;
-	get_four_nearest_heights(pos, terrain_chunk, heights);
+	int width = terrain_chunk->heightmap_width;
+	int height = terrain_chunk->heightmap_height;
+	v4f pixels_per_unit = (v4f){0} + ((float)terrain_chunk->width/(TERRAIN_XZ_SCALE*4));
+	int half_dimension = terrain_chunk->dimension/2;
+	v4i pixel_x = round_v4f(x*pixels_per_unit) + (terrain_chunk->width*half_dimension);
+	v4i pixel_z = round_v4f(z*pixels_per_unit) + (terrain_chunk->height*half_dimension);
+
+	v4i index = (pixel_z*width) + pixel_x;
+	for (int lane = 0; lane < 4; ++lane)
+	{
+		if ((index[lane] < 0) || ((unsigned int)index[lane] >= terrain_chunk->heightmap_size))
+		{
+			fprintf(stderr, "get_terrain_heights error: Trying to access index %i from buffer of size %u.\n", index[lane], terrain_chunk->heightmap_size);
+			exit(-1);
+		}
+	}
 
+	/* Same wrapping as get_heightmap_buffer_index */
+	pixel_x += offset_x;
+	pixel_z += offset_z;
+	pixel_x -= (pixel_x >= width) & width;
+	pixel_z -= (pixel_z >= height) & height;
+	pixel_x += (pixel_x < 0) & width;
+	pixel_z += (pixel_z < 0) & height;
+	index = (pixel_z*width) + pixel_x;
+
+	v4f heights;
+	for (int lane = 0; lane < 4; ++lane)
+	{
+		heights[lane] = terrain_chunk->heightmap_buffer[index[lane]].height;
+	}
+	return heights * (TERRAIN_MAX_HEIGHT/UINT16_MAX);
+}
+
+void get_terrain_heights(vec3 *positions, float *out, size_t n, TerrainChunk *terrain_chunk)
+{
 	float grid_square_width = TERRAIN_XZ_SCALE / terrain_chunk->tessellation_level;
-	float grid_square_height = TERRAIN_XZ_SCALE / terrain_chunk->tessellation_level;
-
-	vec3 q00;
-	vec3 q10;
-	vec3 q11;
-	vec3 q01;
-
-	float grid_x_min = pos[0] - fmod(pos[0], grid_square_width);
-	float grid_z_min = pos[2] - fmod(pos[2], grid_square_height);
-	
-	float grid_x_max = grid_x_min + grid_square_width;
-	float grid_z_max = grid_z_min + grid_square_height;
-
-	glm_vec3_copy(VEC3(0, heights[0], 0), q00);
-	glm_vec3_copy(VEC3(0, heights[1], 1), q01);
-	glm_vec3_copy(VEC3(1, heights[2], 0), q10);
-	glm_vec3_copy(VEC3(1, heights[3], 1), q11);
-
-	float player_grid_square_x = percent(grid_x_min, grid_x_max, pos[0]);
-	float player_grid_square_z = percent(grid_z_min, grid_z_max, pos[2]);
-
-        return bilinearly_interpolate_float(0, 1,
-                                            0, 1,
-                                            q00[1], q01[1],
-                                            q10[1], q11[1],
-                                            player_grid_square_x,
-                                            player_grid_square_z);
+	v4f inverse_grid_square_width = (v4f){0} + (1.0f/grid_square_width);
+
+	unsigned int origin = get_heightmap_buffer_index(terrain_chunk, 0, 0);
+	v4i offset_x = (v4i){0} + (int)(origin % terrain_chunk->heightmap_width);
+	v4i offset_z = (v4i){0} + (int)(origin / terrain_chunk->heightmap_width);
+
+	for (size_t i = 0; i < n; i += 4)
+	{
+		/* The last few positions are padded out with copies of the last one */
+		v4f x;
+		v4f z;
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			size_t j = i + lane;
+			if (j >= n)
+			{
+				j = n - 1;
+			}
+			x[lane] = positions[j][0];
+			z[lane] = positions[j][2];
+		}
+
+		/* The grid squares are the same size as the ones the terrain is tessellated into, and like fmod, these
+		 * round toward zero. */
+		v4f grid_x_min = __builtin_convertvector(__builtin_convertvector(x*inverse_grid_square_width, v4i), v4f) * grid_square_width;
+		v4f grid_z_min = __builtin_convertvector(__builtin_convertvector(z*inverse_grid_square_width, v4i), v4f) * grid_square_width;
+		v4f grid_x_max = grid_x_min + grid_square_width;
+		v4f grid_z_max = grid_z_min + grid_square_width;
+
+		v4f q00 = get_raw_terrain_heights(terrain_chunk, grid_x_min, grid_z_min, offset_x, offset_z);
+		v4f q01 = get_raw_terrain_heights(terrain_chunk, grid_x_min, grid_z_max, offset_x, offset_z);
+		v4f q10 = get_raw_terrain_heights(terrain_chunk, grid_x_max, grid_z_min, offset_x, offset_z);
+		v4f q11 = get_raw_terrain_heights(terrain_chunk, grid_x_max, grid_z_max, offset_x, offset_z);
+
+		v4f t_x = (x - grid_x_min)*inverse_grid_square_width;
+		v4f t_z = (z - grid_z_min)*inverse_grid_square_width;
+		v4f r0 = q00 + ((q10 - q00)*t_x);
+		v4f r1 = q01 + ((q11 - q01)*t_x);
+		v4f result = r0 + ((r1 - r0)*t_z);
+
+		for (int lane = 0; (lane < 4) && (i + lane < n); ++lane)
+		{
+			out[i + lane] = result[lane];
+		}
+	}
+}
+
+float get_terrain_height(vec3 pos, TerrainChunk *terrain_chunk)
+{
+	float height;
+	get_terrain_heights((vec3 *)pos, &height, 1, terrain_chunk);
+	return height;
 }
 
-void update_actor_gravity(ActorState *actor_state, float actor_height, TerrainChunk *terrain_chunk, float delta_t)
+void update_actor_gravity(ActorState *actor_state, float actor_height, float terrain_height, float delta_t)
 {
-	float height = get_terrain_height(actor_state->position, terrain_chunk) + (actor_height/2.0f);
+	float height = terrain_height + (actor_height/2.0f);
 	if (actor_state->position[1] > height)
 	{
 		actor_state->position[1] -= 0.08 * delta_t;
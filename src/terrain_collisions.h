@@ -5,12 +5,22 @@
 #include "terrain.h"
 float get_terrain_height(vec3 pos, TerrainChunk *block);
 
+/* Same as get_terrain_height for each of the n positions, four at a time. Anything that needs more than one
+ * height a frame should gather its positions and use this. */
+void get_terrain_heights(vec3 *positions, float *out, size_t n, TerrainChunk *terrain_chunk);
+
 /* Gets the height, but doesn't interpoate between the values on the heightmap -- mostly needed as a
  * utility for get_terrain_height */
 float get_raw_terrain_height(vec3 pos, TerrainChunk *terrain_chunk);
-void update_actor_gravity(ActorState *actor_state, float actor_height, TerrainChunk *terrain_chunk, float delta_t);
+/* terrain_height is the height of the ground under the actor, from get_terrain_heights */
+void update_actor_gravity(ActorState *actor_state, float actor_height, float terrain_height, float delta_t);
 void snap_to_ground(vec3 pos, TerrainChunk *terrain_chunk);
 float get_raw_terrain_height_outside_bounds(vec3 pos, TerrainChunk *terrain_chunk);
+
+/* Gets the lowest (dest[0]) and highest (dest[1]) the ground gets anywhere in the rectangle from min_xz to max_xz,
+ * in the same coordinates as get_raw_terrain_height_outside_bounds. This uses the chunk's height pyramid, so it's
+ * cheap even for large rectangles. Returns 0 if the rectangle is entirely outside the chunk. */
+int get_terrain_height_bounds(TerrainChunk *terrain_chunk, vec2 min_xz, vec2 max_xz, vec2 dest);
 void get_current_interpolation_samples(vec3 interpolation_samples[4]);
 
 #endif
@@ -0,0 +1,434 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "heightmap_generation.h"
+#include "terrain_deformation.h"
+#include "utils.h"
+
+TerrainEdit *g_terrain_edits = NULL;
+int g_num_terrain_edits = 0;
+int g_max_terrain_edits = 0;
+
+/* Which edits touch each land block, so generating a block only goes through the edits made on it instead of the
+ * whole log. It's an open addressing hash table on the block's terrain index, and slots with no edits are empty. */
+typedef struct TerrainEditBlock
+{
+	uint64_t	terrain_index;
+	/* Indices into g_terrain_edits, in the order the edits were made */
+	int		*edits;
+	int		num_edits;
+	int		max_edits;
+} TerrainEditBlock;
+
+TerrainEditBlock *g_terrain_edit_blocks = NULL;
+int g_num_terrain_edit_blocks = 0;
+/* Always a power of 2 */
+int g_max_terrain_edit_blocks = 0;
+
+static uint16_t quantize_terrain_height(float height)
+{
+	float f = height/TERRAIN_MAX_HEIGHT;
+	if (f <= 0.0f)
+	{
+		return 0;
+	}
+	if (f >= 1.0f)
+	{
+		return UINT16_MAX;
+	}
+	return (uint16_t)((f * UINT16_MAX) + 0.5f);
+}
+
+static TerrainTexelRect get_terrain_edit_rect(TerrainEdit *edit)
+{
+	TerrainTexelRect rect;
+	rect.min_x = (int64_t)floor(edit->center_x - edit->radius);
+	rect.min_z = (int64_t)floor(edit->center_z - edit->radius);
+	rect.max_x = (int64_t)ceil(edit->center_x + edit->radius);
+	rect.max_z = (int64_t)ceil(edit->center_z + edit->radius);
+	return rect;
+}
+
+/* Applies the edit to the width*height texels of dest, whose first one is at (first_x, first_z) */
+static void apply_terrain_edit(TerrainEdit *edit, int64_t first_x, int64_t first_z, int width, int height, TerrainHeight *dest, int stride)
+{
+	TerrainTexelRect rect = get_terrain_edit_rect(edit);
+	int64_t min_x = (rect.min_x > first_x) ? rect.min_x : first_x;
+	int64_t min_z = (rect.min_z > first_z) ? rect.min_z : first_z;
+	int64_t max_x = (rect.max_x < first_x + width - 1) ? rect.max_x : first_x + width - 1;
+	int64_t max_z = (rect.max_z < first_z + height - 1) ? rect.max_z : first_z + height - 1;
+	for (int64_t z = min_z; z <= max_z; ++z)
+	{
+		TerrainHeight *row = &dest[(z - first_z)*stride];
+		for (int64_t x = min_x; x <= max_x; ++x)
+		{
+			float dx = (float)((double)x - edit->center_x);
+			float dz = (float)((double)z - edit->center_z);
+			float distance_squared = ((dx*dx) + (dz*dz))/(edit->radius*edit->radius);
+			if (distance_squared >= 1.0f)
+			{
+				continue;
+			}
+			float falloff = (1.0f - distance_squared)*(1.0f - distance_squared);
+			TerrainHeight *texel = &row[x - first_x];
+			texel->height = quantize_terrain_height(unpack_terrain_height(*texel) - (edit->depth*falloff));
+		}
+	}
+}
+
+static int terrain_texel_rects_overlap(TerrainTexelRect *a, TerrainTexelRect *b)
+{
+	return (a->min_x <= b->max_x) && (b->min_x <= a->max_x) && (a->min_z <= b->max_z) && (b->min_z <= a->max_z);
+}
+
+static void merge_terrain_texel_rect(TerrainTexelRect *dest, TerrainTexelRect *rect)
+{
+	dest->min_x = (rect->min_x < dest->min_x) ? rect->min_x : dest->min_x;
+	dest->min_z = (rect->min_z < dest->min_z) ? rect->min_z : dest->min_z;
+	dest->max_x = (rect->max_x > dest->max_x) ? rect->max_x : dest->max_x;
+	dest->max_z = (rect->max_z > dest->max_z) ? rect->max_z : dest->max_z;
+}
+
+/* Overlapping rectangles are merged, so the same texels aren't uploaded twice. Once the chunk has all the
+ * rectangles it can keep track of, the rest are merged into the last one. */
+static void add_terrain_dirty_rect(TerrainChunk *chunk, TerrainTexelRect rect)
+{
+	for (int i = 0; i < chunk->num_dirty_rects; ++i)
+	{
+		if (terrain_texel_rects_overlap(&chunk->dirty_rects[i], &rect))
+		{
+			merge_terrain_texel_rect(&chunk->dirty_rects[i], &rect);
+			return;
+		}
+	}
+	if (chunk->num_dirty_rects == TERRAIN_MAX_DIRTY_RECTS)
+	{
+		merge_terrain_texel_rect(&chunk->dirty_rects[TERRAIN_MAX_DIRTY_RECTS-1], &rect);
+		return;
+	}
+	chunk->dirty_rects[chunk->num_dirty_rects++] = rect;
+}
+
+void get_terrain_chunk_first_texel(TerrainChunk *chunk, int64_t *x, int64_t *z)
+{
+	int half_dimension = chunk->dimension/2;
+	*x = ((int64_t)(chunk->center_index % MAX_TERRAIN_BLOCKS) - half_dimension) * chunk->width;
+	*z = ((int64_t)(chunk->center_index / MAX_TERRAIN_BLOCKS) - half_dimension) * chunk->height;
+}
+
+/* The ring buffer only wraps between blocks, so the edit is applied a block at a time */
+static void apply_terrain_edit_to_chunk(TerrainChunk *chunk, TerrainEdit *edit)
+{
+	int64_t first_x = 0;
+	int64_t first_z = 0;
+	get_terrain_chunk_first_texel(chunk, &first_x, &first_z);
+	TerrainTexelRect rect = get_terrain_edit_rect(edit);
+	int touched_chunk = 0;
+	for (int block_z = 0; block_z < chunk->dimension; ++block_z)
+	{
+		for (int block_x = 0; block_x < chunk->dimension; ++block_x)
+		{
+			TerrainTexelRect block_rect = { first_x + (block_x*chunk->width),
+							first_z + (block_z*chunk->height),
+							first_x + ((block_x+1)*chunk->width) - 1,
+							first_z + ((block_z+1)*chunk->height) - 1 };
+			if (!terrain_texel_rects_overlap(&rect, &block_rect))
+			{
+				continue;
+			}
+			apply_terrain_edit(edit, 
+					   block_rect.min_x, 
+					   block_rect.min_z, 
+					   chunk->width, 
+					   chunk->height, 
+					   get_terrain_block_buffer(chunk, block_x, block_z), 
+					   chunk->heightmap_width);
+			touched_chunk = 1;
+		}
+	}
+	if (touched_chunk)
+	{
+		add_terrain_dirty_rect(chunk, rect);
+	}
+}
+
+static int get_terrain_edit_block_slot(uint64_t terrain_index)
+{
+	/* Fibonacci hashing, since neighbouring blocks have neighbouring indices */
+	return (int)((terrain_index * 11400714819323198485ull) >> 40) & (g_max_terrain_edit_blocks - 1);
+}
+
+static TerrainEditBlock *find_terrain_edit_block(uint64_t terrain_index)
+{
+	if (g_num_terrain_edit_blocks == 0)
+	{
+		return NULL;
+	}
+	for (int i = get_terrain_edit_block_slot(terrain_index); ; i = (i + 1) & (g_max_terrain_edit_blocks - 1))
+	{
+		TerrainEditBlock *block = &g_terrain_edit_blocks[i];
+		if (block->edits == NULL)
+		{
+			return NULL;
+		}
+		if (block->terrain_index == terrain_index)
+		{
+			return block;
+		}
+	}
+}
+
+static TerrainEditBlock *add_terrain_edit_block(uint64_t terrain_index)
+{
+	/* Kept at most half full, so the probes stay short */
+	if ((g_num_terrain_edit_blocks+1)*2 > g_max_terrain_edit_blocks)
+	{
+		TerrainEditBlock *old_blocks = g_terrain_edit_blocks;
+		int old_max = g_max_terrain_edit_blocks;
+		g_max_terrain_edit_blocks = (old_max == 0) ? 64 : old_max*2;
+		g_terrain_edit_blocks = BG_MALLOC(TerrainEditBlock, g_max_terrain_edit_blocks);
+		for (int i = 0; i < old_max; ++i)
+		{
+			if (old_blocks[i].edits == NULL)
+			{
+				continue;
+			}
+			int slot = get_terrain_edit_block_slot(old_blocks[i].terrain_index);
+			while (g_terrain_edit_blocks[slot].edits != NULL)
+			{
+				slot = (slot + 1) & (g_max_terrain_edit_blocks - 1);
+			}
+			g_terrain_edit_blocks[slot] = old_blocks[i];
+		}
+		BG_FREE(old_blocks);
+	}
+
+	int slot = get_terrain_edit_block_slot(terrain_index);
+	while (g_terrain_edit_blocks[slot].edits != NULL)
+	{
+		slot = (slot + 1) & (g_max_terrain_edit_blocks - 1);
+	}
+	TerrainEditBlock *block = &g_terrain_edit_blocks[slot];
+	block->terrain_index = terrain_index;
+	block->max_edits = 4;
+	block->edits = BG_MALLOC(int, block->max_edits);
+	++g_num_terrain_edit_blocks;
+	return block;
+}
+
+/* The block a global texel coordinate is in. Edits right at the edge of the world can reach past it. */
+static int64_t get_terrain_edit_block_coordinate(int64_t texel)
+{
+	if (texel < 0)
+	{
+		return 0;
+	}
+	int64_t block = texel/HEIGHTMAP_BLOCK_WIDTH;
+	return (block < (int64_t)MAX_TERRAIN_BLOCKS) ? block : (int64_t)MAX_TERRAIN_BLOCKS - 1;
+}
+
+/* Adds the edit to every land block it touches */
+static void index_terrain_edit(int edit_index)
+{
+	TerrainTexelRect rect = get_terrain_edit_rect(&g_terrain_edits[edit_index]);
+	int64_t min_block_x = get_terrain_edit_block_coordinate(rect.min_x);
+	int64_t min_block_z = get_terrain_edit_block_coordinate(rect.min_z);
+	int64_t max_block_x = get_terrain_edit_block_coordinate(rect.max_x);
+	int64_t max_block_z = get_terrain_edit_block_coordinate(rect.max_z);
+	for (int64_t block_z = min_block_z; block_z <= max_block_z; ++block_z)
+	{
+		for (int64_t block_x = min_block_x; block_x <= max_block_x; ++block_x)
+		{
+			uint64_t terrain_index = ((uint64_t)block_z*MAX_TERRAIN_BLOCKS) + (uint64_t)block_x;
+			TerrainEditBlock *block = find_terrain_edit_block(terrain_index);
+			if (block == NULL)
+			{
+				block = add_terrain_edit_block(terrain_index);
+			}
+			if (block->num_edits == block->max_edits)
+			{
+				block->max_edits *= 2;
+				int *edits = BG_MALLOC(int, block->max_edits);
+				memcpy(edits, block->edits, block->num_edits*sizeof(int));
+				BG_FREE(block->edits);
+				block->edits = edits;
+			}
+			block->edits[block->num_edits++] = edit_index;
+		}
+	}
+}
+
+void deform_terrain(TerrainChunk *land_chunk, vec3 position, float radius, float depth)
+{
+	if (land_chunk->type != TERRAIN_CHUNK_LAND)
+	{
+		fprintf(stderr, "deform_terrain error: invalid chunk type\n");
+		exit(-1);
+	}
+	if (radius <= 0.0f)
+	{
+		return;
+	}
+
+	if (g_num_terrain_edits == g_max_terrain_edits)
+	{
+		g_max_terrain_edits = (g_max_terrain_edits == 0) ? 64 : g_max_terrain_edits*2;
+		TerrainEdit *edits = BG_MALLOC(TerrainEdit, g_max_terrain_edits);
+		if (g_num_terrain_edits > 0)
+		{
+			memcpy(edits, g_terrain_edits, g_num_terrain_edits*sizeof(TerrainEdit));
+		}
+		BG_FREE(g_terrain_edits);
+		g_terrain_edits = edits;
+	}
+
+	/* Texel 0 of the chunk is at its top left corner, the same as in get_terrain_height */
+	float texel_spacing = (TERRAIN_XZ_SCALE*4.0f)/land_chunk->width;
+	float chunk_min = -(TERRAIN_XZ_SCALE*4.0f)*(land_chunk->dimension/2);
+	int64_t first_x = 0;
+	int64_t first_z = 0;
+	get_terrain_chunk_first_texel(land_chunk, &first_x, &first_z);
+
+	TerrainEdit *edit = &g_terrain_edits[g_num_terrain_edits++];
+	edit->center_x = (double)first_x + ((position[0] - chunk_min)/texel_spacing);
+	edit->center_z = (double)first_z + ((position[2] - chunk_min)/texel_spacing);
+	edit->radius = radius/texel_spacing;
+	edit->depth = depth;
+	index_terrain_edit(g_num_terrain_edits-1);
+	apply_terrain_edit_to_chunk(land_chunk, edit);
+}
+
+void apply_terrain_edits_to_block(uint64_t terrain_index, TerrainHeight *dest, int stride)
+{
+	TerrainTexelRect block_rect;
+	block_rect.min_x = (int64_t)(terrain_index % MAX_TERRAIN_BLOCKS) * HEIGHTMAP_BLOCK_WIDTH;
+	block_rect.min_z = (int64_t)(terrain_index / MAX_TERRAIN_BLOCKS) * HEIGHTMAP_BLOCK_WIDTH;
+	block_rect.max_x = block_rect.min_x + HEIGHTMAP_BLOCK_WIDTH - 1;
+	block_rect.max_z = block_rect.min_z + HEIGHTMAP_BLOCK_WIDTH - 1;
+	TerrainEditBlock *block = find_terrain_edit_block(terrain_index);
+	if (block == NULL)
+	{
+		return;
+	}
+	/* They have to go in the order they were made, for the heights to come out the same as the first time */
+	for (int i = 0; i < block->num_edits; ++i)
+	{
+		apply_terrain_edit(&g_terrain_edits[block->edits[i]], 
+				   block_rect.min_x, 
+				   block_rect.min_z, 
+				   HEIGHTMAP_BLOCK_WIDTH, 
+				   HEIGHTMAP_BLOCK_WIDTH, 
+				   dest, 
+				   stride);
+	}
+}
+
+void reapply_terrain_edits(TerrainChunk *land_chunk, int first_edit)
+{
+	for (int i = first_edit; i < g_num_terrain_edits; ++i)
+	{
+		apply_terrain_edit_to_chunk(land_chunk, &g_terrain_edits[i]);
+	}
+}
+
+static int compare_edit_indices(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+int get_terrain_chunk_edits(TerrainChunk *land_chunk, TerrainChunkEdit **dest)
+{
+	int64_t first_x = 0;
+	int64_t first_z = 0;
+	get_terrain_chunk_first_texel(land_chunk, &first_x, &first_z);
+
+	/* Edits that cross block edges are in more than one block's list, so they're sorted back into the order they
+	 * were made and the repeats are skipped */
+	int max_indices = 0;
+	for (int block_z = 0; block_z < land_chunk->dimension; ++block_z)
+	{
+		for (int block_x = 0; block_x < land_chunk->dimension; ++block_x)
+		{
+			TerrainEditBlock *block = find_terrain_edit_block(get_terrain_chunk_block_index(land_chunk, block_x, block_z));
+			max_indices += (block != NULL) ? block->num_edits : 0;
+		}
+	}
+	*dest = BG_MALLOC(TerrainChunkEdit, maxi(max_indices, 1));
+	if (max_indices == 0)
+	{
+		return 0;
+	}
+	int *indices = BG_MALLOC(int, max_indices);
+	int num_indices = 0;
+	for (int block_z = 0; block_z < land_chunk->dimension; ++block_z)
+	{
+		for (int block_x = 0; block_x < land_chunk->dimension; ++block_x)
+		{
+			TerrainEditBlock *block = find_terrain_edit_block(get_terrain_chunk_block_index(land_chunk, block_x, block_z));
+			if (block != NULL)
+			{
+				memcpy(&indices[num_indices], block->edits, block->num_edits*sizeof(int));
+				num_indices += block->num_edits;
+			}
+		}
+	}
+	qsort(indices, num_indices, sizeof(int), compare_edit_indices);
+
+	int num_edits = 0;
+	for (int i = 0; i < num_indices; ++i)
+	{
+		if ((i > 0) && (indices[i] == indices[i-1]))
+		{
+			continue;
+		}
+		/* Relative to the chunk, the centers are small enough for a float again */
+		TerrainEdit *edit = &g_terrain_edits[indices[i]];
+		TerrainChunkEdit *chunk_edit = &(*dest)[num_edits++];
+		chunk_edit->center_x = (float)(edit->center_x - (double)first_x);
+		chunk_edit->center_z = (float)(edit->center_z - (double)first_z);
+		chunk_edit->radius = edit->radius;
+		chunk_edit->depth = edit->depth;
+	}
+	BG_FREE(indices);
+	return num_edits;
+}
+
+int get_num_terrain_edits(void)
+{
+	return g_num_terrain_edits;
+}
+
+void free_terrain_edits(void)
+{
+	BG_FREE(g_terrain_edits);
+	g_terrain_edits = NULL;
+	g_num_terrain_edits = 0;
+	g_max_terrain_edits = 0;
+	for (int i = 0; i < g_max_terrain_edit_blocks; ++i)
+	{
+		BG_FREE(g_terrain_edit_blocks[i].edits);
+	}
+	BG_FREE(g_terrain_edit_blocks);
+	g_terrain_edit_blocks = NULL;
+	g_num_terrain_edit_blocks = 0;
+	g_max_terrain_edit_blocks = 0;
+}
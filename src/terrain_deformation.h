@@ -0,0 +1,77 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TERRAIN_DEFORMATION_H__
+#define __TERRAIN_DEFORMATION_H__
+#include <cglm/cglm.h>
+#include "terrain.h"
+
+/* Craters, digging, burrows and anything else that changes the shape of the land. Every edit goes into a log, and is
+ * applied again whenever a block it touches is generated, so the ground stays how it was left when the player walks
+ * away and comes back. The log only lasts as long as the game is running. */
+
+typedef struct TerrainEdit
+{
+	/* In global texel coordinates (see TerrainTexelRect). These are doubles since the world is too wide for a
+	 * float to find a texel in. */
+	double		center_x;
+	double		center_z;
+	/* In texels */
+	float		radius;
+	/* How far down the middle of the edit goes. It's a smooth bowl out to radius. Negative depths raise the
+	 * ground instead. */
+	float		depth;
+} TerrainEdit;
+
+/* A TerrainEdit relative to a chunk's first texel, laid out for terrain_edit_shader.comp */
+typedef struct TerrainChunkEdit
+{
+	float		center_x;
+	float		center_z;
+	float		radius;
+	float		depth;
+} TerrainChunkEdit;
+
+/* The hole the player digs where they're looking, in world units, and how far away they can dig */
+#define PLAYER_DIG_RADIUS 150.0f
+#define PLAYER_DIG_DEPTH 40.0f
+#define PLAYER_DIG_REACH 1500.0f
+
+/* Digs a bowl depth deep and radius wide (both in world units) into the land chunk around position, which is in the
+ * same coordinates as get_terrain_height. heightmap_buffer changes right away, and the GPU's copy the next time
+ * B_upload_terrain_chunk_edits is called. */
+void deform_terrain(TerrainChunk *land_chunk, vec3 position, float radius, float depth);
+
+/* Applies every logged edit that touches the land block at terrain_index. dest is the block's first texel and stride
+ * is the width of the whole destination image in texels, like generate_terrain_block. */
+void apply_terrain_edits_to_block(uint64_t terrain_index, TerrainHeight *dest, int stride);
+
+/* Applies every logged edit from first_edit on that touches the chunk to its heightmap_buffer and marks them dirty.
+ * This is for when the whole buffer has been replaced with freshly generated heights that don't have those edits yet. */
+void reapply_terrain_edits(TerrainChunk *land_chunk, int first_edit);
+
+/* Writes every logged edit that touches the chunk to dest (which is allocated here, and freed by the caller), in the
+ * order they were made, and returns how many there are. This is for applying them on the GPU. */
+int get_terrain_chunk_edits(TerrainChunk *land_chunk, TerrainChunkEdit **dest);
+
+/* Gets the first texel of the chunk's top left block, in global texel coordinates */
+void get_terrain_chunk_first_texel(TerrainChunk *chunk, int64_t *x, int64_t *z);
+
+int get_num_terrain_edits(void);
+void free_terrain_edits(void);
+#endif
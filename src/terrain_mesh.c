@@ -0,0 +1,334 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "terrain_mesh.h"
+#include "heightmap_generation.h"
+#include "utils.h"
+
+static int clamp_int(int value, int min, int max)
+{
+	if (value < min)
+	{
+		return min;
+	}
+	if (value > max)
+	{
+		return max;
+	}
+	return value;
+}
+
+/* Which of the chunk's TerrainMeshBlocks holds block (block_x, block_z), which is wherever that block is in the
+ * heightmap ring buffer */
+static int get_terrain_mesh_slot(TerrainChunk *chunk, int block_x, int block_z)
+{
+	unsigned int index = get_heightmap_buffer_index(chunk, block_x*chunk->width, block_z*chunk->height);
+	int slot_x = (index % chunk->heightmap_width)/chunk->width;
+	int slot_z = (index / chunk->heightmap_width)/chunk->height;
+	return (slot_z * chunk->dimension) + slot_x;
+}
+
+/* Texel (x, z) of the chunk, counted from its top left corner. Past the edge of the chunk, the nearest one is used. */
+static TerrainHeight get_terrain_mesh_texel(TerrainChunk *chunk, int x, int z)
+{
+	x = clamp_int(x, 0, chunk->heightmap_width-1);
+	z = clamp_int(z, 0, chunk->heightmap_height-1);
+	return chunk->heightmap_buffer[get_heightmap_buffer_index(chunk, x, z)];
+}
+
+/* The vertices of a level are a (cells+1) x (cells+1) grid, followed by a copy of each of its four edges for the
+ * skirt: top (z = 0), bottom (z = cells), left (x = 0), then right (x = cells). */
+static unsigned int get_skirt_vertex(int cells, int edge, int i)
+{
+	return ((cells+1)*(cells+1)) + (edge*(cells+1)) + i;
+}
+
+static unsigned int get_grid_vertex(int cells, int edge, int i)
+{
+	switch (edge)
+	{
+		case 0:
+			return i;
+		case 1:
+			return (cells*(cells+1)) + i;
+		case 2:
+			return i*(cells+1);
+		default:
+			return (i*(cells+1)) + cells;
+	}
+}
+
+static void B_send_terrain_lod_indices_to_gpu(TerrainLodMeshes *meshes, int width)
+{
+	glGenBuffers(TERRAIN_MESH_LOD_LEVELS, meshes->ebos);
+	for (int lod = 0; lod < TERRAIN_MESH_LOD_LEVELS; ++lod)
+	{
+		int cells = width >> lod;
+		unsigned int *indices = BG_MALLOC(unsigned int, ((cells*cells) + (4*cells))*6);
+		int num_indices = 0;
+		for (int z = 0; z < cells; ++z)
+		{
+			for (int x = 0; x < cells; ++x)
+			{
+				unsigned int top_left = (z * (cells+1)) + x;
+				unsigned int bottom_left = top_left + (cells+1);
+				/* Counter-clockwise seen from above, the same as the tessellated terrain */
+				indices[num_indices++] = top_left;
+				indices[num_indices++] = bottom_left;
+				indices[num_indices++] = top_left+1;
+				indices[num_indices++] = top_left+1;
+				indices[num_indices++] = bottom_left;
+				indices[num_indices++] = bottom_left+1;
+			}
+		}
+
+		/* The skirts face out from the block. Going along the top and right edges that's one winding, and going
+		 * along the bottom and left edges it's the other. */
+		for (int edge = 0; edge < 4; ++edge)
+		{
+			int flip = ((edge == 1) || (edge == 2));
+			for (int i = 0; i < cells; ++i)
+			{
+				unsigned int a = get_grid_vertex(cells, edge, i);
+				unsigned int b = get_grid_vertex(cells, edge, i+1);
+				unsigned int skirt_a = get_skirt_vertex(cells, edge, i);
+				unsigned int skirt_b = get_skirt_vertex(cells, edge, i+1);
+				if (flip)
+				{
+					unsigned int temp = a;
+					a = b;
+					b = temp;
+					temp = skirt_a;
+					skirt_a = skirt_b;
+					skirt_b = temp;
+				}
+				indices[num_indices++] = a;
+				indices[num_indices++] = b;
+				indices[num_indices++] = skirt_a;
+				indices[num_indices++] = b;
+				indices[num_indices++] = skirt_b;
+				indices[num_indices++] = skirt_a;
+			}
+		}
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshes->ebos[lod]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices*sizeof(unsigned int), indices, GL_STATIC_DRAW);
+		meshes->num_indices[lod] = num_indices;
+		BG_FREE(indices);
+	}
+}
+
+void B_create_terrain_lod_meshes(TerrainChunk *chunk)
+{
+	TerrainLodMeshes *meshes = &chunk->lod_meshes;
+	int num_blocks = chunk->dimension*chunk->dimension;
+	meshes->blocks = BG_MALLOC(TerrainMeshBlock, num_blocks);
+	B_send_terrain_lod_indices_to_gpu(meshes, chunk->width);
+	for (int i = 0; i < num_blocks; ++i)
+	{
+		TerrainMeshBlock *block = &meshes->blocks[i];
+		block->lod = -1;
+		block->dirty = 1;
+		glGenVertexArrays(1, &block->vao);
+		glBindVertexArray(block->vao);
+		glGenBuffers(1, &block->vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, block->vbo);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(TerrainMeshVertex), (void*)offsetof(TerrainMeshVertex, position));
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(TerrainMeshVertex), (void*)offsetof(TerrainMeshVertex, normal));
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(TerrainMeshVertex), (void*)offsetof(TerrainMeshVertex, data));
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+		glEnableVertexAttribArray(2);
+	}
+	glBindVertexArray(0);
+}
+
+void B_free_terrain_lod_meshes(TerrainChunk *chunk)
+{
+	TerrainLodMeshes *meshes = &chunk->lod_meshes;
+	if (meshes->blocks == NULL)
+	{
+		return;
+	}
+	for (int i = 0; i < chunk->dimension*chunk->dimension; ++i)
+	{
+		glDeleteBuffers(1, &meshes->blocks[i].vbo);
+		glDeleteVertexArrays(1, &meshes->blocks[i].vao);
+	}
+	glDeleteBuffers(TERRAIN_MESH_LOD_LEVELS, meshes->ebos);
+	BG_FREE(meshes->blocks);
+	memset(meshes, 0, sizeof(TerrainLodMeshes));
+}
+
+void mark_terrain_lod_meshes_dirty(TerrainChunk *chunk, ivec2 *blocks, int num_blocks)
+{
+	if (chunk->lod_meshes.blocks == NULL)
+	{
+		return;
+	}
+	if (blocks == NULL)
+	{
+		for (int i = 0; i < chunk->dimension*chunk->dimension; ++i)
+		{
+			chunk->lod_meshes.blocks[i].dirty = 1;
+		}
+		return;
+	}
+
+	/* A block's normals and far edges come from its neighbours' texels */
+	for (int i = 0; i < num_blocks; ++i)
+	{
+		for (int z = blocks[i][1]-1; z <= blocks[i][1]+1; ++z)
+		{
+			for (int x = blocks[i][0]-1; x <= blocks[i][0]+1; ++x)
+			{
+				if ((x >= 0) && (x < chunk->dimension) && (z >= 0) && (z < chunk->dimension))
+				{
+					chunk->lod_meshes.blocks[get_terrain_mesh_slot(chunk, x, z)].dirty = 1;
+				}
+			}
+		}
+	}
+
+	/* The blocks that are on the edge of the chunk now might have lost neighbours that were scrolled out */
+	if (num_blocks > 0)
+	{
+		for (int i = 0; i < chunk->dimension; ++i)
+		{
+			int last = chunk->dimension-1;
+			chunk->lod_meshes.blocks[get_terrain_mesh_slot(chunk, i, 0)].dirty = 1;
+			chunk->lod_meshes.blocks[get_terrain_mesh_slot(chunk, i, last)].dirty = 1;
+			chunk->lod_meshes.blocks[get_terrain_mesh_slot(chunk, 0, i)].dirty = 1;
+			chunk->lod_meshes.blocks[get_terrain_mesh_slot(chunk, last, i)].dirty = 1;
+		}
+	}
+}
+
+int get_terrain_mesh_lod(float distance)
+{
+	if (distance < TERRAIN_MESH_LOD_DISTANCE)
+	{
+		return 0;
+	}
+	int lod = 1 + (int)floorf(log2f(distance/TERRAIN_MESH_LOD_DISTANCE));
+	return clamp_int(lod, 1, TERRAIN_MESH_LOD_LEVELS-1);
+}
+
+static void B_mesh_terrain_block(TerrainChunk *chunk, TerrainMeshBlock *mesh_block, int block_x, int block_z, int lod)
+{
+	int step = 1 << lod;
+	int cells = chunk->width >> lod;
+	int row = cells+1;
+	int num_vertices = row*(row+4);
+	float spacing = (TERRAIN_XZ_SCALE*4.0f)/chunk->width;
+	int first_x = block_x*chunk->width;
+	int first_z = block_z*chunk->height;
+
+	TerrainMeshVertex *vertices = BG_MALLOC(TerrainMeshVertex, num_vertices);
+	for (int z = 0; z < row; ++z)
+	{
+		for (int x = 0; x < row; ++x)
+		{
+			TerrainMeshVertex *vertex = &vertices[(z*row) + x];
+			int texel_x = first_x + (x*step);
+			int texel_z = first_z + (z*step);
+			TerrainHeight texel = get_terrain_mesh_texel(chunk, texel_x, texel_z);
+			vertex->position[0] = x*step*spacing;
+			vertex->position[2] = z*step*spacing;
+			if (chunk->type == TERRAIN_CHUNK_LAND)
+			{
+				vertex->position[1] = unpack_terrain_height(texel);
+				get_terrain_texel_normal(chunk, texel_x, texel_z, step, vertex->normal);
+				vertex->data[0] = unpack_terrain_snow(texel);
+				vertex->data[1] = 0.0f;
+			}
+			else
+			{
+				/* The waves move, so their heights are worked out in the vertex shader, and their normals in
+				 * the fragment shader */
+				vertex->position[1] = 0.0f;
+				glm_vec3_zero(vertex->normal);
+				vertex->data[0] = (float)texel.height/UINT16_MAX;
+				vertex->data[1] = (float)texel.snow/UINT16_MAX;
+			}
+		}
+	}
+
+	/* The skirts go down about as far as the ground could be between two of this level's vertices. Water is flat
+	 * enough that it doesn't need them. */
+	float skirt_depth = 0.0f;
+	if (chunk->type == TERRAIN_CHUNK_LAND)
+	{
+		skirt_depth = step*spacing;
+	}
+	for (int edge = 0; edge < 4; ++edge)
+	{
+		for (int i = 0; i < row; ++i)
+		{
+			TerrainMeshVertex *skirt = &vertices[get_skirt_vertex(cells, edge, i)];
+			*skirt = vertices[get_grid_vertex(cells, edge, i)];
+			skirt->position[1] -= skirt_depth;
+		}
+	}
+
+	glBindVertexArray(mesh_block->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh_block->vbo);
+	glBufferData(GL_ARRAY_BUFFER, num_vertices*sizeof(TerrainMeshVertex), vertices, GL_DYNAMIC_DRAW);
+	if (mesh_block->lod != lod)
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chunk->lod_meshes.ebos[lod]);
+	}
+	mesh_block->lod = lod;
+	mesh_block->dirty = 0;
+	BG_FREE(vertices);
+}
+
+void B_draw_terrain_lod_meshes(TerrainChunk *chunk, B_Shader shader, int num_blocks, vec3 camera_position)
+{
+	int half_dimension = chunk->dimension/2;
+	float block_width = TERRAIN_XZ_SCALE*4.0f;
+	for (int i = 0; i < num_blocks; ++i)
+	{
+		TerrainDrawBlock *draw_block = &chunk->draw_blocks[i];
+		vec2 corner = { draw_block->x_offset*block_width, draw_block->z_offset*block_width };
+
+		/* How far the camera is from the closest point of the block */
+		float dx = glm_max(glm_max(corner[0] - camera_position[0], camera_position[0] - (corner[0]+block_width)), 0.0f);
+		float dz = glm_max(glm_max(corner[1] - camera_position[2], camera_position[2] - (corner[1]+block_width)), 0.0f);
+		int lod = get_terrain_mesh_lod(sqrtf((dx*dx) + (dz*dz)));
+
+		int block_x = draw_block->x_offset + half_dimension;
+		int block_z = draw_block->z_offset + half_dimension;
+		TerrainMeshBlock *mesh_block = &chunk->lod_meshes.blocks[get_terrain_mesh_slot(chunk, block_x, block_z)];
+		if (mesh_block->dirty || (mesh_block->lod != lod))
+		{
+			B_mesh_terrain_block(chunk, mesh_block, block_x, block_z, lod);
+		}
+
+		B_set_uniform_vec2(shader, "block_offset", corner);
+		B_set_uniform_int(shader, "temperature", draw_block->temperature);
+		B_set_uniform_float(shader, "precipitation", draw_block->precipitation);
+		glBindVertexArray(mesh_block->vao);
+		glDrawElements(GL_TRIANGLES, chunk->lod_meshes.num_indices[lod], GL_UNSIGNED_INT, 0);
+	}
+	glBindVertexArray(0);
+}
@@ -0,0 +1,49 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TERRAIN_MESH_H__
+#define __TERRAIN_MESH_H__
+#include "terrain.h"
+
+/* When USE_MESHED_TERRAIN is set, every block of a chunk is an indexed grid whose heights and normals are worked out
+ * on the CPU from heightmap_buffer, so it can be drawn with just a vertex and fragment shader. The farther away a block
+ * is, the coarser its grid. Each block has a skirt hanging down from its edges, which hides the cracks where it meets
+ * a block at a different level of detail. */
+
+/* Blocks closer than this are meshed at full detail, and every doubling of the distance past it is one level coarser */
+#define TERRAIN_MESH_LOD_DISTANCE (TERRAIN_XZ_SCALE*4.0f)
+
+typedef struct TerrainMeshVertex
+{
+	/* Relative to the block's corner */
+	GLfloat		position[3];
+	GLfloat		normal[3];
+	/* Land: the snow value, and 0. Water: the wave value and scale (see water_shader.etess). */
+	GLfloat		data[2];
+} TerrainMeshVertex;
+
+void B_create_terrain_lod_meshes(TerrainChunk *chunk);
+void B_free_terrain_lod_meshes(TerrainChunk *chunk);
+/* Marks the given blocks (in chunk coordinates) and their neighbours to be remeshed next time they're drawn, since
+ * their heightmap has changed. If blocks is NULL, every block is. */
+void mark_terrain_lod_meshes_dirty(TerrainChunk *chunk, ivec2 *blocks, int num_blocks);
+int get_terrain_mesh_lod(float distance);
+/* Draws the first num_blocks of chunk->draw_blocks, remeshing any that are dirty or at the wrong level of detail
+ * first. The chunk's uniforms have to be set already. */
+void B_draw_terrain_lod_meshes(TerrainChunk *chunk, B_Shader shader, int num_blocks, vec3 camera_position);
+#endif
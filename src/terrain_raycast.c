@@ -0,0 +1,424 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <time.h>
+#include "height_pyramid.h"
+#include "terrain_collisions.h"
+#include "terrain_raycast.h"
+#include "utils.h"
+
+/* A ray in texel space -- x and z are in texels of the chunk's heightmap (before it's wrapped around the ring
+ * buffer), and y is in world units. t is always the distance along the ray in world units. */
+typedef struct TerrainRay
+{
+	TerrainChunk	*chunk;
+	float		origin[3];
+	float		direction[3];
+	float		texels_per_unit;
+	float		chunk_min;
+} TerrainRay;
+
+/* Steps through the cells of a grid that a ray passes through, in order. */
+typedef struct CellWalk
+{
+	int		x;
+	int		z;
+	int		step_x;
+	int		step_z;
+	float		t;
+	float		t_end;
+	float		t_max_x;
+	float		t_max_z;
+	float		t_delta_x;
+	float		t_delta_z;
+} CellWalk;
+
+static float get_ray_height(TerrainRay *ray, float t)
+{
+	return ray->origin[1] + (ray->direction[1]*t);
+}
+
+static void start_cell_walk(CellWalk *walk, TerrainRay *ray, float cell_width, float t_start, float t_end)
+{
+	/* The cell is picked from a point just past t_start, so a ray starting on a cell's edge is put in the cell
+	 * it's heading into. */
+	float t_mid = t_start + ((t_end - t_start)*1e-4f);
+	float x = ray->origin[0] + (ray->direction[0]*t_mid);
+	float z = ray->origin[2] + (ray->direction[2]*t_mid);
+	walk->x = (int)floorf(x/cell_width);
+	walk->z = (int)floorf(z/cell_width);
+	walk->t = t_start;
+	walk->t_end = t_end;
+
+	walk->step_x = (ray->direction[0] >= 0.0f) ? 1 : -1;
+	walk->step_z = (ray->direction[2] >= 0.0f) ? 1 : -1;
+	walk->t_max_x = FLT_MAX;
+	walk->t_max_z = FLT_MAX;
+	walk->t_delta_x = FLT_MAX;
+	walk->t_delta_z = FLT_MAX;
+	if (ray->direction[0] != 0.0f)
+	{
+		float edge = (walk->x + (walk->step_x > 0))*cell_width;
+		walk->t_max_x = (edge - ray->origin[0])/ray->direction[0];
+		walk->t_delta_x = cell_width/fabsf(ray->direction[0]);
+	}
+	if (ray->direction[2] != 0.0f)
+	{
+		float edge = (walk->z + (walk->step_z > 0))*cell_width;
+		walk->t_max_z = (edge - ray->origin[2])/ray->direction[2];
+		walk->t_delta_z = cell_width/fabsf(ray->direction[2]);
+	}
+}
+
+/* Gets the next cell and the part of the ray inside it. Returns 0 once the walk is past t_end. */
+static int next_cell(CellWalk *walk, int *x, int *z, float *t_enter, float *t_exit)
+{
+	if (walk->t >= walk->t_end)
+	{
+		return 0;
+	}
+	*x = walk->x;
+	*z = walk->z;
+	*t_enter = walk->t;
+	if (walk->t_max_x < walk->t_max_z)
+	{
+		*t_exit = walk->t_max_x;
+		walk->t_max_x += walk->t_delta_x;
+		walk->x += walk->step_x;
+	}
+	else
+	{
+		*t_exit = walk->t_max_z;
+		walk->t_max_z += walk->t_delta_z;
+		walk->z += walk->step_z;
+	}
+	if (*t_exit > walk->t_end)
+	{
+		*t_exit = walk->t_end;
+	}
+	walk->t = *t_exit;
+	return 1;
+}
+
+/* Clips the ray to the rectangle of texels from min to max. Returns 0 if none of [t_start, t_end] is in it. */
+static int clip_ray(TerrainRay *ray, float min_x, float min_z, float max_x, float max_z, float *t_start, float *t_end)
+{
+	float mins[2] = { min_x, min_z };
+	float maxes[2] = { max_x, max_z };
+	for (int i = 0; i < 2; ++i)
+	{
+		float origin = ray->origin[i*2];
+		float direction = ray->direction[i*2];
+		if (direction == 0.0f)
+		{
+			if ((origin < mins[i]) || (origin > maxes[i]))
+			{
+				return 0;
+			}
+			continue;
+		}
+		float t0 = (mins[i] - origin)/direction;
+		float t1 = (maxes[i] - origin)/direction;
+		if (t0 > t1)
+		{
+			float tmp = t0;
+			t0 = t1;
+			t1 = tmp;
+		}
+		*t_start = fmaxf(*t_start, t0);
+		*t_end = fminf(*t_end, t1);
+	}
+	return *t_start < *t_end;
+}
+
+static float get_texel_height(TerrainChunk *chunk, int x, int z)
+{
+	x = mini(maxi(x, 0), chunk->heightmap_width - 1);
+	z = mini(maxi(z, 0), chunk->heightmap_height - 1);
+	return unpack_terrain_height(chunk->heightmap_buffer[get_heightmap_buffer_index(chunk, x, z)]);
+}
+
+/* Merges in the bounds of a cell of the pyramid, by where it is in the chunk rather than in the ring buffer. This
+ * only works for levels with cells no bigger than a block, since a block is never split up in the ring buffer. */
+static void merge_cell_bounds(TerrainChunk *chunk, int level, int cell_x, int cell_z, HeightBounds *bounds)
+{
+	HeightPyramid *pyramid = &chunk->height_pyramid;
+	int cell_width = HEIGHT_PYRAMID_CELL_WIDTH << level;
+	int x = cell_x*cell_width;
+	int z = cell_z*cell_width;
+	if ((x < 0) || (z < 0) || (x >= chunk->heightmap_width) || (z >= chunk->heightmap_height))
+	{
+		return;
+	}
+	unsigned int index = get_heightmap_buffer_index(chunk, x, z);
+	int buffer_x = (index % chunk->heightmap_width)/cell_width;
+	int buffer_z = (index / chunk->heightmap_width)/cell_width;
+	HeightBounds cell = pyramid->levels[level][(buffer_z*pyramid->level_widths[level]) + buffer_x];
+	bounds->min = mini(bounds->min, cell.min);
+	bounds->max = maxi(bounds->max, cell.max);
+}
+
+/* The ground between the last texel of a cell and the first texel of the next is interpolated between them, so the
+ * neighbours' bounds are included too. */
+static float get_cell_max_height(TerrainChunk *chunk, int level, int cell_x, int cell_z)
+{
+	HeightBounds bounds = { UINT16_MAX, 0 };
+	merge_cell_bounds(chunk, level, cell_x, cell_z, &bounds);
+	merge_cell_bounds(chunk, level, cell_x + 1, cell_z, &bounds);
+	merge_cell_bounds(chunk, level, cell_x, cell_z + 1, &bounds);
+	merge_cell_bounds(chunk, level, cell_x + 1, cell_z + 1, &bounds);
+	return unpack_terrain_height((TerrainHeight){ bounds.max, 0 });
+}
+
+/* Tests the part of the ray over one texel square, where the ground is bilinearly interpolated between its four
+ * corners. Along the ray that's a quadratic, so the ray's height minus the ground's is too, and the first place
+ * that goes below zero can be solved for exactly. */
+static int intersect_texel_square(TerrainRay *ray, int x, int z, float t0, float t1, TerrainRayHit *hit)
+{
+	TerrainChunk *chunk = ray->chunk;
+	float h00 = get_texel_height(chunk, x, z);
+	float h10 = get_texel_height(chunk, x + 1, z);
+	float h01 = get_texel_height(chunk, x, z + 1);
+	float h11 = get_texel_height(chunk, x + 1, z + 1);
+	float max_height = fmaxf(fmaxf(h00, h10), fmaxf(h01, h11));
+	if (fminf(get_ray_height(ray, t0), get_ray_height(ray, t1)) > max_height)
+	{
+		return 0;
+	}
+
+	float samples[3];
+	float ts[3] = { t0, (t0 + t1)/2.0f, t1 };
+	for (int i = 0; i < 3; ++i)
+	{
+		float u = ray->origin[0] + (ray->direction[0]*ts[i]) - x;
+		float v = ray->origin[2] + (ray->direction[2]*ts[i]) - z;
+		float ground = (h00*(1.0f-u)*(1.0f-v)) + (h10*u*(1.0f-v)) + (h01*(1.0f-u)*v) + (h11*u*v);
+		samples[i] = get_ray_height(ray, ts[i]) - ground;
+	}
+
+	float s = -1.0f;
+	if (samples[0] <= 0.0f)
+	{
+		s = 0.0f;
+	}
+	else
+	{
+		/* The quadratic through the three samples, with s going from 0 at t0 to 1 at t1 */
+		float a = (2.0f*samples[0]) - (4.0f*samples[1]) + (2.0f*samples[2]);
+		float b = (-3.0f*samples[0]) + (4.0f*samples[1]) - samples[2];
+		float c = samples[0];
+		if (fabsf(a) < 1e-6f)
+		{
+			if ((samples[2] <= 0.0f) && (b != 0.0f))
+			{
+				s = -c/b;
+			}
+		}
+		else
+		{
+			float discriminant = (b*b) - (4.0f*a*c);
+			if (discriminant >= 0.0f)
+			{
+				float root = sqrtf(discriminant);
+				float s0 = (-b - root)/(2.0f*a);
+				float s1 = (-b + root)/(2.0f*a);
+				if (s0 > s1)
+				{
+					float tmp = s0;
+					s0 = s1;
+					s1 = tmp;
+				}
+				if ((s0 >= 0.0f) && (s0 <= 1.0f))
+				{
+					s = s0;
+				}
+				else if ((s1 >= 0.0f) && (s1 <= 1.0f))
+				{
+					s = s1;
+				}
+			}
+		}
+	}
+	if (s < 0.0f)
+	{
+		return 0;
+	}
+
+	float t = t0 + ((t1 - t0)*s);
+	float u = glm_clamp(ray->origin[0] + (ray->direction[0]*t) - x, 0.0f, 1.0f);
+	float v = glm_clamp(ray->origin[2] + (ray->direction[2]*t) - z, 0.0f, 1.0f);
+	float slope_x = (((h10 - h00)*(1.0f-v)) + ((h11 - h01)*v))*ray->texels_per_unit;
+	float slope_z = (((h01 - h00)*(1.0f-u)) + ((h11 - h10)*u))*ray->texels_per_unit;
+
+	hit->distance = t;
+	hit->position[0] = ((ray->origin[0] + (ray->direction[0]*t))/ray->texels_per_unit) + ray->chunk_min;
+	hit->position[1] = get_ray_height(ray, t);
+	hit->position[2] = ((ray->origin[2] + (ray->direction[2]*t))/ray->texels_per_unit) + ray->chunk_min;
+	glm_vec3_copy(VEC3(-slope_x, 1.0f, -slope_z), hit->normal);
+	glm_vec3_normalize(hit->normal);
+	return 1;
+}
+
+static int intersect_cell(TerrainRay *ray, int level, int cell_x, int cell_z, float t0, float t1, TerrainRayHit *hit)
+{
+	if (fminf(get_ray_height(ray, t0), get_ray_height(ray, t1)) > get_cell_max_height(ray->chunk, level, cell_x, cell_z))
+	{
+		return 0;
+	}
+
+	CellWalk walk;
+	int x = 0;
+	int z = 0;
+	float t_enter = 0.0f;
+	float t_exit = 0.0f;
+	if (level == 0)
+	{
+		start_cell_walk(&walk, ray, 1.0f, t0, t1);
+		while (next_cell(&walk, &x, &z, &t_enter, &t_exit))
+		{
+			if (intersect_texel_square(ray, x, z, t_enter, t_exit, hit))
+			{
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	start_cell_walk(&walk, ray, (float)(HEIGHT_PYRAMID_CELL_WIDTH << (level-1)), t0, t1);
+	while (next_cell(&walk, &x, &z, &t_enter, &t_exit))
+	{
+		if (intersect_cell(ray, level-1, x, z, t_enter, t_exit, hit))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int raycast_terrain(TerrainChunk *terrain_chunk, vec3 origin, vec3 direction, float max_distance, TerrainRayHit *hit)
+{
+	if ((terrain_chunk->height_pyramid.num_levels == 0) || !terrain_chunk->heightmap_generated)
+	{
+		return 0;
+	}
+	vec3 normalized_direction;
+	glm_vec3_normalize_to(direction, normalized_direction);
+	if (glm_vec3_norm(normalized_direction) == 0.0f)
+	{
+		return 0;
+	}
+
+	TerrainRay ray;
+	ray.chunk = terrain_chunk;
+	ray.texels_per_unit = (float)terrain_chunk->width/(TERRAIN_XZ_SCALE*4);
+	ray.chunk_min = -(TERRAIN_XZ_SCALE*4)*(terrain_chunk->dimension/2);
+	ray.origin[0] = (origin[0] - ray.chunk_min)*ray.texels_per_unit;
+	ray.origin[1] = origin[1];
+	ray.origin[2] = (origin[2] - ray.chunk_min)*ray.texels_per_unit;
+	ray.direction[0] = normalized_direction[0]*ray.texels_per_unit;
+	ray.direction[1] = normalized_direction[1];
+	ray.direction[2] = normalized_direction[2]*ray.texels_per_unit;
+
+	float t_start = 0.0f;
+	float t_end = max_distance;
+	if (!clip_ray(&ray, 0.0f, 0.0f, terrain_chunk->heightmap_width - 1, terrain_chunk->heightmap_height - 1, &t_start, &t_end))
+	{
+		return 0;
+	}
+
+	/* The ray goes block by block, and then down the pyramid inside each block it might hit. */
+	int block_level = 0;
+	while ((HEIGHT_PYRAMID_CELL_WIDTH << block_level) < terrain_chunk->width)
+	{
+		block_level++;
+	}
+	CellWalk walk;
+	int x = 0;
+	int z = 0;
+	float t_enter = 0.0f;
+	float t_exit = 0.0f;
+	start_cell_walk(&walk, &ray, (float)terrain_chunk->width, t_start, t_end);
+	while (next_cell(&walk, &x, &z, &t_enter, &t_exit))
+	{
+		if (intersect_cell(&ray, block_level, x, z, t_enter, t_exit, hit))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int terrain_segment_intersection(TerrainChunk *terrain_chunk, vec3 start, vec3 end, TerrainRayHit *hit)
+{
+	vec3 direction;
+	glm_vec3_sub(end, start, direction);
+	return raycast_terrain(terrain_chunk, start, direction, glm_vec3_norm(direction), hit);
+}
+
+void benchmark_terrain_raycast(int num_rays)
+{
+	set_terrain_chunk_dimension(9);
+	TerrainChunk chunk = create_server_terrain_chunk(TERRAIN_CHUNK_LAND, PLAYER_TERRAIN_INDEX_START);
+	float max_distance = (TERRAIN_XZ_SCALE*4)*(chunk.dimension/2);
+
+	/* The rays start a little above the ground in the middle block, and look out at the horizon or slightly down,
+	 * like the camera does. */
+	vec3 *origins = BG_MALLOC(vec3, num_rays);
+	vec3 *directions = BG_MALLOC(vec3, num_rays);
+	srand(0);
+	for (int i = 0; i < num_rays; ++i)
+	{
+		origins[i][0] = ((float)rand()/(float)RAND_MAX)*(TERRAIN_XZ_SCALE*4);
+		origins[i][2] = ((float)rand()/(float)RAND_MAX)*(TERRAIN_XZ_SCALE*4);
+		origins[i][1] = get_terrain_height(origins[i], &chunk) + 2.0f + (((float)rand()/(float)RAND_MAX)*50.0f);
+		float yaw = ((float)rand()/(float)RAND_MAX)*2.0f*GLM_PI;
+		float pitch = -((float)rand()/(float)RAND_MAX)*0.5f;
+		directions[i][0] = cosf(yaw)*cosf(pitch);
+		directions[i][1] = sinf(pitch);
+		directions[i][2] = sinf(yaw)*cosf(pitch);
+	}
+
+	struct timespec start;
+	struct timespec end;
+	int num_hits = 0;
+	double total_distance = 0.0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < num_rays; ++i)
+	{
+		TerrainRayHit hit;
+		if (raycast_terrain(&chunk, origins[i], directions[i], max_distance, &hit))
+		{
+			num_hits++;
+			total_distance += hit.distance;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (double)(end.tv_sec - start.tv_sec) + ((double)(end.tv_nsec - start.tv_nsec)/1e9);
+	printf("%i rays over a %ix%i chunk in %.3f s: %.0f rays per second, %.2f us per ray\n", 
+	       num_rays, chunk.dimension, chunk.dimension, seconds, num_rays/seconds, (seconds*1e6)/num_rays);
+	printf("%i hits, average distance %.1f\n", num_hits, (num_hits > 0) ? total_distance/num_hits : 0.0);
+
+	BG_FREE(origins);
+	BG_FREE(directions);
+	free_server_terrain_chunk(&chunk);
+}
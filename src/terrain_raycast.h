@@ -0,0 +1,42 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TERRAIN_RAYCAST_H__
+#define __TERRAIN_RAYCAST_H__
+#include <cglm/cglm.h>
+#include "terrain.h"
+
+typedef struct TerrainRayHit
+{
+	vec3		position;
+	vec3		normal;
+	float		distance;
+} TerrainRayHit;
+
+/* Finds where a ray first hits the ground of a land chunk, in the same coordinates as get_terrain_height. The ray is
+ * walked through the chunk's height pyramid, so whole stretches of terrain that it passes over are skipped at
+ * once, and only the texels right under it are ever tested. direction doesn't have to be normalized, and the ray
+ * goes at most max_distance. Returns 1 and fills in hit if the ground was hit, otherwise returns 0. */
+int raycast_terrain(TerrainChunk *terrain_chunk, vec3 origin, vec3 direction, float max_distance, TerrainRayHit *hit);
+
+/* Same as raycast_terrain, for the line segment from start to end. */
+int terrain_segment_intersection(TerrainChunk *terrain_chunk, vec3 start, vec3 end, TerrainRayHit *hit);
+
+/* Casts num_rays random rays over a freshly generated chunk and prints how many it can do a second. */
+void benchmark_terrain_raycast(int num_rays);
+#endif
@@ -0,0 +1,261 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "heightmap_generation.h"
+#include "terrain_streaming.h"
+
+TerrainStreamer g_terrain_streamer;
+int g_terrain_streamer_initialized = 0;
+
+void init_terrain_streamer(void)
+{
+	if (g_terrain_streamer_initialized)
+	{
+		return;
+	}
+	memset(&g_terrain_streamer, 0, sizeof(TerrainStreamer));
+	/* Leave half of the cores for generation the game is actually waiting on */
+	g_terrain_streamer.thread_pool = create_thread_pool(maxi(get_num_cpu_cores()/2, 1));
+	pthread_mutex_init(&g_terrain_streamer.mutex, NULL);
+	pthread_cond_init(&g_terrain_streamer.block_ready, NULL);
+	g_terrain_streamer.predicted_index = UINT64_MAX;
+	g_terrain_streamer_initialized = 1;
+}
+
+void free_terrain_streamer(void)
+{
+	if (!g_terrain_streamer_initialized)
+	{
+		return;
+	}
+	free_thread_pool(g_terrain_streamer.thread_pool);
+	pthread_mutex_destroy(&g_terrain_streamer.mutex);
+	pthread_cond_destroy(&g_terrain_streamer.block_ready);
+	for (int i = 0; i < MAX_STREAMED_BLOCKS; ++i)
+	{
+		BG_FREE(g_terrain_streamer.blocks[i].heights);
+	}
+	g_terrain_streamer_initialized = 0;
+}
+
+static void generate_streamed_block_job(void *arg)
+{
+	StreamedBlock *block = (StreamedBlock *)arg;
+	load_or_generate_terrain_block(block->type, block->terrain_index, block->condition, block->heights, HEIGHTMAP_BLOCK_WIDTH);
+
+	pthread_mutex_lock(&g_terrain_streamer.mutex);
+	block->state = STREAMED_BLOCK_READY;
+	pthread_cond_broadcast(&g_terrain_streamer.block_ready);
+	pthread_mutex_unlock(&g_terrain_streamer.mutex);
+}
+
+static StreamedBlock *find_streamed_block(int type, uint64_t terrain_index)
+{
+	for (int i = 0; i < MAX_STREAMED_BLOCKS; ++i)
+	{
+		StreamedBlock *block = &g_terrain_streamer.blocks[i];
+		if ((block->state != STREAMED_BLOCK_EMPTY) && (block->type == type) && (block->terrain_index == terrain_index))
+		{
+			return block;
+		}
+	}
+	return NULL;
+}
+
+/* Gets the block offsets (relative to the player's current block) that come into view when moving
+ * dx blocks over in x and dz in z. Returns how many there are. */
+static int get_incoming_block_offsets(int dimension, int dx, int dz, ivec2 *dest)
+{
+	int half_dimension = dimension/2;
+	int num_offsets = 0;
+	for (int z = -half_dimension; z <= half_dimension; ++z)
+	{
+		for (int x = -half_dimension; x <= half_dimension; ++x)
+		{
+			if ((abs(x + dx) > half_dimension) || (abs(z + dz) > half_dimension))
+			{
+				dest[num_offsets][0] = x + dx;
+				dest[num_offsets][1] = z + dz;
+				num_offsets++;
+			}
+		}
+	}
+	return num_offsets;
+}
+
+/* Predicts which way (if any) the actor will cross into a new block within STREAMING_LOOKAHEAD_TICKS. */
+static void predict_block_crossing(ActorState *actor_state, int *dx, int *dz)
+{
+	float block_size = TERRAIN_XZ_SCALE*4;
+	float velocity[2] = { actor_state->command_state.move_direction[0] * actor_state->speed,
+			      actor_state->command_state.move_direction[2] * actor_state->speed };
+	float position[2] = { actor_state->position[0], actor_state->position[2] };
+	int *crossing[2] = { dx, dz };
+	for (int i = 0; i < 2; ++i)
+	{
+		*crossing[i] = 0;
+		if (velocity[i] > 0.0f)
+		{
+			if (((block_size - position[i]) / velocity[i]) < STREAMING_LOOKAHEAD_TICKS)
+			{
+				*crossing[i] = 1;
+			}
+		}
+		else if (velocity[i] < 0.0f)
+		{
+			if ((position[i] / -velocity[i]) < STREAMING_LOOKAHEAD_TICKS)
+			{
+				*crossing[i] = -1;
+			}
+		}
+	}
+}
+
+void update_terrain_streamer(ActorState *actor_state, int dimension)
+{
+	if (!CPU_HEIGHTMAP_GENERATION)
+	{
+		return;
+	}
+	init_terrain_streamer();
+
+	int dx = 0;
+	int dz = 0;
+	predict_block_crossing(actor_state, &dx, &dz);
+	if ((dx == 0) && (dz == 0))
+	{
+		return;
+	}
+	uint64_t predicted_index = actor_state->current_terrain_index + dx + (dz*MAX_TERRAIN_BLOCKS);
+	if (predicted_index == g_terrain_streamer.predicted_index)
+	{
+		return;
+	}
+	g_terrain_streamer.predicted_index = predicted_index;
+
+	ivec2 *offsets = BG_MALLOC(ivec2, dimension*dimension);
+	int num_offsets = get_incoming_block_offsets(dimension, dx, dz, offsets);
+	int types[2] = { TERRAIN_CHUNK_LAND, TERRAIN_CHUNK_WATER };
+
+	pthread_mutex_lock(&g_terrain_streamer.mutex);
+	/* Whatever is ready but not part of this prediction was for a crossing that didn't happen */
+	for (int i = 0; i < MAX_STREAMED_BLOCKS; ++i)
+	{
+		StreamedBlock *block = &g_terrain_streamer.blocks[i];
+		if (block->state != STREAMED_BLOCK_READY)
+		{
+			continue;
+		}
+		int needed = 0;
+		for (int j = 0; j < num_offsets; ++j)
+		{
+			int index = actor_state->current_terrain_index + (offsets[j][1]*MAX_TERRAIN_BLOCKS) + offsets[j][0];
+			if (block->terrain_index == (uint64_t)index)
+			{
+				needed = 1;
+				break;
+			}
+		}
+		if (!needed)
+		{
+			block->state = STREAMED_BLOCK_EMPTY;
+		}
+	}
+
+	int free_block = 0;
+	for (int i = 0; i < num_offsets*2; ++i)
+	{
+		int type = types[i/num_offsets];
+		int index = actor_state->current_terrain_index + (offsets[i%num_offsets][1]*MAX_TERRAIN_BLOCKS) + offsets[i%num_offsets][0];
+		if (find_streamed_block(type, index) != NULL)
+		{
+			continue;
+		}
+		while ((free_block < MAX_STREAMED_BLOCKS) && (g_terrain_streamer.blocks[free_block].state != STREAMED_BLOCK_EMPTY))
+		{
+			free_block++;
+		}
+		if (free_block == MAX_STREAMED_BLOCKS)
+		{
+			break;
+		}
+		StreamedBlock *block = &g_terrain_streamer.blocks[free_block];
+		if (block->heights == NULL)
+		{
+			block->heights = BG_MALLOC(TerrainHeight, HEIGHTMAP_BLOCK_WIDTH*HEIGHTMAP_BLOCK_WIDTH);
+		}
+		block->state = STREAMED_BLOCK_PENDING;
+		block->type = type;
+		block->terrain_index = index;
+		block->condition = get_environment_condition(index);
+		thread_pool_submit(g_terrain_streamer.thread_pool, generate_streamed_block_job, block);
+	}
+	pthread_mutex_unlock(&g_terrain_streamer.mutex);
+	BG_FREE(offsets);
+}
+
+int take_streamed_terrain_block(int type, uint64_t terrain_index, TerrainHeight *dest, int stride)
+{
+	if (!g_terrain_streamer_initialized)
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&g_terrain_streamer.mutex);
+	StreamedBlock *block = find_streamed_block(type, terrain_index);
+	if ((block == NULL) || (block->state == STREAMED_BLOCK_TAKEN))
+	{
+		g_terrain_streamer.num_misses++;
+		pthread_mutex_unlock(&g_terrain_streamer.mutex);
+		return 0;
+	}
+	while (block->state == STREAMED_BLOCK_PENDING)
+	{
+		pthread_cond_wait(&g_terrain_streamer.block_ready, &g_terrain_streamer.mutex);
+	}
+	block->state = STREAMED_BLOCK_TAKEN;
+	g_terrain_streamer.num_hits++;
+	pthread_mutex_unlock(&g_terrain_streamer.mutex);
+
+	for (int z = 0; z < HEIGHTMAP_BLOCK_WIDTH; ++z)
+	{
+		memcpy(&dest[z*stride], &block->heights[z*HEIGHTMAP_BLOCK_WIDTH], HEIGHTMAP_BLOCK_WIDTH*sizeof(TerrainHeight));
+	}
+
+	pthread_mutex_lock(&g_terrain_streamer.mutex);
+	block->state = STREAMED_BLOCK_EMPTY;
+	pthread_mutex_unlock(&g_terrain_streamer.mutex);
+	return 1;
+}
+
+void get_terrain_streamer_stats(int *hits, int *misses)
+{
+	*hits = 0;
+	*misses = 0;
+	if (!g_terrain_streamer_initialized)
+	{
+		return;
+	}
+	pthread_mutex_lock(&g_terrain_streamer.mutex);
+	*hits = g_terrain_streamer.num_hits;
+	*misses = g_terrain_streamer.num_misses;
+	pthread_mutex_unlock(&g_terrain_streamer.mutex);
+}
@@ -0,0 +1,77 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TERRAIN_STREAMING_H__
+#define __TERRAIN_STREAMING_H__
+#include <pthread.h>
+#include "actor_state.h"
+#include "environment.h"
+#include "thread_pool.h"
+#include "terrain.h"
+
+/* The most blocks that can be generated ahead of time. A crossing needs 2*dimension blocks (land and water),
+ * or 2*(2*dimension - 1) for a diagonal one. */
+#define MAX_STREAMED_BLOCKS 256
+/* How far ahead (in simulation ticks) the player's next block crossing is predicted */
+#define STREAMING_LOOKAHEAD_TICKS 300.0f
+
+enum STREAMED_BLOCK_STATES
+{
+	STREAMED_BLOCK_EMPTY,
+	STREAMED_BLOCK_PENDING,
+	STREAMED_BLOCK_READY,
+	STREAMED_BLOCK_TAKEN,
+};
+
+typedef struct StreamedBlock
+{
+	int			state;
+	int			type;
+	uint64_t		terrain_index;
+	EnvironmentCondition	condition;
+	TerrainHeight		*heights;
+} StreamedBlock;
+
+/* The TerrainStreamer watches where the player is heading, and generates the blocks that will come into view
+ * at the next block crossing on its own worker threads, before the crossing happens. When the chunk is scrolled,
+ * those blocks are copied out of the streamer instead of being generated on the spot. */
+typedef struct TerrainStreamer
+{
+	ThreadPool		*thread_pool;
+	pthread_mutex_t		mutex;
+	pthread_cond_t		block_ready;
+	StreamedBlock		blocks[MAX_STREAMED_BLOCKS];
+	uint64_t		predicted_index;
+	int			num_hits;
+	int			num_misses;
+} TerrainStreamer;
+
+void init_terrain_streamer(void);
+void free_terrain_streamer(void);
+
+/* Predicts the actor's next block crossing from its position, speed and move direction, and starts generating
+ * the blocks that crossing will need. This should be called once a frame for the player. */
+void update_terrain_streamer(ActorState *actor_state, int dimension);
+
+/* If the block has been (or is being) generated ahead of time, waits for it, copies it to dest and returns 1.
+ * Otherwise returns 0. stride is the width of dest in texels. This is thread safe. */
+int take_streamed_terrain_block(int type, uint64_t terrain_index, TerrainHeight *dest, int stride);
+
+/* The number of blocks that were and weren't ready ahead of time. */
+void get_terrain_streamer_stats(int *hits, int *misses);
+#endif
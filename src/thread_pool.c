@@ -0,0 +1,147 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "utils.h"
+#include "thread_pool.h"
+
+int get_num_cpu_cores(void)
+{
+	long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_cores < 1)
+	{
+		return 1;
+	}
+	return (int)num_cores;
+}
+
+static void *thread_pool_worker(void *arg)
+{
+	ThreadPool *pool = (ThreadPool *)arg;
+	pthread_mutex_lock(&pool->mutex);
+	while (1)
+	{
+		while ((pool->num_tasks == 0) && !pool->shutting_down)
+		{
+			pthread_cond_wait(&pool->task_available, &pool->mutex);
+		}
+		if (pool->num_tasks == 0)
+		{
+			break;
+		}
+
+		ThreadPoolTask task = pool->tasks[pool->first_task];
+		pool->first_task = (pool->first_task + 1) % pool->max_tasks;
+		pool->num_tasks--;
+		pool->num_running++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		task.job(task.arg);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->num_running--;
+		if ((pool->num_tasks == 0) && (pool->num_running == 0))
+		{
+			pthread_cond_broadcast(&pool->all_done);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+ThreadPool *create_thread_pool(int num_threads)
+{
+	if (num_threads <= 0)
+	{
+		num_threads = get_num_cpu_cores();
+	}
+	ThreadPool *pool = BG_MALLOC(ThreadPool, 1);
+	pool->max_tasks = 64;
+	pool->tasks = BG_MALLOC(ThreadPoolTask, pool->max_tasks);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->task_available, NULL);
+	pthread_cond_init(&pool->all_done, NULL);
+
+	pool->threads = BG_MALLOC(pthread_t, num_threads);
+	for (int i = 0; i < num_threads; ++i)
+	{
+		if (pthread_create(&pool->threads[i], NULL, thread_pool_worker, pool) != 0)
+		{
+			fprintf(stderr, "create_thread_pool error: could not create worker thread %i\n", i);
+			exit(-1);
+		}
+		pool->num_threads++;
+	}
+	return pool;
+}
+
+void thread_pool_submit(ThreadPool *pool, ThreadPoolJob job, void *arg)
+{
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->num_tasks == pool->max_tasks)
+	{
+		/* Unroll the ring into a bigger array so first_task can start over at 0 */
+		ThreadPoolTask *tasks = BG_MALLOC(ThreadPoolTask, pool->max_tasks*2);
+		for (int i = 0; i < pool->num_tasks; ++i)
+		{
+			tasks[i] = pool->tasks[(pool->first_task + i) % pool->max_tasks];
+		}
+		BG_FREE(pool->tasks);
+		pool->tasks = tasks;
+		pool->first_task = 0;
+		pool->max_tasks *= 2;
+	}
+	int last_task = (pool->first_task + pool->num_tasks) % pool->max_tasks;
+	pool->tasks[last_task].job = job;
+	pool->tasks[last_task].arg = arg;
+	pool->num_tasks++;
+	pthread_cond_signal(&pool->task_available);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void thread_pool_wait(ThreadPool *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	while ((pool->num_tasks > 0) || (pool->num_running > 0))
+	{
+		pthread_cond_wait(&pool->all_done, &pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void free_thread_pool(ThreadPool *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	pool->shutting_down = 1;
+	pthread_cond_broadcast(&pool->task_available);
+	pthread_mutex_unlock(&pool->mutex);
+
+	/* Workers finish whatever is still queued before they exit */
+	for (int i = 0; i < pool->num_threads; ++i)
+	{
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->task_available);
+	pthread_cond_destroy(&pool->all_done);
+	BG_FREE(pool->threads);
+	BG_FREE(pool->tasks);
+	BG_FREE(pool);
+}
@@ -0,0 +1,54 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+#include <pthread.h>
+
+typedef void (*ThreadPoolJob)(void *arg);
+
+typedef struct ThreadPoolTask
+{
+	ThreadPoolJob	job;
+	void		*arg;
+} ThreadPoolTask;
+
+/* A fixed set of worker threads pulling jobs off of a shared queue. The queue grows as needed, so
+ * submitting never blocks. thread_pool_wait() blocks until every job submitted so far has finished. */
+typedef struct ThreadPool
+{
+	pthread_t	*threads;
+	int		num_threads;
+	ThreadPoolTask	*tasks;
+	int		max_tasks;
+	int		first_task;
+	int		num_tasks;
+	int		num_running;
+	int		shutting_down;
+	pthread_mutex_t	mutex;
+	pthread_cond_t	task_available;
+	pthread_cond_t	all_done;
+} ThreadPool;
+
+/* If num_threads is 0 or less, one thread per online CPU core is created. */
+ThreadPool *create_thread_pool(int num_threads);
+void thread_pool_submit(ThreadPool *pool, ThreadPoolJob job, void *arg);
+void thread_pool_wait(ThreadPool *pool);
+void free_thread_pool(ThreadPool *pool);
+int get_num_cpu_cores(void);
+#endif
@@ -0,0 +1,508 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "heightmap_generation.h"
+#include "thread_pool.h"
+#include "tile_cache.h"
+
+#define TILE_RECORD_SIZE (sizeof(TileRecord) + (HEIGHTMAP_BLOCK_WIDTH*HEIGHTMAP_BLOCK_WIDTH*sizeof(TerrainHeight)))
+#define TILE_REGION_FILE_SIZE (TILE_REGION_HEADER_SIZE + (2*TILE_REGION_BLOCKS*TILE_RECORD_SIZE))
+
+TileCache g_tile_cache;
+int g_tile_cache_initialized = 0;
+
+typedef struct PrewarmJob
+{
+	uint64_t		terrain_index;
+	EnvironmentCondition	condition;
+	TerrainHeight		*heights;
+} PrewarmJob;
+
+static uint64_t part_1_by_1(uint32_t n)
+{
+	uint64_t x = n;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+	x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+	x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | (x << 2)) & 0x3333333333333333ULL;
+	x = (x | (x << 1)) & 0x5555555555555555ULL;
+	return x;
+}
+
+uint64_t morton_encode(uint32_t x, uint32_t z)
+{
+	return part_1_by_1(x) | (part_1_by_1(z) << 1);
+}
+
+static void get_region_filename(uint64_t key, char *dest, size_t size)
+{
+	snprintf(dest, size, "%s/%016lx.tiles", g_tile_cache.directory, (unsigned long)key);
+}
+
+static void get_tile_location(uint64_t terrain_index, uint64_t *region_key, int *slot)
+{
+	uint32_t x = terrain_index % MAX_TERRAIN_BLOCKS;
+	uint32_t z = terrain_index / MAX_TERRAIN_BLOCKS;
+	*region_key = morton_encode(x/TILE_REGION_WIDTH, z/TILE_REGION_WIDTH);
+	*slot = (int)morton_encode(x%TILE_REGION_WIDTH, z%TILE_REGION_WIDTH);
+}
+
+static int tile_type_index(int type)
+{
+	return (type == TERRAIN_CHUNK_LAND);
+}
+
+static TileRecord *get_tile_record(TileRegion *region, int type, int slot)
+{
+	size_t offset = TILE_REGION_HEADER_SIZE + (((tile_type_index(type)*TILE_REGION_BLOCKS) + slot)*TILE_RECORD_SIZE);
+	return (TileRecord *)(region->data + offset);
+}
+
+/* Moves the region file to the most recently used end of region_files, adding it if it isn't there. Must be called
+ * with the mutex held. */
+static void touch_tile_region_file(uint64_t key)
+{
+	int i = 0;
+	while ((i < g_tile_cache.num_region_files) && (g_tile_cache.region_files[i] != key))
+	{
+		++i;
+	}
+	if (i == g_tile_cache.num_region_files)
+	{
+		if (g_tile_cache.num_region_files == TILE_CACHE_MAX_REGIONS)
+		{
+			/* Only if the file couldn't be evicted. It'll be found again next time the cache starts. */
+			return;
+		}
+		g_tile_cache.num_region_files++;
+	}
+	memmove(&g_tile_cache.region_files[i], 
+		&g_tile_cache.region_files[i+1], 
+		(g_tile_cache.num_region_files - i - 1)*sizeof(uint64_t));
+	g_tile_cache.region_files[g_tile_cache.num_region_files-1] = key;
+}
+
+/* Deletes the least recently used region files until there's room for one more. Regions that are mapped are kept.
+ * Must be called with the mutex held. */
+static void evict_tile_regions(void)
+{
+	int i = 0;
+	while ((g_tile_cache.num_region_files >= TILE_CACHE_MAX_REGIONS) && (i < g_tile_cache.num_region_files))
+	{
+		uint64_t key = g_tile_cache.region_files[i];
+		int in_use = 0;
+		for (int j = 0; j < g_tile_cache.num_regions; ++j)
+		{
+			if (g_tile_cache.regions[j].key == key)
+			{
+				in_use = 1;
+			}
+		}
+		if (in_use)
+		{
+			++i;
+			continue;
+		}
+		char filename[512] = {0};
+		get_region_filename(key, filename, 512);
+		unlink(filename);
+		memmove(&g_tile_cache.region_files[i], 
+			&g_tile_cache.region_files[i+1], 
+			(g_tile_cache.num_region_files - i - 1)*sizeof(uint64_t));
+		g_tile_cache.num_region_files--;
+	}
+}
+
+typedef struct TileRegionFile
+{
+	uint64_t	key;
+	uint64_t	last_used;
+} TileRegionFile;
+
+static int compare_tile_region_files(const void *a, const void *b)
+{
+	uint64_t a_time = ((const TileRegionFile *)a)->last_used;
+	uint64_t b_time = ((const TileRegionFile *)b)->last_used;
+	return (a_time > b_time) - (a_time < b_time);
+}
+
+/* Fills region_files from the directory, oldest first by the time in each header. If there are more files than
+ * TILE_CACHE_MAX_REGIONS (from a bigger limit in an older build, say), the oldest are deleted. */
+static void load_tile_region_files(void)
+{
+	g_tile_cache.num_region_files = 0;
+	DIR *directory = opendir(g_tile_cache.directory);
+	if (directory == NULL)
+	{
+		return;
+	}
+	int num_files = 0;
+	int max_files = TILE_CACHE_MAX_REGIONS;
+	TileRegionFile *files = BG_MALLOC(TileRegionFile, max_files);
+	struct dirent *entry = NULL;
+	while ((entry = readdir(directory)) != NULL)
+	{
+		uint64_t key = 0;
+		char extension[8] = {0};
+		if (sscanf(entry->d_name, "%16lx.%5s", (unsigned long *)&key, extension) != 2 || strcmp(extension, "tiles"))
+		{
+			continue;
+		}
+		char filename[512] = {0};
+		get_region_filename(key, filename, 512);
+		int fd = open(filename, O_RDONLY);
+		TileRegionHeader header = {0};
+		if (fd >= 0)
+		{
+			if (pread(fd, &header, sizeof(header), 0) != sizeof(header))
+			{
+				header.last_used = 0;
+			}
+			close(fd);
+		}
+		if (num_files == max_files)
+		{
+			max_files *= 2;
+			TileRegionFile *new_files = BG_MALLOC(TileRegionFile, max_files);
+			memcpy(new_files, files, num_files*sizeof(TileRegionFile));
+			BG_FREE(files);
+			files = new_files;
+		}
+		files[num_files].key = key;
+		files[num_files].last_used = header.last_used;
+		num_files++;
+	}
+	closedir(directory);
+
+	qsort(files, num_files, sizeof(TileRegionFile), compare_tile_region_files);
+	int first_kept = (num_files > TILE_CACHE_MAX_REGIONS) ? num_files - TILE_CACHE_MAX_REGIONS : 0;
+	for (int i = 0; i < num_files; ++i)
+	{
+		if (i < first_kept)
+		{
+			char filename[512] = {0};
+			get_region_filename(files[i].key, filename, 512);
+			unlink(filename);
+			continue;
+		}
+		g_tile_cache.region_files[g_tile_cache.num_region_files++] = files[i].key;
+	}
+	BG_FREE(files);
+}
+
+static void close_tile_region(TileRegion *region)
+{
+	munmap(region->data, region->size);
+	region->data = NULL;
+}
+
+/* Finds the mapped region, mapping it (and creating it if create is set) if it isn't already, and pins it. Returns
+ * NULL if the region doesn't exist and create isn't set. Must be called with the mutex held, and the region has to be
+ * given back with release_tile_region once the blocks have been copied. */
+static TileRegion *open_tile_region(uint64_t key, int create)
+{
+	g_tile_cache.access_counter++;
+	while (1)
+	{
+		int num_unpinned = 0;
+		for (int i = 0; i < g_tile_cache.num_regions; ++i)
+		{
+			if (g_tile_cache.regions[i].key == key)
+			{
+				g_tile_cache.regions[i].last_access = g_tile_cache.access_counter;
+				g_tile_cache.regions[i].refs++;
+				return &g_tile_cache.regions[i];
+			}
+			num_unpinned += (g_tile_cache.regions[i].refs == 0);
+		}
+		if ((g_tile_cache.num_regions < TILE_CACHE_MAX_OPEN_REGIONS) || (num_unpinned > 0))
+		{
+			break;
+		}
+		/* Every mapping is being copied from, so wait for one to be done. Another thread might map this
+		 * region in the meantime, so it's looked for again after. */
+		pthread_cond_wait(&g_tile_cache.region_released, &g_tile_cache.mutex);
+	}
+
+	char filename[512] = {0};
+	get_region_filename(key, filename, 512);
+	if (!file_exists(filename))
+	{
+		if (!create)
+		{
+			return NULL;
+		}
+		evict_tile_regions();
+	}
+	touch_tile_region_file(key);
+	int fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		fprintf(stderr, "open_tile_region error: could not open %s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+	/* ftruncate leaves the file sparse */
+	struct stat file_stat;
+	fstat(fd, &file_stat);
+	if ((size_t)file_stat.st_size != TILE_REGION_FILE_SIZE)
+	{
+		if (ftruncate(fd, 0) || ftruncate(fd, TILE_REGION_FILE_SIZE))
+		{
+			fprintf(stderr, "open_tile_region error: could not resize %s: %s\n", filename, strerror(errno));
+			close(fd);
+			return NULL;
+		}
+	}
+	uint8_t *data = mmap(NULL, TILE_REGION_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "open_tile_region error: could not map %s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+
+	TileRegionHeader *header = (TileRegionHeader *)data;
+	if (memcmp(header->magic, "BGTILES", 8) || (header->version != TILE_CACHE_VERSION) || (header->block_width != HEIGHTMAP_BLOCK_WIDTH))
+	{
+		memset(header, 0, sizeof(TileRegionHeader));
+		strcpy(header->magic, "BGTILES");
+		header->version = TILE_CACHE_VERSION;
+		header->block_width = HEIGHTMAP_BLOCK_WIDTH;
+		header->region_key = key;
+	}
+	header->last_used = (uint64_t)time(NULL);
+
+	/* Replace the least recently used mapping nobody is copying from if they're all taken */
+	TileRegion *region = &g_tile_cache.regions[g_tile_cache.num_regions];
+	if (g_tile_cache.num_regions == TILE_CACHE_MAX_OPEN_REGIONS)
+	{
+		region = NULL;
+		for (int i = 0; i < TILE_CACHE_MAX_OPEN_REGIONS; ++i)
+		{
+			if ((g_tile_cache.regions[i].refs == 0) && 
+			    ((region == NULL) || (g_tile_cache.regions[i].last_access < region->last_access)))
+			{
+				region = &g_tile_cache.regions[i];
+			}
+		}
+		close_tile_region(region);
+	}
+	else
+	{
+		g_tile_cache.num_regions++;
+	}
+	region->key = key;
+	region->data = data;
+	region->size = TILE_REGION_FILE_SIZE;
+	region->last_access = g_tile_cache.access_counter;
+	region->refs = 1;
+	return region;
+}
+
+static void release_tile_region(TileRegion *region)
+{
+	pthread_mutex_lock(&g_tile_cache.mutex);
+	region->refs--;
+	if (region->refs == 0)
+	{
+		pthread_cond_broadcast(&g_tile_cache.region_released);
+	}
+	pthread_mutex_unlock(&g_tile_cache.mutex);
+}
+
+void init_tile_cache(const char *directory)
+{
+	if (g_tile_cache_initialized)
+	{
+		return;
+	}
+	memset(&g_tile_cache, 0, sizeof(TileCache));
+	strncpy(g_tile_cache.directory, directory, 255);
+	if ((mkdir(directory, 0755) != 0) && (errno != EEXIST))
+	{
+		fprintf(stderr, "init_tile_cache error: could not create %s: %s\n", directory, strerror(errno));
+		return;
+	}
+	pthread_mutex_init(&g_tile_cache.mutex, NULL);
+	pthread_cond_init(&g_tile_cache.region_released, NULL);
+	load_tile_region_files();
+	g_tile_cache_initialized = 1;
+}
+
+void free_tile_cache(void)
+{
+	if (!g_tile_cache_initialized)
+	{
+		return;
+	}
+	for (int i = 0; i < g_tile_cache.num_regions; ++i)
+	{
+		close_tile_region(&g_tile_cache.regions[i]);
+	}
+	pthread_mutex_destroy(&g_tile_cache.mutex);
+	pthread_cond_destroy(&g_tile_cache.region_released);
+	g_tile_cache_initialized = 0;
+}
+
+int load_cached_terrain_block(int type, uint64_t terrain_index, EnvironmentCondition *condition, TerrainHeight *dest, int stride)
+{
+	if (!g_tile_cache_initialized)
+	{
+		return 0;
+	}
+	uint64_t key = 0;
+	int slot = 0;
+	get_tile_location(terrain_index, &key, &slot);
+
+	pthread_mutex_lock(&g_tile_cache.mutex);
+	TileRegion *region = open_tile_region(key, 0);
+	TileRegionHeader *header = NULL;
+	if (region != NULL)
+	{
+		header = (TileRegionHeader *)region->data;
+	}
+	if ((header == NULL) || !(header->present[tile_type_index(type)][slot/64] & (1ULL << (slot%64))))
+	{
+		g_tile_cache.num_misses++;
+		pthread_mutex_unlock(&g_tile_cache.mutex);
+		if (region != NULL)
+		{
+			release_tile_region(region);
+		}
+		return 0;
+	}
+
+	g_tile_cache.num_hits++;
+	pthread_mutex_unlock(&g_tile_cache.mutex);
+
+	/* The present bit is only set once a block is all there, and blocks aren't changed after that (except by the
+	 * same heights being stored again), so the copy doesn't need the mutex */
+	TileRecord *record = get_tile_record(region, type, slot);
+	for (int z = 0; z < HEIGHTMAP_BLOCK_WIDTH; ++z)
+	{
+		memcpy(&dest[z*stride], &record->heights[z*HEIGHTMAP_BLOCK_WIDTH], HEIGHTMAP_BLOCK_WIDTH*sizeof(TerrainHeight));
+	}
+	if (condition != NULL)
+	{
+		condition->temperature = record->temperature;
+		condition->precipitation = record->precipitation;
+	}
+	release_tile_region(region);
+	return 1;
+}
+
+void store_cached_terrain_block(int type, uint64_t terrain_index, EnvironmentCondition condition, TerrainHeight *src, int stride)
+{
+	if (!g_tile_cache_initialized)
+	{
+		return;
+	}
+	uint64_t key = 0;
+	int slot = 0;
+	get_tile_location(terrain_index, &key, &slot);
+
+	pthread_mutex_lock(&g_tile_cache.mutex);
+	TileRegion *region = open_tile_region(key, 1);
+	if (region == NULL)
+	{
+		pthread_mutex_unlock(&g_tile_cache.mutex);
+		return;
+	}
+	pthread_mutex_unlock(&g_tile_cache.mutex);
+
+	TileRecord *record = get_tile_record(region, type, slot);
+	record->temperature = condition.temperature;
+	record->precipitation = condition.precipitation;
+	for (int z = 0; z < HEIGHTMAP_BLOCK_WIDTH; ++z)
+	{
+		memcpy(&record->heights[z*HEIGHTMAP_BLOCK_WIDTH], &src[z*stride], HEIGHTMAP_BLOCK_WIDTH*sizeof(TerrainHeight));
+	}
+	/* The block is only marked as present once it's all there */
+	pthread_mutex_lock(&g_tile_cache.mutex);
+	TileRegionHeader *header = (TileRegionHeader *)region->data;
+	header->present[tile_type_index(type)][slot/64] |= (1ULL << (slot%64));
+	pthread_mutex_unlock(&g_tile_cache.mutex);
+	release_tile_region(region);
+}
+
+static void prewarm_block_job(void *arg)
+{
+	PrewarmJob *job = (PrewarmJob *)arg;
+	load_or_generate_terrain_block(TERRAIN_CHUNK_LAND, job->terrain_index, job->condition, job->heights, HEIGHTMAP_BLOCK_WIDTH);
+	load_or_generate_terrain_block(TERRAIN_CHUNK_WATER, job->terrain_index, job->condition, job->heights, HEIGHTMAP_BLOCK_WIDTH);
+}
+
+void prewarm_tile_cache(uint64_t x_min, uint64_t z_min, uint64_t x_max, uint64_t z_max)
+{
+	if ((x_max >= MAX_TERRAIN_BLOCKS) || (z_max >= MAX_TERRAIN_BLOCKS) || (x_min > x_max) || (z_min > z_max))
+	{
+		fprintf(stderr, "prewarm_tile_cache error: invalid region (%lu, %lu) to (%lu, %lu)\n", 
+			(unsigned long)x_min, (unsigned long)z_min, (unsigned long)x_max, (unsigned long)z_max);
+		exit(-1);
+	}
+	ThreadPool *pool = create_thread_pool(0);
+	int row_length = (int)(x_max - x_min) + 1;
+	PrewarmJob *jobs = BG_MALLOC(PrewarmJob, row_length);
+	for (int i = 0; i < row_length; ++i)
+	{
+		jobs[i].heights = BG_MALLOC(TerrainHeight, HEIGHTMAP_BLOCK_WIDTH*HEIGHTMAP_BLOCK_WIDTH);
+	}
+
+	for (uint64_t z = z_min; z <= z_max; ++z)
+	{
+		for (int i = 0; i < row_length; ++i)
+		{
+			jobs[i].terrain_index = (z*MAX_TERRAIN_BLOCKS) + x_min + i;
+			jobs[i].condition = get_environment_condition(jobs[i].terrain_index);
+			thread_pool_submit(pool, prewarm_block_job, &jobs[i]);
+		}
+		thread_pool_wait(pool);
+		printf("Prewarmed row %lu of %lu\n", (unsigned long)(z - z_min + 1), (unsigned long)(z_max - z_min + 1));
+	}
+
+	for (int i = 0; i < row_length; ++i)
+	{
+		BG_FREE(jobs[i].heights);
+	}
+	BG_FREE(jobs);
+	free_thread_pool(pool);
+}
+
+void get_tile_cache_stats(int *hits, int *misses)
+{
+	*hits = 0;
+	*misses = 0;
+	if (!g_tile_cache_initialized)
+	{
+		return;
+	}
+	pthread_mutex_lock(&g_tile_cache.mutex);
+	*hits = g_tile_cache.num_hits;
+	*misses = g_tile_cache.num_misses;
+	pthread_mutex_unlock(&g_tile_cache.mutex);
+}
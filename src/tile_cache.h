@@ -0,0 +1,102 @@
+/*
+    Bio-Game is a game for designing your own organism. 
+    Copyright (C) 2022 John Engel 
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TILE_CACHE_H__
+#define __TILE_CACHE_H__
+#include <pthread.h>
+#include "environment.h"
+#include "terrain.h"
+
+/* Generated terrain blocks are cached on disk, in region files of TILE_REGION_WIDTH*TILE_REGION_WIDTH blocks.
+ * Region files are named after the Morton code of the region's coordinates, and the blocks inside a region
+ * are stored in Morton order too, so blocks that are near each other in the world are near each other on disk.
+ * The region files are sparse and memory mapped -- only blocks that have actually been stored take up space. */
+#define TILE_CACHE_DIRECTORY "tile_cache"
+#define TILE_REGION_WIDTH 16
+#define TILE_REGION_BLOCKS (TILE_REGION_WIDTH*TILE_REGION_WIDTH)
+/* Bump this whenever the generator or TerrainHeight changes, so old caches aren't used */
+#define TILE_CACHE_VERSION 5
+/* The most region files kept on disk. When there are more, the least recently used ones are deleted. */
+#define TILE_CACHE_MAX_REGIONS 64
+/* The most region files mapped at once */
+#define TILE_CACHE_MAX_OPEN_REGIONS 16
+#define TILE_REGION_HEADER_SIZE 4096
+
+typedef struct TileRegionHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	block_width;
+	uint64_t	region_key;
+	/* Seconds since the epoch when the region was last opened, for LRU eviction */
+	uint64_t	last_used;
+	/* One bit per block, for land and water */
+	uint64_t	present[2][TILE_REGION_BLOCKS/64];
+} TileRegionHeader;
+
+typedef struct TileRecord
+{
+	int32_t		temperature;
+	float		precipitation;
+	int32_t		padding[2];
+	TerrainHeight	heights[];
+} TileRecord;
+
+typedef struct TileRegion
+{
+	uint64_t	key;
+	uint8_t		*data;
+	size_t		size;
+	uint64_t	last_access;
+	/* How many threads are copying blocks in or out of the mapping right now. The blocks are copied without the
+	 * mutex held, so a region isn't unmapped to make room for another until this is back to 0. */
+	int		refs;
+} TileRegion;
+
+typedef struct TileCache
+{
+	char		directory[256];
+	TileRegion	regions[TILE_CACHE_MAX_OPEN_REGIONS];
+	int		num_regions;
+	uint64_t	access_counter;
+	/* The mutex only covers finding, mapping and unmapping regions, and the present bits */
+	pthread_mutex_t	mutex;
+	/* Signaled when a region's refs drops to 0, for threads waiting for a mapping to free up */
+	pthread_cond_t	region_released;
+	/* The region files on disk, least recently used first. It's read from the directory once, in
+	 * init_tile_cache, and kept up to date after that. */
+	uint64_t	region_files[TILE_CACHE_MAX_REGIONS];
+	int		num_region_files;
+	int		num_hits;
+	int		num_misses;
+} TileCache;
+
+void init_tile_cache(const char *directory);
+void free_tile_cache(void);
+
+/* Copies a cached block into dest (stride is the width of dest in texels) and returns 1, or returns 0 if the block
+ * isn't cached. If condition isn't NULL, the block's temperature and precipitation are written to it. These are
+ * thread safe, and do nothing if init_tile_cache hasn't been called. */
+int load_cached_terrain_block(int type, uint64_t terrain_index, EnvironmentCondition *condition, TerrainHeight *dest, int stride);
+void store_cached_terrain_block(int type, uint64_t terrain_index, EnvironmentCondition condition, TerrainHeight *src, int stride);
+
+/* Generates and stores every block with x_min <= x index <= x_max and z_min <= z index <= z_max. */
+void prewarm_tile_cache(uint64_t x_min, uint64_t z_min, uint64_t x_max, uint64_t z_max);
+void get_tile_cache_stats(int *hits, int *misses);
+uint64_t morton_encode(uint32_t x, uint32_t z);
+#endif
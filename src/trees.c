@@ -6,6 +6,7 @@
 #include "environment.h"
 #include "terrain_collisions.h"
 #include "noise.h"
+#include "plant_noise.h"
 #include "terrain.h"
 #include "trees.h"
 
@@ -118,8 +119,8 @@ void B_draw_canopy(Plant canopy,
 		   int mesh_id,
 		   float scale_factor,
 		   unsigned int size,
-		   TerrainChunk *chunk,
 		   vec2 base_offset, 
+		   float terrain_height,
 		   int x_offset,
 		   int z_offset,
 		   mat4 projection_view)
@@ -134,7 +135,7 @@ void B_draw_canopy(Plant canopy,
 	vec3 offset = GLM_VEC3_ZERO_INIT;
 	offset[0] = base_offset[0] + (x_offset * (TERRAIN_XZ_SCALE*4));
 	offset[2] = base_offset[1] + (z_offset * (TERRAIN_XZ_SCALE*4));
-	offset[1] = get_terrain_height(offset, chunk) + 100.0f;
+	offset[1] = terrain_height + 100.0f;
 
 	float max_distance = 700.0f;
 	if (USE_ALT_CAMERA)
@@ -158,6 +159,7 @@ void B_draw_canopy(Plant canopy,
 	glBindFramebuffer(GL_FRAMEBUFFER, canopy.meshes[mesh_id].g_buffer);
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, canopy.meshes[mesh_id].heightmap);
+	B_bind_plant_noise(canopy.meshes[mesh_id].shaders[0]);
 
 	B_set_uniform_float(canopy.meshes[mesh_id].shaders[0], "max_distance", max_distance);
 	B_set_uniform_uint(canopy.meshes[mesh_id].shaders[0], "total", (unsigned int)size);
@@ -260,8 +262,8 @@ void B_draw_generated_tree_trunk(Plant tree,
 		                 uint64_t terrain_index,
 		                 int mesh_id,
 		                 float scale_factor,
-		                 TerrainChunk *chunk,
 		                 vec2 base_offset, 
+		                 float terrain_height,
 		                 int x_offset,
 		                 int z_offset,
 		                 mat4 projection_view)
@@ -276,7 +278,7 @@ void B_draw_generated_tree_trunk(Plant tree,
 	vec3 offset = GLM_VEC3_ZERO_INIT;
 	offset[0] = base_offset[0] + (x_offset * (TERRAIN_XZ_SCALE*4));
 	offset[2] = base_offset[1] + (z_offset * (TERRAIN_XZ_SCALE*4));
-	offset[1] = get_terrain_height(offset, chunk);
+	offset[1] = terrain_height;
 
         float max_distance = 700.0f;
         vec4 frustum_planes[6];
@@ -308,6 +310,7 @@ void B_draw_generated_tree_trunk(Plant tree,
 	unsigned int block_z = (int)(terrain_index / MAX_TERRAIN_BLOCKS) & 0xff;
 	unsigned int block = (block_x + block_z);
 
+	B_bind_plant_noise(tree.meshes[mesh_id].shaders[0]);
 	B_set_uniform_float(tree.meshes[mesh_id].shaders[0], "max_distance", max_distance);
 	B_set_uniform_float(tree.meshes[mesh_id].shaders[0], "scale_factor", scale_factor);
 	B_set_uniform_uint(tree.meshes[mesh_id].shaders[0], "block", (unsigned int)block/20);
@@ -331,6 +334,7 @@ void B_draw_generated_tree_trunk(Plant tree,
 		glDrawArraysInstanced(GL_TRIANGLES, 0, tree.meshes[mesh_id].num_vertices, block/20);
 	}
 
+	B_bind_plant_noise(tree.meshes[mesh_id].shaders[1]);
 	B_set_uniform_float(tree.meshes[mesh_id].shaders[1], "max_distance", max_distance);
 	B_set_uniform_float(tree.meshes[mesh_id].shaders[1], "scale_factor", scale_factor);
 	B_set_uniform_uint(tree.meshes[mesh_id].shaders[1], "block", (unsigned int)block/20);
@@ -362,8 +366,8 @@ void B_draw_generated_tree_trunk(Plant tree,
 void B_draw_tree_trunk(Plant tree, 
 		   int mesh_id,
 		   float scale_factor,
-		   TerrainChunk *chunk,
 		   vec2 base_offset, 
+		   float terrain_height,
 		   int x_offset,
 		   int z_offset,
 		   mat4 projection_view)
@@ -378,7 +382,7 @@ void B_draw_tree_trunk(Plant tree,
 	vec3 offset = GLM_VEC3_ZERO_INIT;
 	offset[0] = base_offset[0] + (x_offset * (TERRAIN_XZ_SCALE*4));
 	offset[2] = base_offset[1] + (z_offset * (TERRAIN_XZ_SCALE*4));
-	offset[1] = get_terrain_height(offset, chunk) + scale_factor;
+	offset[1] = terrain_height + scale_factor;
 	
 	glBindFramebuffer(GL_FRAMEBUFFER, tree.meshes[mesh_id].g_buffer);
 	glActiveTexture(GL_TEXTURE0);
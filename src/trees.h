@@ -15,8 +15,8 @@ void B_draw_canopy(Plant canopy,
 		   int mesh_id, 
 		   float scale_factor, 
 		   unsigned int size,
-		   TerrainChunk *chunk, 
 		   vec2 base_offset, 
+		   float terrain_height,
 		   int x_offset, 
 		   int z_offset, 
 		   mat4 projection_view);
@@ -24,8 +24,8 @@ void B_draw_canopy(Plant canopy,
 void B_draw_tree_trunk(Plant tree, 
 		   int mesh_id,
 		   float scale_factor,
-		   TerrainChunk *chunk,
 		   vec2 base_offset, 
+		   float terrain_height,
 		   int x_offset,
 		   int z_offset,
 		   mat4 projection_view);
@@ -34,8 +34,8 @@ void B_draw_generated_tree_trunk(Plant tree,
 		                 uint64_t terrain_index,
 		                 int mesh_id,
 		                 float scale_factor,
-		                 TerrainChunk *chunk,
 		                 vec2 base_offset, 
+		                 float terrain_height,
 		                 int x_offset,
 		                 int z_offset,
 		                 mat4 projection_view);
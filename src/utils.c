@@ -209,6 +209,15 @@ int maxi(int a, int b)
 	return b;
 }
 
+int mini(int a, int b)
+{
+	if (a < b)
+	{
+		return a;
+	}
+	return b;
+}
+
 size_t mins(size_t a, size_t b)
 {
 	if (a < b)
@@ -82,6 +82,7 @@ float bilinearly_interpolate_float(float x0,
 
 int B_load_file(const char *filename, char *buff, int size);
 int maxi(int a, int b);
+int mini(int a, int b);
 size_t mins(size_t a, size_t b);
 
 /* Gets the distance between two substrings in a bigger string.